@@ -6,33 +6,87 @@
 #include <stdbool.h>
 #include <time.h>
 
+// Lock a keyed command needs on the shard of its key (first argument)
+typedef enum
+{
+    CMD_LOCK_NONE,      // Command does not touch a single key
+    CMD_LOCK_SHARED,    // Read-only command
+    CMD_LOCK_EXCLUSIVE  // Command modifies the keyspace
+} CommandLock;
+
+CommandLock command_lock_mode(const char *command);
+
+// Whether a keyed command may allocate memory, so it needs room under
+// maxmemory (db_ensure_memory) before it runs
+bool command_may_grow_memory(const char *command);
+
+// Outcome of SET with options
+typedef enum
+{
+    SET_OK,
+    SET_NOT_PERFORMED,  // NX or XX condition did not hold
+    SET_SYNTAX_ERROR,   // Unknown or conflicting option
+    SET_INVALID_EXPIRE  // EX/PX value is not a positive integer or too large
+} SetResult;
+
+// Outcome of SCAN and HSCAN
+typedef enum
+{
+    SCAN_OK,
+    SCAN_INVALID_CURSOR, // Cursor is not a non-negative integer
+    SCAN_SYNTAX_ERROR,   // Unknown option, missing value or COUNT below 1
+    SCAN_WRONG_TYPE      // HSCAN of a key that does not hold a hash
+} ScanResult;
+
 // KV Store string implementations
-void set_command(Database *db, const char *key, const char *value);
-char *get_command(Database *db, const char *key);
-bool exists_command(Database *db, const char *key);
-bool del_command(Database *db, const char *key);
-bool incr_command(Database *db, const char *key, int *new_value);
-bool decr_command(Database *db, const char *key, int *new_value);
+SetResult set_command(Database *db, sds key, sds value, sds *options, int option_count);
+bool get_command(Database *db, sds key, DbString *value);
+bool exists_command(Database *db, sds key);
+bool del_command(Database *db, sds key);
+bool unlink_command(Database *db, sds key);
+bool incr_command(Database *db, sds key, int64_t *new_value);
+bool decr_command(Database *db, sds key, int64_t *new_value);
+bool incrby_command(Database *db, sds key, int64_t increment, int64_t *new_value);
+bool decrby_command(Database *db, sds key, int64_t decrement, int64_t *new_value);
 
 // TTL command implementations
-bool expire_command(Database *db, const char *key, int seconds);
-int ttl_command(Database *db, const char *key);
-bool persist_command(Database *db, const char *key);
+bool expire_command(Database *db, sds key, int seconds);
+bool pexpire_command(Database *db, sds key, int64_t milliseconds);
+bool pexpireat_command(Database *db, sds key, int64_t timestamp);
+int64_t ttl_command(Database *db, sds key);
+int64_t pttl_command(Database *db, sds key);
+bool persist_command(Database *db, sds key);
 
 // List commands
-bool lpush_command(Database *db, const char *key, const char *value);
-bool rpush_command(Database *db, const char *key, const char *value);
-char *lpop_command(Database *db, const char *key);
-char *rpop_command(Database *db, const char *key);
-char **lrange_command(Database *db, const char *key, int start, int stop, int *count);
-int llen_command(Database *db, const char *key);
+bool lpush_command(Database *db, sds key, sds value);
+bool rpush_command(Database *db, sds key, sds value);
+sds lpop_command(Database *db, sds key);
+sds rpop_command(Database *db, sds key);
+size_t lrange_command(Database *db, sds key, int start, int stop, DbListRange *range);
+int llen_command(Database *db, sds key);
 
 // Hash comamnds
-bool hset_command(Database *db, const char *key, const char *field, const char *value);
-char *hget_command(Database *db, const char *key, const char *field);
-char **hgetall_command(Database *db, const char *key, int *count);
-bool hdel_command(Database *db, const char *key, const char *field);
-bool hexists_command(Database *db, const char *key, const char *field);
+bool hset_command(Database *db, sds key, sds field, sds value);
+bool hget_command(Database *db, sds key, sds field, DbString *value);
+size_t hgetall_command(Database *db, sds key, HashIterator *it);
+bool hdel_command(Database *db, sds key, sds field);
+bool hexists_command(Database *db, sds key, sds field);
+
+// Introspection and configuration commands
+const char *object_encoding_command(Database *db, sds key);
+bool memory_usage_command(Database *db, sds key, size_t *bytes);
+sds *config_get_command(Database *db, sds pattern, int *count);
+bool config_set_command(Database *db, sds name, sds value);
+bool flushall_command(Database *db, sds *options, int option_count);
+
+// Cursor scans: *cursor is set to the next cursor (0 when done) and the
+// keys, or field/value pairs, found are returned in a new array
+ScanResult scan_command(Database *db, sds cursor_arg, sds *options, int option_count, uint64_t *cursor,
+                        sds **keys, int *found);
+ScanResult hscan_command(Database *db, sds key, sds cursor_arg, sds *options, int option_count,
+                         uint64_t *cursor, sds **pairs, int *found);
+sds *keys_command(Database *db, sds pattern, int *count);
+bool prefixcount_command(Database *db, sds prefix, size_t *count);
 
 // Pub/Sub commands
 bool subscribe_command(PubSubManager *pubsub, int client_socket, const char *channel);
@@ -1,11 +1,41 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include "keyspace.h"
+#include "listpack.h"
+#include "memtrack.h"
+#include "quicklist.h"
+#include "radix.h"
+#include "sds.h"
+#include "slab.h"
+#include "timewheel.h"
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 
-// Hash table size
-#define HASH_TABLE_SIZE 1024
+// Default and maximum number of independently locked keyspace shards
+#define DB_DEFAULT_SHARDS 16
+#define DB_MAX_SHARDS 1024
+
+// Default limits for the compact hash encoding
+#define DB_HASH_MAX_ENTRIES 128
+#define DB_HASH_MAX_VALUE 64
+
+// Keys sampled per eviction by default
+#define DB_MAXMEMORY_SAMPLES 5
+
+// Which keys are evicted when the database is over maxmemory
+typedef enum
+{
+    EVICT_NOEVICTION,   // Refuse commands that may grow memory instead
+    EVICT_ALLKEYS_LRU,  // Least recently used key
+    EVICT_VOLATILE_LRU, // Least recently used key with an expiration
+    EVICT_ALLKEYS_LFU,  // Least frequently used key
+    EVICT_VOLATILE_LFU, // Least frequently used key with an expiration
+    EVICT_VOLATILE_TTL  // Key with the nearest expiration
+} EvictionPolicy;
 
 // Value type
 typedef enum
@@ -15,96 +45,356 @@ typedef enum
     VALUE_HASH
 } ValueType;
 
-// Hash structure
+// Encodings of a hash value
+typedef enum
+{
+    HASH_ENC_LISTPACK, // Small hash: field, value, ... packed in a Listpack
+    HASH_ENC_TABLE     // Hash table of HashField
+} HashEncoding;
+
+// Hash table structure
 typedef struct HashField
 {
-    char *field;
-    char *value;
+    sds field;
+    sds value;
+    uint64_t hash; // Cached hash of the field name
     struct HashField *next;
 } HashField;
 
+// Field table that grows and shrinks with its field count. Like the
+// chained keyspace, resizing is incremental: while rehash_index != -1
+// fields live in both tables and each write migrates a few buckets from
+// table[0] to table[1]. Reads never migrate, so they are safe under a
+// shared shard lock.
 typedef struct
 {
-    HashField **buckets;
-    size_t bucket_count;
-    size_t field_count;
+    HashField **table[2]; // table[1] is only allocated while rehashing
+    size_t size[2];       // Bucket count of each table (power of two)
+    size_t used[2];       // Number of fields stored in each table
+    long rehash_index;    // Next bucket of table[0] to migrate (-1 = not rehashing)
 } Hash;
 
-// List node structure for doubly linked list
-typedef struct ListNode
+// String values up to this many bytes are stored inline in their entry
+#define DB_INLINE_VALUE_MAX 256
+
+// Encodings of a string value
+typedef enum
 {
-    char *data;
-    struct ListNode *prev;
-    struct ListNode *next;
-} ListNode;
+    STRING_ENC_EMBSTR, // sds stored inline in the entry
+    STRING_ENC_RAW,    // Separately allocated sds
+    STRING_ENC_INT     // Canonical decimal integer kept in int_value
+} StringEncoding;
+
+// Bytes needed to format any int64_t, including the terminator
+#define DB_INT_BUF_SIZE 21
 
-// List Structure
+// Read-only view of a string value. Integer-encoded values are formatted
+// into buf on read; otherwise data points into the database.
 typedef struct
 {
-    ListNode *head;
-    ListNode *tail;
-    size_t length;
-} List;
+    const char *data;
+    size_t len;
+    char buf[DB_INT_BUF_SIZE];
+} DbString;
 
-// Entry structure to store key-value pairs for different value types
+// Entry structure to store key-value pairs for different value types.
+// An entry is a single allocation: the key bytes follow the struct, and a
+// string value of at most DB_INLINE_VALUE_MAX bytes follows the key as an
+// sds; larger values and lists/hashes are allocated separately. Strings
+// that are canonical 64-bit integers are stored as int_value instead.
+// Keys that have been given an expiration are reallocated with a pointer to
+// their timer in front of the struct, so keys without one pay nothing.
 typedef struct Entry
 {
-    char *key;
-    ValueType type;
+    uint64_t hash; // Cached hash of the key, reused on lookups and resizes
     union
     {
-        char *string_value;
+        sds string_value;
+        int64_t int_value;
         List *list_value;
         Hash *hash_value;
+        Listpack *listpack_value;
     } value;
-    time_t expiration; // (0 = no expiration)
-    struct Entry *next;
+#ifndef KV_KEYSPACE_SWISS
+    struct Entry *next; // Bucket chain link (chained keyspace engine only)
+#endif
+    uint32_t key_len;
+    uint32_t access;      // LRU clock or LFU counter, see db_touch_entry
+    uint8_t type;         // ValueType
+    uint8_t encoding;     // StringEncoding or HashEncoding
+    uint8_t timer_prefix; // Preceded by a TimerNode pointer (NULL once persisted)
+    char key[];           // key_len bytes plus NUL, then the inline value
 } Entry;
 
+// Expiration timer of an entry, NULL if it has none
+static inline TimerNode *db_entry_timer(const Entry *entry)
+{
+    return entry->timer_prefix ? ((TimerNode *const *)entry)[-1] : NULL;
+}
+
+// Expiration time of an entry in Unix milliseconds (0 = no expiration)
+static inline int64_t db_entry_expiration(const Entry *entry)
+{
+    const TimerNode *timer = db_entry_timer(entry);
+    return timer ? timer->when : 0;
+}
+
+// Keyspace shard: a table of entries guarded by its own reader/writer lock.
+// Entries, list chunks, hash fields and the strings they own are allocated
+// from the shard's slab pool. Entries with an expiration have a timer in
+// the shard's timing wheel, whose owner is the entry. With the key index
+// enabled, the keys are also kept in order in a radix tree.
+typedef struct
+{
+    Keyspace keys; // Key -> Entry table (engine selected at build time)
+    SlabPool pool;
+    pthread_rwlock_t lock;
+    TimerWheel expires;    // Expiration times, in Unix milliseconds
+    RadixTree index;       // Ordered key index, empty when disabled
+    size_t expired_active; // Keys removed by the active expire cycle
+    size_t expired_lazy;   // Keys removed when found expired on access
+    size_t evicted;        // Keys removed to stay under maxmemory
+} DbShard;
+
+// Runtime settings, changed with CONFIG SET under all shard locks
+typedef struct
+{
+    size_t hash_max_entries; // Hashes with more fields use a table
+    size_t hash_max_value;   // Hashes with a longer field or value use a table
+    size_t maxmemory;         // Limit of the database memory of all shards, in bytes (0 = none)
+    size_t maxmemory_policy;  // EvictionPolicy
+    size_t maxmemory_samples; // Keys compared per eviction
+    size_t lazyfree_user_del;   // DEL frees large values in the background, like UNLINK
+    size_t lazyfree_server_del; // So do overwrites and expirations
+    size_t key_index;           // Keep an ordered index of the keys (see db_apply_config)
+} DbConfig;
+
+typedef struct LazyFreeJob LazyFreeJob;
+
+// Background freeing of large values and flushed tables. Jobs are queued
+// by writers under their shard's exclusive lock; the lazy free thread frees
+// each job in bounded steps, taking the shard's exclusive lock for every
+// step, so neither the writer nor other clients of the shard wait for the
+// whole job.
+typedef struct
+{
+    pthread_mutex_t mutex; // Guards the queue and counters
+    pthread_cond_t cond;
+    pthread_t thread;
+    LazyFreeJob *head;
+    LazyFreeJob *tail;
+    size_t pending; // Jobs queued or in progress
+    size_t freed;   // Jobs completed
+    bool stopping;
+} LazyFree;
+
 // Database structure
+// Keys are spread over shards by hash. The db_* functions do not lock:
+// concurrent callers hold the key's shard lock (db_lock_key) around each
+// call and any use of the pointers it returns - shared for read-only
+// functions, exclusive for functions that modify the keyspace.
 typedef struct
 {
-    Entry *hash_table[HASH_TABLE_SIZE];
+    DbShard *shards;
+    size_t shard_count;
+    DbConfig config;
+    size_t expire_shard; // Next shard visited by the active expire cycle
+    LazyFree lazyfree;
+    bool indexed; // The shards' key indexes are maintained
 } Database;
 
-// Hash function
-unsigned int hash(const char *key);
+// Conditions of db_set_with_options
+#define DB_SET_NX 1 // Only set a key that does not exist
+#define DB_SET_XX 2 // Only set a key that already exists
+
+// Expiration counters summed over all shards
+typedef struct
+{
+    size_t expires;        // Keys with an expiration
+    size_t expired_active; // Keys removed by the active expire cycle
+    size_t expired_lazy;   // Keys removed when found expired on access
+} DbExpireStats;
+
+// Iterator over every entry of every shard, valid while a table is being
+// resized. The database must not be modified while iterating.
+typedef struct
+{
+    Database *db;
+    size_t shard;
+    KsIterator keys;
+} DbIterator;
+
+// Iterator over the field/value pairs of a hash entry; the hash must not be
+// modified while iterating
+typedef struct
+{
+    const Entry *entry;
+    int table;              // Table being walked (table encoding)
+    size_t bucket;          // Next bucket (table encoding)
+    const HashField *field; // Next field in the bucket (table encoding)
+    size_t offset;          // Next field (listpack encoding)
+} HashIterator;
+
+// Iterator over a range of list elements, read in place; the list must not
+// be modified while iterating
+typedef struct
+{
+    ListIterator it;
+    size_t remaining; // Elements left in the range
+} DbListRange;
+
+// Filter of db_scan and db_hscan, applied to the keys or fields visited
+typedef struct
+{
+    const char *pattern; // Glob pattern, NULL to keep everything
+    size_t pattern_len;
+    int type; // ValueType of the keys to keep, -1 for any (db_scan only)
+} DbScanFilter;
 
 // Database functions
-Database *db_create();
+Database *db_create(size_t shard_count);
 void db_free(Database *db);
+void db_clear(Database *db);
+// Remove every key (caller holds all shard locks exclusively). With async
+// set, the tables are detached at once and freed by the lazy free thread.
+void db_flush(Database *db, bool async);
+// Bring state derived from the configuration in line with it (caller holds
+// all shard locks exclusively): builds the key index from every key when
+// key_index is turned on, or frees it when turned off. False if memory ran
+// out, in which case the index stays disabled.
+bool db_apply_config(Database *db);
+// Lazy free jobs waiting or in progress, and completed
+void db_lazyfree_stats(Database *db, size_t *pending, size_t *freed);
+size_t db_size(Database *db);
 void db_cleanup_expired(Database *db);
 bool db_is_expired(Entry *entry);
 
+// Active expiration: remove the keys whose expiration time has passed,
+// visiting shards round-robin until they are all done or budget_us
+// microseconds have passed. Takes each shard's exclusive lock itself, one
+// shard at a time; only one thread may run cycles. Returns the number of
+// keys removed.
+size_t db_active_expire_cycle(Database *db, long budget_us);
+
+// Expiration counters (caller holds all shard locks)
+void db_expire_stats(Database *db, DbExpireStats *stats);
+
+// Eviction: make room before a command that may grow memory (caller holds
+// the exclusive lock of key's shard). While the database memory of all
+// shards together is over maxmemory, keys chosen by the policy among a few
+// sampled ones are removed, from key's shard first and then from the other
+// shards whose lock is free. Returns false if memory stays over the limit,
+// which is always the case under noeviction.
+bool db_ensure_memory(Database *db, const char *key, size_t key_len);
+
+// Keys evicted so far (caller holds all shard locks)
+size_t db_evicted_keys(Database *db);
+
+// Bytes used by the key's entry, its value, its expiration timer and its
+// share of the key table (MEMORY USAGE); false if the key does not exist
+bool db_memory_usage(Database *db, const char *key, size_t key_len, size_t *bytes);
+
+// Eviction policy names as used by CONFIG; -1 for an unknown name
+const char *db_eviction_policy_name(size_t policy);
+int db_eviction_policy_from_name(const char *name);
+
+// Shard locking for concurrent callers
+void db_lock_key(Database *db, const char *key, size_t key_len, bool exclusive);
+void db_unlock_key(Database *db, const char *key, size_t key_len);
+void db_lock_all(Database *db, bool exclusive);
+void db_unlock_all(Database *db);
+
+// Slab usage of all shards (caller holds all shard locks)
+void db_slab_stats(Database *db, SlabStats *stats);
+
+// Iteration over all entries
+void db_iterator_init(DbIterator *it, Database *db);
+Entry *db_iterator_next(DbIterator *it);
+
+// Cursor scan (SCAN): one step from *cursor, which is updated to the next
+// cursor, 0 once every shard has been scanned. A step visits buckets of
+// one shard until about count keys have been looked at, holding that
+// shard's shared lock itself. Returns copies of the live keys passing the
+// filter (*found of them), NULL if there are none. Every key present for
+// the whole scan is returned at least once, some may be returned twice.
+// With the key index and a pattern starting with literal bytes, a step at
+// the start of a shard visits just the shard's keys with that prefix and
+// returns all the matching ones.
+sds *db_scan(Database *db, uint64_t *cursor, size_t count, const DbScanFilter *filter, int *found);
+
+// Every live key matching a glob pattern (KEYS), shard by shard under each
+// shard's shared lock. With the key index, a pattern starting with literal
+// bytes only visits the keys with that prefix.
+sds *db_keys(Database *db, const char *pattern, size_t pattern_len, int *found);
+
+// Number of keys starting with prefix, expired ones not removed yet
+// included, in time proportional to the prefix length. Locks each shard
+// shared itself. False if the key index is disabled.
+bool db_count_prefix(Database *db, const char *prefix, size_t prefix_len, size_t *count);
+
+// Iteration over the fields of a hash entry
+size_t db_hash_length(const Entry *entry);
+void db_hash_iterator_init(HashIterator *it, const Entry *entry);
+bool db_hash_iterator_next(HashIterator *it, DbString *field, DbString *value);
+
+// Name of the encoding of the value at key (OBJECT ENCODING), NULL if missing
+const char *db_object_encoding(Database *db, const char *key, size_t key_len);
+
+// Keys, values and fields are binary safe and passed with their length.
+// Values returned as DbString point into the database; returned arrays and
+// popped values are copies released with sds_free.
+
 // Function prototypes for string operations
-void db_set(Database *db, const char *key, const char *value);
-char *db_get(Database *db, const char *key);
-bool db_exists(Database *db, const char *key);
-bool db_delete(Database *db, const char *key);
+void db_set(Database *db, const char *key, size_t key_len, const char *value, size_t value_len);
+// SET with options: flags are DB_SET_* conditions and a non-zero
+// expiration replaces the key's TTL. Returns false if the condition does not
+// hold (the key is left untouched) or memory runs out.
+bool db_set_with_options(Database *db, const char *key, size_t key_len, const char *value, size_t value_len,
+                         int flags, int64_t expiration);
+bool db_get(Database *db, const char *key, size_t key_len, DbString *out);
+bool db_incrby(Database *db, const char *key, size_t key_len, int64_t delta, int64_t *result);
+bool db_exists(Database *db, const char *key, size_t key_len);
+bool db_delete(Database *db, const char *key, size_t key_len);
+// Remove a key at once and free a large value in the background (UNLINK)
+bool db_unlink(Database *db, const char *key, size_t key_len);
 
-// TTL-related function prototypes
-void db_set_expiration(Database *db, const char *key, time_t expiration);
-time_t db_get_expiration(Database *db, const char *key);
-bool db_remove_expiration(Database *db, const char *key);
+// TTL-related function prototypes. Expiration times are Unix milliseconds,
+// compared against the calling thread's cached clock (clock_cached_ms).
+void db_set_expiration(Database *db, const char *key, size_t key_len, int64_t expiration);
+int64_t db_get_expiration(Database *db, const char *key, size_t key_len);
+bool db_remove_expiration(Database *db, const char *key, size_t key_len);
 
 // Function prototypes for list operations
-bool db_lpush(Database *db, const char *key, const char *value);
-bool db_rpush(Database *db, const char *key, const char *value);
-char *db_lpop(Database *db, const char *key);
-char *db_rpop(Database *db, const char *key);
-char **db_lrange(Database *db, const char *key, int start, int stop, int *count);
-int db_llen(Database *db, const char *key);
-List *create_list(void);
-void free_list_node(ListNode *node);
-void free_list(List *list);
+bool db_lpush(Database *db, const char *key, size_t key_len, const char *value, size_t value_len);
+bool db_rpush(Database *db, const char *key, size_t key_len, const char *value, size_t value_len);
+sds db_lpop(Database *db, const char *key, size_t key_len);
+sds db_rpop(Database *db, const char *key, size_t key_len);
+// Position range on the elements start to stop (inclusive, negative
+// indexes counting from the end) of the list at key, to be read with
+// db_lrange_next. Returns how many there are, 0 if the key is missing or
+// holds another type.
+size_t db_lrange(Database *db, const char *key, size_t key_len, int start, int stop, DbListRange *range);
+bool db_lrange_next(DbListRange *range, DbString *out);
+int db_llen(Database *db, const char *key, size_t key_len);
 
 // Function prototypes for hash operations
-Hash *create_hash();
-void free_hash(Hash *hash);
-bool db_hset(Database *db, const char *key, const char *field, const char *value);
-char *db_hget(Database *db, const char *key, const char *field);
-char **db_hgetall(Database *db, const char *key, int *count);
-bool db_hdel(Database *db, const char *key, const char *field);
-bool db_hexists(Database *db, const char *key, const char *field);
+Hash *create_hash(SlabPool *pool, size_t fields);
+void free_hash(SlabPool *pool, Hash *hash);
+bool db_hset(Database *db, const char *key, size_t key_len, const char *field, size_t field_len,
+             const char *value, size_t value_len);
+bool db_hget(Database *db, const char *key, size_t key_len, const char *field, size_t field_len, DbString *out);
+// Start iterating over the fields of the hash at key (HGETALL) with
+// db_hash_iterator_next. Returns the number of fields, 0 if the key is
+// missing or holds another type, in which case it must not be used.
+size_t db_hgetall(Database *db, const char *key, size_t key_len, HashIterator *it);
+bool db_hdel(Database *db, const char *key, size_t key_len, const char *field, size_t field_len);
+bool db_hexists(Database *db, const char *key, size_t key_len, const char *field, size_t field_len);
+
+// Cursor scan of a hash (HSCAN), with the guarantees of db_scan: returns
+// field/value pairs (*found strings) in *pairs and updates *cursor. Small
+// hashes are returned whole with cursor 0. False if the key holds another
+// type.
+bool db_hscan(Database *db, const char *key, size_t key_len, uint64_t *cursor, size_t count,
+              const DbScanFilter *filter, sds **pairs, int *found);
 
 #endif /* DATABASE_H */
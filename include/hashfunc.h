@@ -0,0 +1,18 @@
+#ifndef HASHFUNC_H
+#define HASHFUNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Seed the hash function from the system's random source.
+// Must be called once at startup, before any table is populated.
+void hash_seed_init(void);
+
+// Set an explicit seed (mainly useful for reproducible debugging)
+void hash_set_seed(uint64_t seed);
+
+// Seeded 64-bit hash (wyhash) shared by the keyspace, hash fields and pub/sub
+uint64_t hash_bytes(const void *data, size_t len);
+uint64_t hash_string(const char *str);
+
+#endif /* HASHFUNC_H */
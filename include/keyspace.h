@@ -0,0 +1,139 @@
+#ifndef KEYSPACE_H
+#define KEYSPACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Keyspace table engines. Both implement the same ks_* interface over
+// Entry pointers; the engine is chosen at build time:
+//   make                 -> chained table with incremental rehashing (default)
+//   make KEYSPACE=swiss  -> open-addressing Swiss table, migrated
+//                           incrementally on resize (KV_KEYSPACE_SWISS)
+//
+// Entries are owned by the caller; the table only links them. Every entry
+// must have its key, key_len and hash set before being inserted.
+
+struct Entry;
+
+// Initial bucket/slot count of the keyspace table (must be a power of two)
+#define KS_INITIAL_SIZE 16
+
+#ifdef KV_KEYSPACE_SWISS
+
+// Slots are probed in groups of 16 control bytes
+#define KS_GROUP_SIZE 16
+
+// Bytes of the key kept inline in each slot to reject mismatches cheaply
+#define KS_KEY_PREFIX 4
+
+// Slot with the key length and prefix inline, so most failed probes never
+// dereference the entry
+typedef struct
+{
+    struct Entry *entry;
+    uint32_t key_len;
+    char prefix[KS_KEY_PREFIX];
+} KsSlot;
+
+// Maximum slot groups migrated by a single incremental resize step
+#define KS_MIGRATE_STEP_GROUPS 1
+
+// One Swiss table: ctrl[i] is EMPTY, DELETED or the low 7 bits of the hash
+// of the entry in slots[i]
+typedef struct
+{
+    int8_t *ctrl;
+    KsSlot *slots;
+    size_t capacity;  // Slot count (power of two, multiple of KS_GROUP_SIZE)
+    size_t used;      // Live entries
+    size_t deleted;   // Tombstones
+} KsTable;
+
+// Swiss table keyspace. Growing, shrinking and clearing out tombstones are
+// incremental like the chained engine's rehash: while migrate_group != -1
+// entries live in both tables, new keys go to table[1] and every
+// maintenance step moves a few groups of table[0] over, so a resize never
+// stalls a single command.
+typedef struct
+{
+    KsTable table[2];   // table[1] is only allocated while migrating
+    long migrate_group; // Next group of table[0] to migrate (-1 = not migrating)
+} Keyspace;
+
+typedef struct
+{
+    Keyspace *ks;
+    int table;
+    size_t slot;
+} KsIterator;
+
+#else
+
+// Maximum buckets migrated by a single incremental rehash step
+#define KS_REHASH_STEP_BUCKETS 1
+
+// Chained hash table that grows and shrinks with the number of keys.
+// Resizing is incremental: while rehash_index != -1 entries live in both
+// tables and every operation migrates a few buckets from table[0] to table[1],
+// so a resize never stalls a single command.
+typedef struct
+{
+    struct Entry **table[2]; // table[1] is only allocated while rehashing
+    size_t size[2];          // Bucket count of each table (power of two)
+    size_t used[2];          // Number of entries stored in each table
+    long rehash_index;       // Next bucket of table[0] to migrate (-1 = not rehashing)
+} Keyspace;
+
+typedef struct
+{
+    Keyspace *ks;
+    int table;
+    size_t bucket;
+    struct Entry *next;
+} KsIterator;
+
+#endif
+
+// Name of the compiled-in engine ("chained" or "swiss")
+const char *ks_engine_name(void);
+
+// Table lifecycle; ks_release calls free_entry(entry, ctx) on every entry
+bool ks_init(Keyspace *ks);
+void ks_release(Keyspace *ks, void (*free_entry)(struct Entry *, void *), void *ctx);
+size_t ks_size(const Keyspace *ks);
+
+// Bytes allocated for the table itself (not the entries)
+size_t ks_memory(const Keyspace *ks);
+
+// A randomly chosen entry, NULL if the table is empty. Entries in short
+// chains or after long runs of free slots are somewhat more likely; this is
+// meant for sampling.
+struct Entry *ks_random(Keyspace *ks);
+
+// Lookup, insert (key must not be present) and unlink
+struct Entry *ks_find(Keyspace *ks, const char *key, size_t key_len, uint64_t hash);
+bool ks_insert(Keyspace *ks, struct Entry *entry);
+struct Entry *ks_remove(Keyspace *ks, const char *key, size_t key_len, uint64_t hash);
+
+// Swap a linked entry for another with the same key, in place
+void ks_replace(Keyspace *ks, struct Entry *old_entry, struct Entry *new_entry);
+
+// Bounded table maintenance (incremental rehash, deferred shrinking),
+// called on every keyspace operation. ks_remove never resizes by itself so
+// removing the entry just returned by an iterator is safe.
+void ks_maintain(Keyspace *ks);
+
+// One step of a cursor scan (scan_cursor_next): calls fn on the entries of
+// the bucket, or of the slot group, that the cursor designates and returns
+// the next cursor, 0 once the scan is complete. An entry present for the
+// whole scan is returned at least once even if the table is resized between
+// steps; entries may be returned more than once. fn must not modify the table.
+uint64_t ks_scan(Keyspace *ks, uint64_t cursor, void (*fn)(struct Entry *, void *), void *ctx);
+
+// Iteration over every entry. The table must not be modified while
+// iterating, except for removing the entry most recently returned.
+void ks_iterator_init(KsIterator *it, Keyspace *ks);
+struct Entry *ks_iterator_next(KsIterator *it);
+
+#endif /* KEYSPACE_H */
@@ -0,0 +1,108 @@
+#ifndef LISTPACK_H
+#define LISTPACK_H
+
+#include "slab.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Packed array of binary strings in one allocation. Elements are stored back
+// to back, each as a length prefix followed by its bytes, and are found by
+// scanning from the start. Used for small hashes (field, value, field, ...);
+// list chunks share the element format.
+//
+// Memory comes from the caller's slab pool. Functions that may grow the
+// array return its new address; on failure they return NULL and leave the
+// original untouched.
+
+typedef struct
+{
+    uint32_t count; // Elements
+    uint32_t used;  // Bytes of data in use
+    uint32_t size;  // Capacity of data
+    char data[];
+} Listpack;
+
+// Longest length prefix
+#define LP_MAX_LEN_SIZE 5
+
+// Length prefix: 1 byte below 2^7, 2 bytes below 2^14, otherwise a marker
+// byte and 4 little-endian bytes
+static inline size_t lp_len_size(size_t len)
+{
+    if (len < 0x80)
+        return 1;
+    if (len < 0x4000)
+        return 2;
+    return LP_MAX_LEN_SIZE;
+}
+
+static inline size_t lp_write_len(char *p, size_t len)
+{
+    unsigned char *u = (unsigned char *)p;
+    if (len < 0x80)
+    {
+        u[0] = (unsigned char)len;
+        return 1;
+    }
+    if (len < 0x4000)
+    {
+        u[0] = (unsigned char)(0x80 | (len >> 8));
+        u[1] = (unsigned char)(len & 0xff);
+        return 2;
+    }
+    u[0] = 0xC0;
+    for (int i = 0; i < 4; i++)
+        u[1 + i] = (unsigned char)((len >> (8 * i)) & 0xff);
+    return LP_MAX_LEN_SIZE;
+}
+
+static inline size_t lp_read_len(const char *p, size_t *len)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    if (u[0] < 0x80)
+    {
+        *len = u[0];
+        return 1;
+    }
+    if (u[0] < 0xC0)
+    {
+        *len = ((size_t)(u[0] & 0x3f) << 8) | u[1];
+        return 2;
+    }
+    *len = (size_t)u[1] | ((size_t)u[2] << 8) | ((size_t)u[3] << 16) | ((size_t)u[4] << 24);
+    return LP_MAX_LEN_SIZE;
+}
+
+// Bytes taken by the encoded element starting at p
+static inline size_t lp_element_size(const char *p)
+{
+    size_t len;
+    size_t prefix = lp_read_len(p, &len);
+    return prefix + len;
+}
+
+// Empty listpack with room for at least size bytes of data
+Listpack *lp_create(SlabPool *pool, size_t size);
+void lp_free(SlabPool *pool, Listpack *lp);
+
+// Bytes of pool memory held by a listpack
+size_t lp_memory(const Listpack *lp);
+
+// Read the element at offset; returns the offset of the next element
+// (lp->used after the last one)
+size_t lp_get(const Listpack *lp, size_t offset, const char **data, size_t *len);
+
+// Make room for extra more bytes of elements
+Listpack *lp_reserve(SlabPool *pool, Listpack *lp, size_t extra);
+
+// Append an element
+Listpack *lp_append(SlabPool *pool, Listpack *lp, const char *data, size_t len);
+
+// Overwrite the element at offset with new contents
+Listpack *lp_replace(SlabPool *pool, Listpack *lp, size_t offset, const char *data, size_t len);
+
+// Remove count elements starting at offset
+void lp_delete(Listpack *lp, size_t offset, size_t count);
+
+#endif /* LISTPACK_H */
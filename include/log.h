@@ -0,0 +1,76 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Leveled logging. Messages below LOG_COMPILE_LEVEL are removed at compile
+// time (set with 'make LOG_LEVEL=debug|verbose|notice|warning'), those
+// below the runtime level (CONFIG SET loglevel) are skipped before being
+// formatted.
+//
+// Once log_start has run, each thread formats its messages into its own
+// ring buffer, from which a background thread writes them to stdout, so
+// logging never waits on the terminal or a file. A message that does not
+// fit in a full ring is dropped and counted. Before log_start, messages
+// are written directly.
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_VERBOSE 1
+#define LOG_LEVEL_NOTICE 2
+#define LOG_LEVEL_WARNING 3
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_VERBOSE
+#endif
+
+#define LOG_DEFAULT_LEVEL LOG_LEVEL_NOTICE
+
+// Longest message kept, longer ones are truncated
+#define LOG_LINE_MAX 1024
+
+// Bytes of each thread's ring buffer
+#define LOG_RING_SIZE (128 * 1024)
+
+// True if messages of the level are logged; constant false for levels
+// compiled out, so whatever it guards is removed with them
+#define log_enabled(level) ((level) >= LOG_COMPILE_LEVEL && log_level_active(level))
+
+#define log_at(level, ...)                       \
+    do                                           \
+    {                                            \
+        if (log_enabled(level))                  \
+            log_message((level), __VA_ARGS__);   \
+    } while (0)
+
+#define log_debug(...) log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_verbose(...) log_at(LOG_LEVEL_VERBOSE, __VA_ARGS__)
+#define log_notice(...) log_at(LOG_LEVEL_NOTICE, __VA_ARGS__)
+#define log_warning(...) log_at(LOG_LEVEL_WARNING, __VA_ARGS__)
+
+bool log_level_active(int level);
+int log_get_level(void);
+void log_set_level(int level);
+
+// Level by name (debug, verbose, notice or warning), -1 if unknown
+int log_level_from_name(const char *name);
+const char *log_level_name(int level);
+
+// Format and log a message; use the level macros, which skip disabled
+// levels without evaluating the format
+void log_message(int level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Start the writer thread; messages logged until then were written
+// directly. Whatever is still queued at exit is written then.
+bool log_start(void);
+
+// Write every queued message now
+void log_flush(void);
+
+// Printable form of up to len bytes for a message: control and non-ASCII
+// bytes as escapes, cut with "..." if out_size is too small. Returns the
+// length written.
+size_t log_escape(char *out, size_t out_size, const char *data, size_t len);
+
+#endif /* LOG_H */
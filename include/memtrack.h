@@ -0,0 +1,58 @@
+#ifndef MEMTRACK_H
+#define MEMTRACK_H
+
+#include <stddef.h>
+
+// Memory accounting by category.
+//
+// Every category has a process-wide counter, updated atomically so it can
+// be read at any time without locking anything. Database memory comes from
+// the shards' slab pools and key tables, which report what they allocate
+// and free with mem_count_alloc and mem_count_free; the pools also count
+// the bytes of each category per shard. Other long-lived heap memory is
+// allocated with the mem_* wrappers below: they keep the size and category
+// in a small header in front of each block, so frees need no size. Blocks
+// from mem_alloc must be released with mem_free, never free.
+
+typedef enum
+{
+    MEM_KEYS,           // Entries (key, inline value, timer pointer) and key tables
+    MEM_VALUES,         // String values stored apart from their entry
+    MEM_LIST_NODES,     // List headers and chunks
+    MEM_HASH_FIELDS,    // Hash headers, field tables, fields and packed small hashes
+    MEM_EXPIRES,        // Expiration timers
+    MEM_KEY_INDEX,      // Nodes of the ordered key index
+    // Categories from here on are not database memory
+    MEM_CLIENT_BUFFERS, // Client query and reply buffers
+    MEM_PUBSUB,         // Channels and subscriptions
+    MEM_CATEGORY_COUNT
+} MemCategory;
+
+// Lowercase name of a category, as reported by INFO
+const char *mem_category_name(MemCategory category);
+
+void *mem_alloc(MemCategory category, size_t size);
+void *mem_calloc(MemCategory category, size_t count, size_t size);
+// Resize a block, or allocate one in category if ptr is NULL
+void *mem_realloc(MemCategory category, void *ptr, size_t size);
+char *mem_strdup(MemCategory category, const char *str);
+void mem_free(void *ptr);
+
+// Count memory allocated or freed without the wrappers
+void mem_count_alloc(MemCategory category, size_t size);
+void mem_count_free(MemCategory category, size_t size);
+
+// Bytes currently allocated in a category
+size_t mem_allocated(MemCategory category);
+
+// Bytes currently allocated in every category, and in the database ones
+size_t mem_used(void);
+size_t mem_used_database(void);
+
+// Record a used memory reading; returns the highest one so far
+size_t mem_update_peak(size_t used);
+
+// Resident set size of the process in bytes, 0 if it cannot be read
+size_t mem_rss(void);
+
+#endif /* MEMTRACK_H */
@@ -6,7 +6,10 @@
 
 // File operations constants
 #define DB_FILE_SIGNATURE "KVSTORE"
-#define DB_FILE_VERSION 1
+#define DB_FILE_VERSION 2
+
+// Version 1 files store expiration times in seconds, later ones in milliseconds
+#define DB_FILE_VERSION_SECONDS 1
 
 // Save and load functions
 bool save_command(Database *db, const char *filename);
@@ -2,6 +2,7 @@
 #define PUBSUB_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <pthread.h>
 
 // Forward declarations
@@ -28,11 +29,15 @@ typedef struct Channel
     struct Channel *next; // For hash table chaining
 } Channel;
 
+// Hands a formatted message to a subscriber's connection
+typedef void (*PubSubDeliverFn)(int client_socket, const char *data, size_t len);
+
 // Pub/Sub Manager structure
 typedef struct PubSubManager
 {
     Channel *channels[1024]; // Hash table of channels
     pthread_mutex_t mutex;   // Thread safety
+    PubSubDeliverFn deliver; // Message delivery, NULL to send() to the socket
 } PubSubManager;
 
 // Function prototypes
@@ -0,0 +1,74 @@
+#ifndef QUICKLIST_H
+#define QUICKLIST_H
+
+#include "sds.h"
+#include "slab.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lists are stored as a doubly linked list of chunks, each packing many
+// elements back to back in the listpack element format (a length prefix
+// followed by the element bytes).
+// Chunks grow through the slab size classes up to QL_CHUNK_MAX bytes; an
+// element that does not fit starts a new chunk. Per-chunk element counts
+// let index seeks skip whole chunks, starting from the nearer end.
+//
+// All memory comes from the caller's slab pool, so a list has the same
+// locking rules as the pool it was created with.
+
+// Largest chunk (header included) that is still extended in place
+#define QL_CHUNK_MAX SLAB_MAX_OBJECT
+
+typedef struct ListChunk
+{
+    struct ListChunk *prev;
+    struct ListChunk *next;
+    uint32_t count; // Elements in this chunk
+    uint32_t used;  // Bytes of data in use
+    uint32_t size;  // Capacity of data
+    char data[];
+} ListChunk;
+
+typedef struct
+{
+    ListChunk *head;
+    ListChunk *tail;
+    size_t length;      // Elements in the whole list
+    size_t chunk_count;
+} List;
+
+// Forward cursor over a list. Element data points into the chunk and is
+// valid until the list is modified.
+typedef struct
+{
+    ListChunk *chunk;
+    uint32_t offset; // Byte offset of the next element in chunk
+    uint32_t index;  // Index of the next element in chunk
+} ListIterator;
+
+List *ql_create(SlabPool *pool);
+void ql_release(SlabPool *pool, List *list);
+
+// Free at most chunks chunks of a list that is no longer in use, from the
+// head; frees the list itself and returns true once no chunk is left
+bool ql_release_step(SlabPool *pool, List *list, size_t chunks);
+
+// Bytes of pool memory held by a list, chunks included
+size_t ql_memory(const List *list);
+
+// Add an element at the head or the tail
+bool ql_push(SlabPool *pool, List *list, const char *data, size_t len, bool at_head);
+
+// Remove the head or tail element and return a copy (released with
+// sds_free), or NULL if the list is empty
+sds ql_pop(SlabPool *pool, List *list, bool at_head);
+
+// Position it on the element at index; an index past the end leaves it
+// at the end
+void ql_iterator_seek(ListIterator *it, const List *list, size_t index);
+
+// Read the element under the cursor and advance; false at the end
+bool ql_iterator_next(ListIterator *it, const char **data, size_t *len);
+
+#endif /* QUICKLIST_H */
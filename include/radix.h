@@ -0,0 +1,56 @@
+#ifndef RADIX_H
+#define RADIX_H
+
+#include "slab.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Compressed radix tree over binary-safe keys, used as an ordered index of
+// the keyspace. Each node holds the bytes of the edge leading to it, so
+// chains of single-child nodes collapse into one; children are kept sorted
+// by their first byte. Every node also counts the keys stored in its
+// subtree, so the keys under a prefix are counted in time proportional to
+// the prefix length and listed in time proportional to their number.
+//
+// The tree stores copies of the keys' bytes, not entries, so it only has
+// to follow insertions and removals. Nodes are allocated from the caller's
+// slab pool and counted as MEM_KEY_INDEX.
+
+typedef struct RadixNode
+{
+    struct RadixNode **children; // Sorted by the first byte of their label
+    size_t keys;                 // Keys ending at this node or below it
+    uint32_t label_len;          // Bytes of the edge from the parent
+    uint16_t child_count;
+    uint16_t child_capacity;
+    uint8_t is_key; // A key ends at this node
+    char label[];
+} RadixNode;
+
+typedef struct
+{
+    RadixNode *root; // Empty label; NULL until the first insertion
+} RadixTree;
+
+void radix_init(RadixTree *tree);
+
+// Free every node
+void radix_release(SlabPool *pool, RadixTree *tree);
+
+// Add a key; true if it is in the tree afterwards, false if out of memory
+bool radix_insert(SlabPool *pool, RadixTree *tree, const char *key, size_t len);
+
+// Remove a key; false if it was not there
+bool radix_remove(SlabPool *pool, RadixTree *tree, const char *key, size_t len);
+
+// Number of keys starting with prefix
+size_t radix_count_prefix(const RadixTree *tree, const char *prefix, size_t len);
+
+// Call fn on every key starting with prefix, in byte order, until it
+// returns false. The key is only valid during the call and the tree must
+// not be modified meanwhile. False if fn stopped the walk or memory ran out.
+bool radix_walk_prefix(const RadixTree *tree, const char *prefix, size_t len,
+                       bool (*fn)(const char *key, size_t len, void *ctx), void *ctx);
+
+#endif /* RADIX_H */
@@ -0,0 +1,64 @@
+#ifndef SDS_H
+#define SDS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Length-prefixed strings. An sds points at the string bytes, which are
+// always NUL terminated so it can be passed where a C string is expected;
+// the length and capacity live in a header just before the bytes, so
+// sds_len() never scans the string.
+typedef char *sds;
+
+typedef struct
+{
+    uint32_t len;   // Bytes in use, excluding the terminator
+    uint32_t alloc; // Bytes available, excluding the terminator
+    char buf[];
+} SdsHeader;
+
+// Alignment of the memory holding an SdsHeader
+#define SDS_ALIGN sizeof(uint32_t)
+
+// Largest length an sds can hold
+#define SDS_MAX_LEN UINT32_MAX
+
+static inline SdsHeader *sds_header(const sds s)
+{
+    return (SdsHeader *)(s - sizeof(SdsHeader));
+}
+
+static inline size_t sds_len(const sds s)
+{
+    return sds_header(s)->len;
+}
+
+static inline size_t sds_alloc(const sds s)
+{
+    return sds_header(s)->alloc;
+}
+
+// Bytes needed to hold an sds with the given capacity
+static inline size_t sds_mem_size(size_t alloc)
+{
+    return sizeof(SdsHeader) + alloc + 1;
+}
+
+// Heap strings, released with sds_free
+sds sds_new_len(const void *data, size_t len);
+sds sds_new(const char *str);
+sds sds_dup(const sds s);
+void sds_free(sds s);
+
+// Free an array of count heap strings and the array itself
+void sds_free_array(sds *array, int count);
+
+// Build an sds inside caller-owned memory of sds_mem_size(alloc) bytes,
+// aligned to SDS_ALIGN. Such strings are never passed to sds_free.
+sds sds_init(void *mem, size_t alloc, const void *data, size_t len);
+
+// Overwrite the contents in place; fails if len exceeds the capacity
+bool sds_assign(sds s, const void *data, size_t len);
+
+#endif /* SDS_H */
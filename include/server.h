@@ -5,20 +5,59 @@
 #include "pubsub.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <sys/uio.h>
 
 // Default port for the server
 #define DEFAULT_PORT 8520
 
-// Function to start the TCP server
-bool start_server(Database *db, int port);
+// Event loop threads serving clients
+#define DEFAULT_IO_THREADS 1
+#define MAX_IO_THREADS 64
 
-// Function to handle client connection
-void handle_client(int client_socket, Database *db, PubSubManager *pubsub);
+// How the event loops wait for and do socket I/O
+typedef enum
+{
+    IO_BACKEND_EPOLL, // Readiness notifications, then reads and writes
+    IO_BACKEND_URING  // Requests completed by the kernel through io_uring
+} IoBackend;
+
+// Reply serialized piece by piece, typically from values read in place in
+// the database while their shard lock is held: pieces are written straight
+// into the client's queued output, which its event loop sends as it grows,
+// so replies of any size need neither a staging copy of every element nor
+// a buffer holding the whole reply
+typedef struct
+{
+    int client_socket;
+    struct Client *client; // Event loop client, locked until reply_flush
+} ReplyStream;
+
+// Function to start the TCP server with io_threads event loops, the first
+// one running in the calling thread. Each loop listens on the port with its
+// own SO_REUSEPORT socket and serves the clients it accepts; replies are
+// queued per client and written when its socket is writable. Loops on which
+// io_uring is requested but unavailable fall back to epoll.
+bool start_server(Database *db, int port, int io_threads, IoBackend backend);
 
 // Function to process commands received from client
-void process_client_command(int client_socket, Database *db, PubSubManager *pubsub, const char *command);
+void process_client_command(int client_socket, Database *db, PubSubManager *pubsub,
+                            const char *command, size_t command_len);
 
 // Function to send response to client
 void send_response_debug(int client_socket, const char *response);
+void send_response_len(int client_socket, const char *response, size_t total_bytes);
+// Several pieces sent as one response, which other output never splits
+void send_response_parts(int client_socket, const struct iovec *parts, int count);
+void send_bulk_response(int client_socket, const char *data, size_t len);
+void send_array_response(int client_socket, sds *items, int count);
+void send_scan_response(int client_socket, uint64_t cursor, sds *items, int count);
+
+// Streamed replies: reply_flush hands the reply to the client's event loop
+// and must end every reply, with no other output sent in between
+void reply_init(ReplyStream *reply, int client_socket);
+void reply_append(ReplyStream *reply, const char *data, size_t len);
+void reply_array_header(ReplyStream *reply, size_t count);
+void reply_bulk(ReplyStream *reply, const char *data, size_t len);
+void reply_flush(ReplyStream *reply);
 
 #endif /* SERVER_H */
\ No newline at end of file
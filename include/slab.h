@@ -0,0 +1,80 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "memtrack.h"
+#include <stddef.h>
+
+// Size-class object pools. Small objects are carved out of SLAB_SIZE-aligned
+// slabs and recycled through per-slab freelists; a slab whose objects are all
+// free is returned to the system unless it is the last one with free space
+// in its class. Larger objects fall through to malloc.
+//
+// A pool is not thread safe: the database keeps one per shard and only uses
+// it under the shard's exclusive lock. Frees are sized, the caller passes the
+// size and the memory category it allocated with; the pool counts the
+// bytes of each category.
+
+// Slab size and alignment. Each shard keeps at least one slab per size class
+// in use, so this bounds the idle overhead.
+#define SLAB_SIZE (16 * 1024)
+
+// Largest object served from slabs
+#define SLAB_MAX_OBJECT 1024
+
+// Size classes: 16..256 by 16, 320..512 by 64, 640..1024 by 128
+#define SLAB_CLASS_COUNT 24
+
+typedef struct Slab Slab;
+
+typedef struct
+{
+    size_t object_size;
+    size_t objects_per_slab;
+    Slab *partial; // Slabs with at least one free object
+    Slab *full;    // Slabs with no free object
+    size_t slabs;  // Slabs owned by this class
+    size_t used;   // Live objects
+} SlabClass;
+
+typedef struct
+{
+    SlabClass classes[SLAB_CLASS_COUNT];
+    size_t large_objects; // Live objects allocated with malloc
+    size_t large_bytes;
+    size_t used_bytes; // Rounded size of all live objects, large ones included
+    size_t category_bytes[MEM_CATEGORY_COUNT]; // used_bytes split by category
+} SlabPool;
+
+// Usage summed over one or more pools
+typedef struct
+{
+    size_t slabs;
+    size_t slab_bytes;    // Memory held in slabs
+    size_t used_bytes;    // Rounded size of the live slab objects
+    size_t objects;       // Live slab objects
+    size_t large_objects; // Live objects allocated with malloc
+    size_t large_bytes;
+    size_t class_slabs[SLAB_CLASS_COUNT];
+    size_t class_objects[SLAB_CLASS_COUNT];
+    size_t category_bytes[MEM_CATEGORY_COUNT]; // Rounded size of live objects by category
+} SlabStats;
+
+void slab_pool_init(SlabPool *pool);
+
+// Return every slab to the system; objects still allocated become invalid.
+// Large objects are not tracked and must have been freed already.
+void slab_pool_release(SlabPool *pool);
+
+void *slab_alloc(SlabPool *pool, MemCategory category, size_t size);
+void slab_free(SlabPool *pool, MemCategory category, void *ptr, size_t size);
+
+// Object size of the class serving size (size itself for large objects)
+size_t slab_class_size(size_t size);
+
+// Object size of the class with the given index
+size_t slab_class_object_size(int index);
+
+// Add the pool's usage to stats (zero it first)
+void slab_pool_add_stats(const SlabPool *pool, SlabStats *stats);
+
+#endif /* SLAB_H */
@@ -0,0 +1,73 @@
+#ifndef TIMEWHEEL_H
+#define TIMEWHEEL_H
+
+#include "slab.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Hierarchical timing wheel: an index of timers by deadline in which the
+// due ones are found in time proportional to their number.
+//
+// Level k has TW_SLOTS slots of TW_SLOTS^k ticks each. A timer sits on the
+// lowest level whose slot range still shares all higher bits with the
+// wheel's current tick; level 0 slots hold a single tick. When the wheel
+// moves into a higher level slot, its timers are redistributed to the
+// levels below. Per-level occupancy bitmaps let the wheel jump straight to
+// the next non-empty slot, so idle periods cost nothing. Deadlines past the
+// top level wait in an overflow list.
+//
+// Timers are allocated from the caller's slab pool, counted as MEM_EXPIRES,
+// and carry an opaque owner pointer. Ticks are in whatever unit the caller uses consistently.
+
+#define TW_LEVEL_BITS 6
+#define TW_SLOTS (1 << TW_LEVEL_BITS)
+#define TW_LEVELS 6
+
+// Timers of one slot visited by tw_first and tw_random
+#define TW_SCAN_LIMIT 16
+
+typedef struct TimerNode
+{
+    struct TimerNode *prev;
+    struct TimerNode *next;
+    void *owner;
+    int64_t when;  // Deadline tick
+    uint8_t level; // Wheel level, TW_LEVELS for the overflow list
+    uint8_t slot;
+} TimerNode;
+
+typedef struct
+{
+    TimerNode *slots[TW_LEVELS][TW_SLOTS];
+    uint64_t occupied[TW_LEVELS]; // Bit per non-empty slot
+    TimerNode *overflow;          // Deadlines beyond the top level
+    int64_t current;              // Every timer before this tick has been handed out
+    size_t count;
+} TimerWheel;
+
+void tw_init(TimerWheel *tw, int64_t now);
+
+// Free every timer
+void tw_release(SlabPool *pool, TimerWheel *tw);
+
+// Schedule a new timer; NULL if out of memory
+TimerNode *tw_add(SlabPool *pool, TimerWheel *tw, void *owner, int64_t when);
+
+// Move a timer to a new deadline
+void tw_update(TimerWheel *tw, TimerNode *node, int64_t when);
+
+void tw_remove(SlabPool *pool, TimerWheel *tw, TimerNode *node);
+
+// A timer whose deadline is at or before now, NULL if none is due. The
+// timer stays scheduled until it is removed or updated.
+TimerNode *tw_next_due(TimerWheel *tw, int64_t now);
+
+// The earliest timer of the earliest non-empty slot, looking at no more
+// than TW_SCAN_LIMIT timers of it; NULL if the wheel is empty
+TimerNode *tw_first(const TimerWheel *tw);
+
+// A timer from a random non-empty slot, for sampling; NULL if empty
+TimerNode *tw_random(const TimerWheel *tw);
+
+#endif /* TIMEWHEEL_H */
@@ -0,0 +1,85 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Minimal io_uring ring driven through the raw system calls: submission
+// and completion queues mapped from the kernel, plus provided buffer rings
+// from which the kernel picks receive buffers itself.
+//
+// A ring is used by a single thread. Requests are prepared with
+// uring_get_sqe and handed to the kernel in batches by uring_submit.
+
+typedef struct
+{
+    int fd;
+    unsigned features; // IORING_FEAT_* flags of the kernel
+
+    // Submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_local_tail; // Prepared up to here, published by uring_submit
+
+    // Completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring; // Same mapping as sq_ring with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size;
+    size_t sqes_size;
+} Uring;
+
+// Buffers registered with the kernel as a group, handed back to it once
+// the data received into them has been consumed
+typedef struct
+{
+    struct io_uring_buf_ring *ring;
+    char *buffers;
+    unsigned entries;
+    size_t buffer_size;
+    uint16_t group;
+    uint16_t tail;
+} UringBufRing;
+
+// Set up a ring with room for entries submissions; false (errno set) if
+// io_uring is unavailable
+bool uring_init(Uring *ring, unsigned entries);
+void uring_free(Uring *ring);
+
+// A cleared submission entry, NULL if the queue is full until the next
+// uring_submit
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+
+// Hand the prepared entries to the kernel and wait for at least wait_nr
+// completions. Returns the number submitted, or -errno.
+int uring_submit(Uring *ring, unsigned wait_nr);
+
+// Next completion, NULL if none is ready; uring_cqe_seen releases it
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+void uring_cqe_seen(Uring *ring);
+
+// Register entries buffers of buffer_size bytes as buffer group group and
+// give them all to the kernel; false (errno set) if not supported
+bool uring_buf_ring_init(Uring *ring, UringBufRing *buffers, uint16_t group, unsigned entries, size_t buffer_size);
+void uring_buf_ring_free(Uring *ring, UringBufRing *buffers);
+
+static inline char *uring_buf_data(const UringBufRing *buffers, uint16_t id)
+{
+    return buffers->buffers + (size_t)id * buffers->buffer_size;
+}
+
+// Give a buffer back to the kernel
+void uring_buf_ring_recycle(UringBufRing *buffers, uint16_t id);
+
+#endif /* URING_H */
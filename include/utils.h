@@ -1,18 +1,55 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include "sds.h"
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 // Function to tokenise a command string into an array of strings
-char **tokenise_command(const char *command, int *token_count);
+sds *tokenise_command(const char *command, int *token_count);
 
 // Function to free tokens
-void free_tokens(char **tokens, int count);
+void free_tokens(sds *tokens, int count);
 
-// Function to parse RESP (Redis Serialization Protocol) command
-char **parse_resp_tokens(const char *input, size_t input_len, int *token_count);
+// Function to parse RESP (Redis Serialization Protocol) command.
+// Bulk strings are copied by length, so tokens may hold any bytes.
+sds *parse_resp_tokens(const char *input, size_t input_len, int *token_count);
 
 // Function to find complete RESP command in buffer
 char *find_complete_resp_command(const char *buffer, size_t buffer_len, size_t *command_length);
 
+// Parse a canonical decimal int64 (no sign '+', spaces or leading zeros),
+// so that formatting the result gives back exactly the same bytes
+bool string_to_int64(const char *str, size_t len, int64_t *value);
+
+// Format an int64 into buf (at least 21 bytes); returns the length
+size_t int64_to_string(int64_t value, char *buf);
+
+// Glob-style match supporting '*', '?', [abc], [^a-z] and '\' escapes.
+// Both pattern and string are binary safe.
+bool glob_match(const char *pattern, size_t pattern_len, const char *str, size_t str_len, bool nocase);
+
+// Length of the literal bytes a pattern starts with, before its first
+// special character: every string it matches starts with them
+size_t glob_literal_prefix(const char *pattern, size_t pattern_len);
+
+// Wall-clock time in milliseconds, cached per thread. clock_refresh_ms()
+// reads the system clock into the calling thread's cache; clock_cached_ms()
+// returns the cached value, so a batch of commands costs one clock read and
+// sees a single time. A thread that never refreshed reads the clock.
+int64_t clock_refresh_ms(void);
+int64_t clock_cached_ms(void);
+
+// Fast per-thread pseudo-random numbers, for sampling (not cryptography)
+uint64_t random_u64(void);
+
+// Next cursor of a scan over a power-of-two table with the given index
+// mask. Cursors count in reverse binary, incrementing the top index bit
+// first, so a scan from 0 is back at 0 after visiting every index once,
+// and the indexes visited before the table doubles or halves cover exactly
+// the indexes they split into or merged from. Elements that stay in the
+// table are then returned even if it is resized between calls.
+uint64_t scan_cursor_next(uint64_t cursor, uint64_t mask);
+
 #endif /* UTILS_H */
\ No newline at end of file
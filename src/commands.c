@@ -1,229 +1,575 @@
 #include "../include/commands.h"
+#include "../include/utils.h"
+#include "../include/log.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
-// SET command implementation
-void set_command(Database *db, const char *key, const char *value)
-{
-    db_set(db, key, value);
-}
+// Keyed commands by the shard lock they need
+static const char *const g_shared_lock_commands[] = {
+    "GET", "EXISTS", "TTL", "PTTL", "LRANGE", "LLEN", "HGET", "HEXISTS", "HGETALL", "HSCAN", NULL};
 
-// GET command implementation
-char *get_command(Database *db, const char *key)
-{
-    return db_get(db, key);
-}
+static const char *const g_exclusive_lock_commands[] = {
+    "SET", "DEL", "UNLINK", "INCR", "DECR", "INCRBY", "DECRBY", "EXPIRE", "PEXPIRE", "PEXPIREAT", "PERSIST",
+    "LPUSH", "RPUSH", "LPOP", "RPOP", "HSET", "HDEL", NULL};
 
-// EXISTS command implementation
-bool exists_command(Database *db, const char *key)
+// Keyed commands that may allocate memory, refused when it cannot be freed
+static const char *const g_memory_growing_commands[] = {
+    "SET", "INCR", "DECR", "INCRBY", "DECRBY", "LPUSH", "RPUSH", "HSET", NULL};
+
+static bool command_in_list(const char *command, const char *const *list)
 {
-    return db_exists(db, key);
+    for (int i = 0; list[i]; i++)
+    {
+        if (strcasecmp(command, list[i]) == 0)
+            return true;
+    }
+    return false;
 }
 
-// DEL command implementation
-bool del_command(Database *db, const char *key)
+// Formats of CONFIG parameter values
+typedef enum
+{
+    CONFIG_COUNT,  // Non-negative integer
+    CONFIG_MEMORY, // Bytes, optionally with a kb, mb or gb suffix
+    CONFIG_POLICY, // EvictionPolicy by name
+    CONFIG_BOOL,    // yes or no, stored as 1 or 0
+    CONFIG_LOGLEVEL // Log level by name, held by the logger rather than DbConfig
+} ConfigType;
+
+// CONFIG parameters, held in DbConfig as size_t
+typedef struct
+{
+    const char *name;
+    size_t offset;
+    ConfigType type;
+} ConfigParam;
+
+static const ConfigParam g_config_params[] = {
+    {"hash-max-entries", offsetof(DbConfig, hash_max_entries), CONFIG_COUNT},
+    {"hash-max-value", offsetof(DbConfig, hash_max_value), CONFIG_COUNT},
+    {"maxmemory", offsetof(DbConfig, maxmemory), CONFIG_MEMORY},
+    {"maxmemory-policy", offsetof(DbConfig, maxmemory_policy), CONFIG_POLICY},
+    {"maxmemory-samples", offsetof(DbConfig, maxmemory_samples), CONFIG_COUNT},
+    {"lazyfree-lazy-user-del", offsetof(DbConfig, lazyfree_user_del), CONFIG_BOOL},
+    {"lazyfree-lazy-server-del", offsetof(DbConfig, lazyfree_server_del), CONFIG_BOOL},
+    {"key-index", offsetof(DbConfig, key_index), CONFIG_BOOL},
+    {"loglevel", 0, CONFIG_LOGLEVEL},
+    {NULL, 0, CONFIG_COUNT}};
+
+static size_t *config_param_value(Database *db, const ConfigParam *param)
 {
-    return db_delete(db, key);
+    return (size_t *)((char *)&db->config + param->offset);
 }
 
-// INCR command implementation
-bool incr_command(Database *db, const char *key, int *new_value)
+// Parse a CONFIG value of the parameter's type
+static bool config_parse_value(const ConfigParam *param, sds value, size_t *result)
 {
-    char *value = db_get(db, key);
-
-    if (!value)
+    if (param->type == CONFIG_POLICY)
     {
-        // Key doesn't exist, create with value 1
-        char buffer[32];
-        sprintf(buffer, "1");
-        db_set(db, key, buffer);
-        *new_value = 1;
+        int policy = db_eviction_policy_from_name(value);
+        if (policy < 0)
+            return false;
+        *result = (size_t)policy;
+        return true;
+    }
+    if (param->type == CONFIG_BOOL)
+    {
+        if (strcasecmp(value, "yes") != 0 && strcasecmp(value, "no") != 0)
+            return false;
+        *result = strcasecmp(value, "yes") == 0;
         return true;
     }
 
-    // Check if value is a valid integer
-    char *endptr;
-    long val = strtol(value, &endptr, 10);
-
-    if (*endptr != '\0')
+    size_t len = sds_len(value);
+    size_t unit = 1;
+    if (param->type == CONFIG_MEMORY && len > 2)
     {
-        return false; // Not a valid integer
+        const char *suffix = value + len - 2;
+        if (strcasecmp(suffix, "kb") == 0)
+            unit = (size_t)1 << 10;
+        else if (strcasecmp(suffix, "mb") == 0)
+            unit = (size_t)1 << 20;
+        else if (strcasecmp(suffix, "gb") == 0)
+            unit = (size_t)1 << 30;
+        if (unit > 1)
+            len -= 2;
     }
 
-    val++; // Increment
+    int64_t number;
+    if (!string_to_int64(value, len, &number) || number < 0 || (uint64_t)number > SIZE_MAX / unit)
+        return false;
+    *result = (size_t)number * unit;
+    return true;
+}
 
-    // Store the new value
-    char buffer[32];
-    sprintf(buffer, "%ld", val);
-    db_set(db, key, buffer);
+bool command_may_grow_memory(const char *command)
+{
+    return command && command_in_list(command, g_memory_growing_commands);
+}
 
-    *new_value = (int)val;
-    return true;
+// Determine the shard lock a command takes on its key
+CommandLock command_lock_mode(const char *command)
+{
+    if (!command)
+        return CMD_LOCK_NONE;
+    if (command_in_list(command, g_shared_lock_commands))
+        return CMD_LOCK_SHARED;
+    if (command_in_list(command, g_exclusive_lock_commands))
+        return CMD_LOCK_EXCLUSIVE;
+    return CMD_LOCK_NONE;
 }
 
-// DECR command implementation
-bool decr_command(Database *db, const char *key, int *new_value)
+// Absolute expiration time for a relative one in milliseconds; false if
+// it would overflow
+static bool expiration_from_now(int64_t milliseconds, int64_t *expiration)
 {
-    char *value = db_get(db, key);
+    int64_t now = clock_cached_ms();
+    if (milliseconds > INT64_MAX - now)
+        return false;
+    *expiration = now + milliseconds;
+    return true;
+}
 
-    if (!value)
+// SET command implementation: SET key value [EX seconds | PX milliseconds] [NX | XX].
+// Without EX or PX an existing expiration is kept.
+SetResult set_command(Database *db, sds key, sds value, sds *options, int option_count)
+{
+    int flags = 0;
+    int64_t expiration = 0;
+    for (int i = 0; i < option_count; i++)
     {
-        // Key doesn't exist, create with value -1
-        char buffer[32];
-        sprintf(buffer, "-1");
-        db_set(db, key, buffer);
-        *new_value = -1;
-        return true;
+        if (strcasecmp(options[i], "NX") == 0 && !(flags & DB_SET_XX))
+        {
+            flags |= DB_SET_NX;
+        }
+        else if (strcasecmp(options[i], "XX") == 0 && !(flags & DB_SET_NX))
+        {
+            flags |= DB_SET_XX;
+        }
+        else if ((strcasecmp(options[i], "EX") == 0 || strcasecmp(options[i], "PX") == 0) &&
+                 expiration == 0 && i + 1 < option_count)
+        {
+            int64_t amount;
+            bool seconds = strcasecmp(options[i], "EX") == 0;
+            i++;
+            if (!string_to_int64(options[i], sds_len(options[i]), &amount) || amount <= 0 ||
+                (seconds && amount > INT64_MAX / 1000))
+                return SET_INVALID_EXPIRE;
+            if (!expiration_from_now(seconds ? amount * 1000 : amount, &expiration))
+                return SET_INVALID_EXPIRE;
+        }
+        else
+        {
+            return SET_SYNTAX_ERROR;
+        }
     }
 
-    // Check if value is a valid integer
-    char *endptr;
-    long val = strtol(value, &endptr, 10);
-
-    if (*endptr != '\0')
+    if (flags == 0 && expiration == 0)
     {
-        return false; // Not a valid integer
+        db_set(db, key, sds_len(key), value, sds_len(value));
+        return SET_OK;
     }
+    if (!db_set_with_options(db, key, sds_len(key), value, sds_len(value), flags, expiration))
+        return SET_NOT_PERFORMED;
+    return SET_OK;
+}
 
-    val--; // Decrement
+// GET command implementation
+bool get_command(Database *db, sds key, DbString *value)
+{
+    return db_get(db, key, sds_len(key), value);
+}
 
-    // Store the new value
-    char buffer[32];
-    sprintf(buffer, "%ld", val);
-    db_set(db, key, buffer);
+// EXISTS command implementation
+bool exists_command(Database *db, sds key)
+{
+    return db_exists(db, key, sds_len(key));
+}
 
-    *new_value = (int)val;
-    return true;
+// DEL command implementation
+bool del_command(Database *db, sds key)
+{
+    return db_delete(db, key, sds_len(key));
 }
 
-// EXPIRE command implementation - Set key to expire in N seconds
-bool expire_command(Database *db, const char *key, int seconds)
+// UNLINK command implementation: the key is gone at once, a large value
+// is freed in the background
+bool unlink_command(Database *db, sds key)
 {
-    if (!db || !key || seconds < 0)
-    {
+    return db_unlink(db, key, sds_len(key));
+}
+
+// INCR command implementation
+bool incr_command(Database *db, sds key, int64_t *new_value)
+{
+    return db_incrby(db, key, sds_len(key), 1, new_value);
+}
+
+// DECR command implementation
+bool decr_command(Database *db, sds key, int64_t *new_value)
+{
+    return db_incrby(db, key, sds_len(key), -1, new_value);
+}
+
+// INCRBY command implementation
+bool incrby_command(Database *db, sds key, int64_t increment, int64_t *new_value)
+{
+    return db_incrby(db, key, sds_len(key), increment, new_value);
+}
+
+// DECRBY command implementation
+bool decrby_command(Database *db, sds key, int64_t decrement, int64_t *new_value)
+{
+    // The decrement is negated, which INT64_MIN does not survive
+    if (decrement == INT64_MIN)
+        return false;
+    return db_incrby(db, key, sds_len(key), -decrement, new_value);
+}
+
+// PEXPIREAT command implementation - Set key to expire at a Unix time in milliseconds
+bool pexpireat_command(Database *db, sds key, int64_t timestamp)
+{
+    if (!db || !key || timestamp <= 0)
         return false;
-    }
 
     // Check if key exists first
-    if (!db_exists(db, key))
+    if (!db_exists(db, key, sds_len(key)))
         return false;
 
-    // Calculate expiration time
-    time_t expiration_time = time(NULL) + seconds;
+    db_set_expiration(db, key, sds_len(key), timestamp);
+    return true;
+}
 
-    // Set the expiration
-    db_set_expiration(db, key, expiration_time);
+// PEXPIRE command implementation - Set key to expire in N milliseconds
+bool pexpire_command(Database *db, sds key, int64_t milliseconds)
+{
+    int64_t expiration;
+    if (milliseconds < 0 || !expiration_from_now(milliseconds, &expiration))
+        return false;
+    return pexpireat_command(db, key, expiration);
+}
 
-    return true;
+// EXPIRE command implementation - Set key to expire in N seconds
+bool expire_command(Database *db, sds key, int seconds)
+{
+    if (seconds < 0)
+        return false;
+    return pexpire_command(db, key, (int64_t)seconds * 1000);
 }
 
-// TTL comamnd implementation - Gets the remaining time for the key
-int ttl_command(Database *db, const char *key)
+// PTTL command implementation - Gets the remaining time for the key in
+// milliseconds
+int64_t pttl_command(Database *db, sds key)
 {
     if (!db || !key)
         return -2; // Error case
 
     // Check if key exists
-    if (!db_exists(db, key))
+    if (!db_exists(db, key, sds_len(key)))
         return -2; // Key doesn't exist
 
-    // Get expiration time
-    time_t expiration = db_get_expiration(db, key);
-
+    int64_t expiration = db_get_expiration(db, key, sds_len(key));
     if (expiration == 0)
         return -1; // Key exists but has no expiration
 
-    // Calculate remaining time
-    time_t current_time = time(NULL);
-    int ttl = (int)(expiration - current_time);
-
-    // If TTL is negative or zero, the key has expired
-    if (ttl <= 0)
-    {
-        // Clean up expired key
-        db_delete(db, key);
-        return -2; // Key has expired (doesn't exist anymore)
-    }
+    // db_exists reported the key as live, so at least 1ms remains
+    int64_t ttl = expiration - clock_cached_ms();
+    return ttl > 0 ? ttl : 0;
+}
 
-    return ttl;
+// TTL comamnd implementation - Gets the remaining time for the key in
+// seconds, rounded to the nearest
+int64_t ttl_command(Database *db, sds key)
+{
+    int64_t ttl = pttl_command(db, key);
+    if (ttl < 0)
+        return ttl;
+    return (ttl + 500) / 1000;
 }
 
 // PERSIST command implementation - Remove expiration from a key
-bool persist_command(Database *db, const char *key)
+bool persist_command(Database *db, sds key)
 {
     if (!db || !key)
         return false;
 
     // Check if key exists
-    if (!db_exists(db, key))
+    if (!db_exists(db, key, sds_len(key)))
         return false;
 
     // Remove expiration
-    return db_remove_expiration(db, key);
+    return db_remove_expiration(db, key, sds_len(key));
 }
 
 // List command implementations
-bool lpush_command(Database *db, const char *key, const char *value)
+bool lpush_command(Database *db, sds key, sds value)
 {
-    return db_lpush(db, key, value);
+    return db_lpush(db, key, sds_len(key), value, sds_len(value));
 }
 
-bool rpush_command(Database *db, const char *key, const char *value)
+bool rpush_command(Database *db, sds key, sds value)
 {
-    return db_rpush(db, key, value);
+    return db_rpush(db, key, sds_len(key), value, sds_len(value));
 }
 
-char *lpop_command(Database *db, const char *key)
+sds lpop_command(Database *db, sds key)
 {
-    return db_lpop(db, key);
+    return db_lpop(db, key, sds_len(key));
 }
 
-char *rpop_command(Database *db, const char *key)
+sds rpop_command(Database *db, sds key)
 {
-    return db_rpop(db, key);
+    return db_rpop(db, key, sds_len(key));
 }
 
-char **lrange_command(Database *db, const char *key, int start, int stop, int *count)
+size_t lrange_command(Database *db, sds key, int start, int stop, DbListRange *range)
 {
-    return db_lrange(db, key, start, stop, count);
+    return db_lrange(db, key, sds_len(key), start, stop, range);
 }
 
-int llen_command(Database *db, const char *key)
+int llen_command(Database *db, sds key)
 {
-    return db_llen(db, key);
+    return db_llen(db, key, sds_len(key));
 }
 
 // Hash commands implementation
 
 // HSET command implementation
-bool hset_command(Database *db, const char *key, const char *field, const char *value)
+bool hset_command(Database *db, sds key, sds field, sds value)
 {
-    return db_hset(db, key, field, value);
+    return db_hset(db, key, sds_len(key), field, sds_len(field), value, sds_len(value));
 }
 
 // HGET command implementation
-char *hget_command(Database *db, const char *key, const char *field)
+bool hget_command(Database *db, sds key, sds field, DbString *value)
 {
-    return db_hget(db, key, field);
+    return db_hget(db, key, sds_len(key), field, sds_len(field), value);
 }
 
 // HGETALL command implementation
-char **hgetall_command(Database *db, const char *key, int *count)
+size_t hgetall_command(Database *db, sds key, HashIterator *it)
 {
-    return db_hgetall(db, key, count);
+    return db_hgetall(db, key, sds_len(key), it);
 }
 
 // HDEL command implementation
-bool hdel_command(Database *db, const char *key, const char *field)
+bool hdel_command(Database *db, sds key, sds field)
 {
-    return db_hdel(db, key, field);
+    return db_hdel(db, key, sds_len(key), field, sds_len(field));
 }
 
 // HEXISTS command implementation
-bool hexists_command(Database *db, const char *key, const char *field)
+bool hexists_command(Database *db, sds key, sds field)
+{
+    return db_hexists(db, key, sds_len(key), field, sds_len(field));
+}
+
+// OBJECT ENCODING command implementation
+const char *object_encoding_command(Database *db, sds key)
+{
+    return db_object_encoding(db, key, sds_len(key));
+}
+
+// MEMORY USAGE command implementation: bytes used by a key and its value
+bool memory_usage_command(Database *db, sds key, size_t *bytes)
+{
+    return db_memory_usage(db, key, sds_len(key), bytes);
+}
+
+// Keys looked at per SCAN or HSCAN call without a COUNT option
+#define SCAN_DEFAULT_COUNT 10
+
+// Type names accepted by SCAN TYPE, indexed by ValueType
+static const char *const g_type_names[] = {"string", "list", "hash"};
+
+// Parse a scan cursor and [MATCH pattern] [COUNT count] [TYPE type]; TYPE
+// only where with_type is set
+static ScanResult parse_scan_options(sds cursor_arg, sds *options, int option_count, bool with_type,
+                                     uint64_t *cursor, size_t *count, DbScanFilter *filter)
+{
+    int64_t number;
+    if (!string_to_int64(cursor_arg, sds_len(cursor_arg), &number) || number < 0)
+        return SCAN_INVALID_CURSOR;
+    *cursor = (uint64_t)number;
+    *count = SCAN_DEFAULT_COUNT;
+    filter->pattern = NULL;
+    filter->pattern_len = 0;
+    filter->type = -1;
+
+    for (int i = 0; i < option_count; i += 2)
+    {
+        if (i + 1 >= option_count)
+            return SCAN_SYNTAX_ERROR;
+
+        sds value = options[i + 1];
+        if (strcasecmp(options[i], "MATCH") == 0)
+        {
+            // A lone * keeps everything, no need to match
+            bool all = sds_len(value) == 1 && value[0] == '*';
+            filter->pattern = all ? NULL : value;
+            filter->pattern_len = all ? 0 : sds_len(value);
+        }
+        else if (strcasecmp(options[i], "COUNT") == 0)
+        {
+            if (!string_to_int64(value, sds_len(value), &number) || number < 1)
+                return SCAN_SYNTAX_ERROR;
+            *count = (size_t)number;
+        }
+        else if (with_type && strcasecmp(options[i], "TYPE") == 0)
+        {
+            filter->type = -2; // Unknown types match nothing
+            for (int t = 0; t < (int)(sizeof(g_type_names) / sizeof(g_type_names[0])); t++)
+            {
+                if (strcasecmp(value, g_type_names[t]) == 0)
+                    filter->type = t;
+            }
+        }
+        else
+        {
+            return SCAN_SYNTAX_ERROR;
+        }
+    }
+    return SCAN_OK;
+}
+
+// SCAN command implementation: SCAN cursor [MATCH pattern] [COUNT count] [TYPE type]
+ScanResult scan_command(Database *db, sds cursor_arg, sds *options, int option_count, uint64_t *cursor,
+                        sds **keys, int *found)
+{
+    size_t count;
+    DbScanFilter filter;
+    *keys = NULL;
+    *found = 0;
+    ScanResult result = parse_scan_options(cursor_arg, options, option_count, true, cursor, &count, &filter);
+    if (result != SCAN_OK)
+        return result;
+
+    *keys = db_scan(db, cursor, count, &filter, found);
+    return SCAN_OK;
+}
+
+// HSCAN command implementation: HSCAN key cursor [MATCH pattern] [COUNT count]
+ScanResult hscan_command(Database *db, sds key, sds cursor_arg, sds *options, int option_count,
+                         uint64_t *cursor, sds **pairs, int *found)
+{
+    size_t count;
+    DbScanFilter filter;
+    *pairs = NULL;
+    *found = 0;
+    ScanResult result = parse_scan_options(cursor_arg, options, option_count, false, cursor, &count, &filter);
+    if (result != SCAN_OK)
+        return result;
+
+    if (!db_hscan(db, key, sds_len(key), cursor, count, &filter, pairs, found))
+        return SCAN_WRONG_TYPE;
+    return SCAN_OK;
+}
+
+// CONFIG GET command implementation: name/value pairs of the parameters
+// matching a glob pattern
+sds *config_get_command(Database *db, sds pattern, int *count)
+{
+    *count = 0;
+    int param_count = 0;
+    while (g_config_params[param_count].name)
+        param_count++;
+
+    sds *result = (sds *)malloc(param_count * 2 * sizeof(sds));
+    if (!result)
+        return NULL;
+
+    for (const ConfigParam *param = g_config_params; param->name; param++)
+    {
+        if (!glob_match(pattern, sds_len(pattern), param->name, strlen(param->name), true))
+            continue;
+
+        char value[32];
+        size_t number = param->type == CONFIG_LOGLEVEL ? 0 : *config_param_value(db, param);
+        if (param->type == CONFIG_LOGLEVEL)
+            snprintf(value, sizeof(value), "%s", log_level_name(log_get_level()));
+        else if (param->type == CONFIG_POLICY)
+            snprintf(value, sizeof(value), "%s", db_eviction_policy_name(number));
+        else if (param->type == CONFIG_BOOL)
+            snprintf(value, sizeof(value), "%s", number ? "yes" : "no");
+        else
+            snprintf(value, sizeof(value), "%zu", number);
+        result[(*count)++] = sds_new(param->name);
+        result[(*count)++] = sds_new(value);
+        if (!result[*count - 2] || !result[*count - 1])
+        {
+            sds_free_array(result, *count);
+            *count = 0;
+            return NULL;
+        }
+    }
+    return result;
+}
+
+// FLUSHALL command implementation: FLUSHALL [ASYNC | SYNC]. Without an
+// option the keys are freed synchronously.
+bool flushall_command(Database *db, sds *options, int option_count)
+{
+    bool async = false;
+    if (option_count > 1)
+        return false;
+    if (option_count == 1)
+    {
+        if (strcasecmp(options[0], "ASYNC") == 0)
+            async = true;
+        else if (strcasecmp(options[0], "SYNC") != 0)
+            return false;
+    }
+    db_flush(db, async);
+    return true;
+}
+
+// CONFIG SET command implementation; fails on an unknown parameter, a
+// value that does not parse as the parameter's type, or a setting that
+// cannot be applied (the previous value is kept)
+bool config_set_command(Database *db, sds name, sds value)
+{
+    for (const ConfigParam *param = g_config_params; param->name; param++)
+    {
+        if (strcasecmp(name, param->name) != 0)
+            continue;
+
+        if (param->type == CONFIG_LOGLEVEL)
+        {
+            int level = log_level_from_name(value);
+            if (level < 0)
+                return false;
+            log_set_level(level);
+            return true;
+        }
+
+        size_t *current = config_param_value(db, param);
+        size_t previous = *current;
+        if (!config_parse_value(param, value, current))
+            return false;
+        if (!db_apply_config(db))
+        {
+            *current = previous;
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+// KEYS command implementation
+sds *keys_command(Database *db, sds pattern, int *count)
+{
+    return db_keys(db, pattern, sds_len(pattern), count);
+}
+
+// PREFIXCOUNT command implementation: keys starting with a prefix, false
+// without the key index
+bool prefixcount_command(Database *db, sds prefix, size_t *count)
 {
-    return db_hexists(db, key, field);
+    return db_count_prefix(db, prefix, sds_len(prefix), count);
 }
 
 // Pub/Sub command implementations
@@ -256,14 +602,21 @@ char **pubchannels_command(PubSubManager *pubsub, int client_socket, int *count)
 void print_help()
 {
     printf("Available commands:\n");
-    printf("  SET key value         - Set key to hold string value\n");
+    printf("  SET key value [EX seconds|PX milliseconds] [NX|XX]\n");
+    printf("                        - Set key to hold string value, optionally with a TTL\n");
+    printf("                          or only if it does not (NX) or does (XX) exist\n");
     printf("  GET key               - Get the value of key\n");
     printf("  DEL key               - Delete key\n");
     printf("  EXISTS key            - Check if key exists\n");
     printf("  INCR key              - Increment the integer value of key by one\n");
     printf("  DECR key              - Decrement the integer value of key by one\n");
+    printf("  INCRBY key increment  - Increment the integer value of key by increment\n");
+    printf("  DECRBY key decrement  - Decrement the integer value of key by decrement\n");
     printf("  EXPIRE key seconds    - Set key to expire in N seconds\n");
+    printf("  PEXPIRE key ms        - Set key to expire in N milliseconds\n");
+    printf("  PEXPIREAT key ms-time - Set key to expire at a Unix time in milliseconds\n");
     printf("  TTL key               - Get remaining time to live for a key\n");
+    printf("  PTTL key              - Get remaining time to live in milliseconds\n");
     printf("  PERSIST key           - Remove expiration from a key\n");
     printf("  LPUSH key value       - Push value to the left of the list\n");
     printf("  RPUSH key value       - Push value to the right of the list\n");
@@ -286,5 +639,17 @@ void print_help()
     printf("  EXIT                  - Exit the program\n");
     printf("\nServer options (when running in server mode):\n");
     printf("  INFO                  - Get server information\n");
+    printf("  CONFIG GET pattern    - Get configuration parameters matching pattern\n");
+    printf("  CONFIG SET name value - Set a configuration parameter\n");
+    printf("  OBJECT ENCODING key   - Get the internal encoding of the value at key\n");
+    printf("  MEMORY USAGE key      - Get the number of bytes used by key and its value\n");
+    printf("  UNLINK key            - Delete key, freeing its value in the background\n");
+    printf("  SCAN cursor [MATCH pattern] [COUNT count] [TYPE type]\n");
+    printf("                        - Iterate over the keys a few at a time\n");
+    printf("  HSCAN key cursor [MATCH pattern] [COUNT count]\n");
+    printf("                        - Iterate over the fields of a hash a few at a time\n");
+    printf("  KEYS pattern          - Get all keys matching a glob pattern\n");
+    printf("  PREFIXCOUNT prefix    - Count the keys starting with prefix (needs key-index)\n");
+    printf("  FLUSHALL [ASYNC|SYNC] - Remove every key, freeing them in the background with ASYNC\n");
     printf("  PING                  - Test connection (returns PONG)\n");
 }
\ No newline at end of file
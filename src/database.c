@@ -1,519 +1,1429 @@
 #include "../include/database.h"
+#include "../include/hashfunc.h"
+#include "../include/utils.h"
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <time.h>
 
-#define HASH_BUCKET_SIZE 16 // Small hash table for fields within a hash
+#define HASH_BUCKET_SIZE 16 // Initial field table size of a hash (power of two)
 
-// Forward declarations for static functions
-static char *my_strdup(const char *s);
-static ListNode *create_list_node(const char *data);
-static Entry *get_entry(Database *db, const char *key);
+// Shrink a hash's field table once it is less than 1/HASH_SHRINK_RATIO full
+#define HASH_SHRINK_RATIO 8
 
-static char *my_strdup(const char *s)
-{
-    if (!s)
-        return NULL;
+// Buckets migrated per write while a hash's field table is being resized
+#define HASH_REHASH_STEP_BUCKETS 1
 
-    size_t len = strlen(s) + 1;
-    char *new_str = (char *)malloc(len);
-    if (new_str)
-    {
-        memcpy(new_str, s, len);
-    }
-    return new_str;
+// Keys removed by the active expire cycle between checks of its time budget
+#define EXPIRE_BUDGET_CHECK_KEYS 16
+
+// LFU counter of a new key, so it is not evicted before it had a chance to
+// be used again
+#define LFU_INIT_VAL 5
+
+// The higher the factor, the more accesses the LFU counter needs to grow
+#define LFU_LOG_FACTOR 10
+
+// Minutes without access for the LFU counter to drop by one
+#define LFU_DECAY_MINUTES 1
+
+// Buckets a scan step may visit per key or field asked for, so that steps
+// over sparse tables stay bounded too
+#define SCAN_BUCKETS_PER_KEY 10
+
+// Bytes in front of an entry that has been given an expiration
+#define ENTRY_TIMER_PREFIX sizeof(TimerNode *)
+
+// Values taking more steps than this to free (list chunks, hash fields)
+// are handed to the lazy free thread when freeing is lazy
+#define LAZYFREE_THRESHOLD 64
+
+// List chunks, hash buckets or flushed keys freed per hold of a shard lock
+// by the lazy free thread
+#define LAZYFREE_STEP 1024
+
+// ----------------------------------Keyspace logic-----------------------------------
+
+// Key of an operation with its length, hash and shard, computed once per call
+typedef struct
+{
+    const char *str;
+    size_t len;
+    uint64_t hash;
+    DbShard *shard;
+    Database *db;
+} DbKey;
+
+// The shard is picked from the high bits of the hash; the tables index with
+// the low bits, so both stay evenly distributed
+static size_t db_shard_index(const Database *db, uint64_t hash)
+{
+    return (size_t)((hash >> 32) % db->shard_count);
 }
 
-unsigned int hash(const char *key)
+static DbKey db_key(Database *db, const char *key, size_t key_len)
 {
-    unsigned int hash_val = 0;
-    while (*key)
-    {
-        hash_val = (hash_val << 5) + *key++;
-    }
-    return hash_val % HASH_TABLE_SIZE;
+    DbKey k;
+    k.str = key;
+    k.len = key_len;
+    k.hash = hash_bytes(key, k.len);
+    k.shard = &db->shards[db_shard_index(db, k.hash)];
+    k.db = db;
+    return k;
 }
 
-// Create a new database
-Database *db_create()
+// ----------------------------------Shard memory-----------------------------------
+
+// Strings owned by the database come from the shard's pool and are sized
+// to fill their slab object, so values can often be overwritten in place
+static sds pool_sds_new(SlabPool *pool, MemCategory category, const char *data, size_t len)
 {
-    Database *db = (Database *)malloc(sizeof(Database));
-    if (!db)
+    if (len > SDS_MAX_LEN)
     {
-        fprintf(stderr, "Failed to allocate memory for database\n");
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "String too long: %zu bytes\n", len);
+        return NULL;
     }
 
-    // Initialize hash table
-    for (int i = 0; i < HASH_TABLE_SIZE; i++)
-    {
-        db->hash_table[i] = NULL;
-    }
+    size_t size = slab_class_size(sds_mem_size(len));
+    void *mem = slab_alloc(pool, category, size);
+    if (!mem)
+        return NULL;
 
-    return db;
+    return sds_init(mem, size - sds_mem_size(0), data, len);
 }
 
-// Free database resources
-void db_free(Database *db)
+static void pool_sds_free(SlabPool *pool, MemCategory category, sds s)
 {
-    if (!db)
-        return;
+    if (s)
+        slab_free(pool, category, sds_header(s), slab_class_size(sds_mem_size(sds_alloc(s))));
+}
 
-    // Free all entries
-    for (int i = 0; i < HASH_TABLE_SIZE; i++)
-    {
-        Entry *current = db->hash_table[i];
-        while (current)
-        {
-            Entry *next = current->next;
-            free(current->key);
+// Offset of the inline value, just past the key and its terminator
+static size_t entry_inline_offset(size_t key_len)
+{
+    size_t offset = offsetof(Entry, key) + key_len + 1;
+    size_t align = SDS_ALIGN;
+    return (offset + align - 1) & ~(align - 1);
+}
 
-            // Free value based on type
-            if (current->type == VALUE_STRING)
-            {
-                free(current->value.string_value);
-            }
-            else if (current->type == VALUE_LIST)
-            {
-                free_list(current->value.list_value);
-            }
-            else if (current->type == VALUE_HASH)
-            {
-                free_hash(current->value.hash_value);
-            }
+// Allocation size of an entry, derived from its key and inline value
+static size_t entry_alloc_size(const Entry *entry)
+{
+    if (entry->type == VALUE_STRING && entry->encoding == STRING_ENC_EMBSTR)
+        return entry_inline_offset(entry->key_len) + sds_mem_size(sds_alloc(entry->value.string_value));
+    return offsetof(Entry, key) + entry->key_len + 1;
+}
 
-            free(current);
-            current = next;
-        }
+// Free the value held by an entry based on its type
+static void free_entry_value(SlabPool *pool, Entry *entry)
+{
+    if (entry->type == VALUE_STRING)
+    {
+        if (entry->encoding == STRING_ENC_RAW)
+            pool_sds_free(pool, MEM_VALUES, entry->value.string_value);
+    }
+    else if (entry->type == VALUE_LIST)
+    {
+        ql_release(pool, entry->value.list_value);
+    }
+    else if (entry->type == VALUE_HASH)
+    {
+        if (entry->encoding == HASH_ENC_LISTPACK)
+            lp_free(pool, entry->value.listpack_value);
+        else
+            free_hash(pool, entry->value.hash_value);
     }
-    free(db);
 }
 
-// Get entry by key
-static Entry *get_entry(Database *db, const char *key)
+static size_t entry_prefix_size(const Entry *entry)
 {
-    if (!db || !key)
-        return NULL;
+    return entry->timer_prefix ? ENTRY_TIMER_PREFIX : 0;
+}
 
-    unsigned int index = hash(key);
-    Entry *current = db->hash_table[index];
+// Free the allocation of an entry, leaving its value alone
+static void free_entry_memory(SlabPool *pool, Entry *entry)
+{
+    size_t prefix = entry_prefix_size(entry);
+    slab_free(pool, MEM_KEYS, (char *)entry - prefix, prefix + entry_alloc_size(entry));
+}
 
-    while (current)
-    {
-        if (strcmp(current->key, key) == 0)
-        {
-            // Check if entry is expired
-            if (db_is_expired(current))
-            {
-                db_delete(db, key);
-                return NULL;
-            }
-            return current;
-        }
-        current = current->next;
-    }
-    return NULL;
+static void free_entry(SlabPool *pool, Entry *entry)
+{
+    free_entry_value(pool, entry);
+    free_entry_memory(pool, entry);
 }
 
-// Set a key-value pair in the database
-void db_set(Database *db, const char *key, const char *value)
+// ks_release callback
+static void release_entry(Entry *entry, void *pool)
 {
-    if (!db || !key || !value)
-        return;
+    free_entry((SlabPool *)pool, entry);
+}
 
-    unsigned int index = hash(key);
+static bool lazyfree_value(LazyFree *lf, DbShard *shard, Entry *entry);
+static void lazyfree_start(LazyFree *lf);
+static void lazyfree_stop(LazyFree *lf);
 
-    // Check if the key already exists
-    Entry *current = db->hash_table[index];
-    while (current)
-    {
-        if (strcmp(current->key, key) == 0)
-        {
-            // Free existing value based on type
-            if (current->type == VALUE_STRING)
-            {
-                free(current->value.string_value);
-            }
-            else if (current->type == VALUE_LIST)
-            {
-                free(current->value.list_value);
-            }
-            else if (current->type == VALUE_HASH)
-            {
-                free_hash(current->value.hash_value);
-            }
+// Free an entry that is no longer linked. With lazy set, a large value is
+// left to the lazy free thread and only the entry is freed here.
+static void discard_entry(Database *db, DbShard *shard, Entry *entry, bool lazy)
+{
+    if (lazy && lazyfree_value(&db->lazyfree, shard, entry))
+        free_entry_memory(&shard->pool, entry);
+    else
+        free_entry(&shard->pool, entry);
+}
 
-            // Update with new string value
-            current->type = VALUE_STRING;
-            current->value.string_value = my_strdup(value);
-            if (!current->value.string_value)
-            {
-                fprintf(stderr, "Failed to allocate memory for value\n");
-                return;
-            }
-            return;
-        }
-        current = current->next;
-    }
+// ----------------------------------Expiration timers-----------------------------------
+
+static void entry_set_timer(Entry *entry, TimerNode *timer)
+{
+    ((TimerNode **)entry)[-1] = timer;
+}
+
+// Copy an entry into an allocation with room for a timer pointer; the
+// value moves along. The original is left for the caller to relink and
+// release with free_entry_memory.
+static Entry *entry_add_timer_prefix(SlabPool *pool, Entry *entry)
+{
+    size_t size = entry_alloc_size(entry);
+    char *mem = (char *)slab_alloc(pool, MEM_KEYS, ENTRY_TIMER_PREFIX + size);
+    if (!mem)
+        return NULL;
+
+    Entry *moved = (Entry *)(mem + ENTRY_TIMER_PREFIX);
+    memcpy(moved, entry, size);
+    if (entry->type == VALUE_STRING && entry->encoding == STRING_ENC_EMBSTR)
+        moved->value.string_value = (char *)moved + (entry->value.string_value - (char *)entry);
+    moved->timer_prefix = 1;
+    entry_set_timer(moved, NULL);
+    return moved;
+}
 
-    // Create new entry
-    Entry *new_entry = (Entry *)malloc(sizeof(Entry));
-    if (!new_entry)
+// Schedule an entry's expiration, moving it to an allocation with a timer
+// pointer the first time. The entry pointer is invalid afterwards.
+static bool entry_set_expiration(const DbKey *k, Entry *entry, int64_t expiration)
+{
+    SlabPool *pool = &k->shard->pool;
+    TimerWheel *wheel = &k->shard->expires;
+    TimerNode *timer = db_entry_timer(entry);
+    if (timer)
     {
-        fprintf(stderr, "Failed to allocate memory for entry\n");
-        return;
+        tw_update(wheel, timer, expiration);
+        return true;
     }
 
-    new_entry->key = my_strdup(key);
-    if (!new_entry->key)
+    if (!entry->timer_prefix)
     {
-        fprintf(stderr, "Failed to allocate memory for key\n");
-        free(new_entry);
-        return;
+        Entry *moved = entry_add_timer_prefix(pool, entry);
+        if (!moved)
+        {
+            fprintf(stderr, "Failed to allocate memory for expiration\n");
+            return false;
+        }
+        ks_replace(&k->shard->keys, entry, moved);
+        free_entry_memory(pool, entry);
+        entry = moved;
     }
 
-    new_entry->type = VALUE_STRING;
-    new_entry->value.string_value = my_strdup(value);
-    if (!new_entry->value.string_value)
+    timer = tw_add(pool, wheel, entry, expiration);
+    if (!timer)
     {
-        fprintf(stderr, "Failed to allocate memory for value\n");
-        free(new_entry->key);
-        free(new_entry);
-        return;
+        fprintf(stderr, "Failed to allocate memory for expiration\n");
+        return false;
     }
+    entry_set_timer(entry, timer);
+    return true;
+}
 
-    new_entry->expiration = 0; // No expiration by default
-    new_entry->next = db->hash_table[index];
-    db->hash_table[index] = new_entry;
+// Unlink an entry from the keyspace and free it, lazily if asked to
+static void unlink_entry(Database *db, DbShard *shard, Entry *entry, bool lazy)
+{
+    TimerNode *timer = db_entry_timer(entry);
+    if (timer)
+        tw_remove(&shard->pool, &shard->expires, timer);
+    ks_remove(&shard->keys, entry->key, entry->key_len, entry->hash);
+    radix_remove(&shard->pool, &shard->index, entry->key, entry->key_len);
+    discard_entry(db, shard, entry, lazy);
 }
 
-// Get a value by key from the database
-char *db_get(Database *db, const char *key)
+// ----------------------------------Access tracking-----------------------------------
+
+// An entry's access field holds, depending on the eviction policy, the
+// time of its last access in seconds (LRU), or the minute its counter was
+// last decayed, modulo 2^16, in bits 8 to 23 and a logarithmic access
+// counter in the low 8 bits (LFU). Changing the policy reinterprets the
+// fields in place.
+
+static bool policy_is_lfu(size_t policy)
 {
-    Entry *entry = get_entry(db, key);
-    if (!entry || entry->type != VALUE_STRING)
-        return NULL;
+    return policy == EVICT_ALLKEYS_LFU || policy == EVICT_VOLATILE_LFU;
+}
 
-    return entry->value.string_value;
+static uint32_t lru_clock(void)
+{
+    return (uint32_t)(clock_cached_ms() / 1000);
 }
 
-// Check if a key exists in the database
-bool db_exists(Database *db, const char *key)
+static uint32_t lfu_minutes(void)
 {
-    return get_entry(db, key) != NULL;
+    return (uint32_t)(clock_cached_ms() / 60000) & 0xFFFF;
 }
 
-// Delete a key from the database
-bool db_delete(Database *db, const char *key)
+// LFU counter of an access field, decayed by the minutes since
+static uint32_t lfu_counter(uint32_t access)
 {
-    if (!db || !key)
-        return false;
+    uint32_t periods = ((lfu_minutes() - (access >> 8)) & 0xFFFF) / LFU_DECAY_MINUTES;
+    uint32_t counter = access & 0xFF;
+    return periods > counter ? 0 : counter - periods;
+}
 
-    unsigned int index = hash(key);
+// Count an access with probability 1 / ((counter - LFU_INIT_VAL) *
+// LFU_LOG_FACTOR + 1), so 8 bits cover millions of accesses
+static uint32_t lfu_increment(uint32_t counter)
+{
+    if (counter == 0xFF)
+        return counter;
+    uint64_t base = counter > LFU_INIT_VAL ? counter - LFU_INIT_VAL : 0;
+    return random_u64() % (base * LFU_LOG_FACTOR + 1) == 0 ? counter + 1 : counter;
+}
 
-    Entry *current = db->hash_table[index];
-    Entry *prev = NULL;
+static uint32_t initial_access(const DbConfig *config)
+{
+    if (policy_is_lfu(config->maxmemory_policy))
+        return lfu_minutes() << 8 | LFU_INIT_VAL;
+    return lru_clock();
+}
 
-    while (current)
-    {
-        if (strcmp(current->key, key) == 0)
-        {
-            // Remove entry
-            if (prev)
-            {
-                prev->next = current->next;
-            }
-            else
-            {
-                db->hash_table[index] = current->next;
-            }
+// Record an access to an entry. Readers under a shared shard lock race on
+// the field, so it is accessed atomically; a lost update only blurs the
+// statistics. The field is only written when it changes.
+static void db_touch_entry(const DbConfig *config, Entry *entry)
+{
+    uint32_t access = __atomic_load_n(&entry->access, __ATOMIC_RELAXED);
+    uint32_t updated;
+    if (policy_is_lfu(config->maxmemory_policy))
+        updated = lfu_minutes() << 8 | lfu_increment(lfu_counter(access));
+    else
+        updated = lru_clock();
 
-            free(current->key);
+    if (updated != access)
+        __atomic_store_n(&entry->access, updated, __ATOMIC_RELAXED);
+}
 
-            if (current->type == VALUE_STRING)
-            {
-                free(current->value.string_value);
-            }
-            else if (current->type == VALUE_LIST)
-            {
-                free_list(current->value.list_value);
-            }
-            else if (current->type == VALUE_HASH)
-            {
-                free_hash(current->value.hash_value);
-            }
+// ----------------------------------Entries-----------------------------------
 
-            free(current);
-            return true;
-        }
+// Allocate an entry of size bytes holding the key, with no value and no
+// expiration
+static Entry *alloc_entry(const DbKey *k, ValueType type, size_t size)
+{
+    if (k->len > UINT32_MAX)
+        return NULL;
 
-        prev = current;
-        current = current->next;
-    }
+    Entry *entry = (Entry *)slab_alloc(&k->shard->pool, MEM_KEYS, size);
+    if (!entry)
+        return NULL;
 
-    return false; // Key not found
+    memcpy(entry->key, k->str, k->len);
+    entry->key[k->len] = '\0';
+    entry->key_len = (uint32_t)k->len;
+    entry->hash = k->hash;
+    entry->type = type;
+    entry->encoding = STRING_ENC_RAW;
+    entry->timer_prefix = 0;
+    entry->access = initial_access(&k->db->config);
+    return entry;
 }
 
-// Check if an entry is expired
-bool db_is_expired(Entry *entry)
+static Entry *create_entry(const DbKey *k, ValueType type)
 {
-    if (!entry || entry->expiration == 0)
-    {
-        return false;
-    }
-
-    return time(NULL) >= entry->expiration;
+    return alloc_entry(k, type, offsetof(Entry, key) + k->len + 1);
 }
 
-// Clean up expired entries from the database
-void db_cleanup_expired(Database *db)
+// Create a string entry; small values share the entry's allocation, whose
+// slack up to the slab object size becomes spare inline capacity
+static Entry *create_string_entry(const DbKey *k, const char *value, size_t value_len)
 {
-    if (!db)
-        return;
-
-    time_t current_time = time(NULL);
+    bool is_inline = value_len <= DB_INLINE_VALUE_MAX;
+    size_t offset = entry_inline_offset(k->len);
+    size_t size = slab_class_size(offset + sds_mem_size(value_len));
+    Entry *entry = is_inline ? alloc_entry(k, VALUE_STRING, size) : create_entry(k, VALUE_STRING);
+    if (!entry)
+        return NULL;
 
-    for (int i = 0; i < HASH_TABLE_SIZE; i++)
+    if (is_inline)
     {
-        Entry *current = db->hash_table[i];
-        Entry *prev = NULL;
-
-        while (current)
+        entry->value.string_value = sds_init((char *)entry + offset, size - offset - sds_mem_size(0),
+                                             value, value_len);
+        entry->encoding = STRING_ENC_EMBSTR;
+    }
+    else
+    {
+        entry->value.string_value = pool_sds_new(&k->shard->pool, MEM_VALUES, value, value_len);
+        if (!entry->value.string_value)
         {
-            Entry *next = current->next;
-
-            if (current->expiration != 0 && current_time >= current->expiration)
-            {
-                // Remove expired entry
-                if (prev)
-                {
-                    prev->next = current->next;
-                }
-                else
-                {
-                    db->hash_table[i] = current->next;
-                }
-
-                free(current->key);
-
-                if (current->type == VALUE_STRING)
-                {
-                    free(current->value.string_value);
-                }
-                else if (current->type == VALUE_LIST)
-                {
-                    free_list(current->value.list_value);
-                }
-
-                free(current);
-            }
-            else
-            {
-                prev = current;
-            }
-
-            current = next;
+            free_entry(&k->shard->pool, entry);
+            return NULL;
         }
     }
+    return entry;
 }
 
-// Set expiration time for a key
-void db_set_expiration(Database *db, const char *key, time_t expiration)
+// Create a string entry holding an integer
+static Entry *create_int_entry(const DbKey *k, int64_t value)
 {
-    if (!db || !key)
-        return;
-
-    unsigned int index = hash(key);
+    Entry *entry = create_entry(k, VALUE_STRING);
+    if (!entry)
+        return NULL;
 
-    Entry *current = db->hash_table[index];
+    entry->encoding = STRING_ENC_INT;
+    entry->value.int_value = value;
+    return entry;
+}
 
-    while (current)
+// Link a new entry into its shard and key index, freeing it if either
+// cannot grow
+static bool db_add_entry(const DbKey *k, Entry *entry)
+{
+    if (!ks_insert(&k->shard->keys, entry))
     {
-        if (strcmp(current->key, key) == 0)
-        {
-            current->expiration = expiration;
-            return;
-        }
-        current = current->next;
+        free_entry(&k->shard->pool, entry);
+        return false;
+    }
+    if (k->db->indexed && !radix_insert(&k->shard->pool, &k->shard->index, entry->key, entry->key_len))
+    {
+        fprintf(stderr, "Failed to allocate memory for key index\n");
+        ks_remove(&k->shard->keys, entry->key, entry->key_len, entry->hash);
+        free_entry(&k->shard->pool, entry);
+        return false;
     }
+    return true;
 }
 
-// Get expiration time for a key
-time_t db_get_expiration(Database *db, const char *key)
+// Put new_entry in place of current (if any), keeping the expiration
+static bool db_put_entry(const DbKey *k, Entry *current, Entry *new_entry)
 {
-    if (!db || !key)
-        return 0;
+    if (!current)
+        return db_add_entry(k, new_entry);
 
-    unsigned int index = hash(key);
-
-    Entry *current = db->hash_table[index];
-    while (current)
+    SlabPool *pool = &k->shard->pool;
+    TimerNode *timer = db_entry_timer(current);
+    if (timer)
     {
-        if (strcmp(current->key, key) == 0)
+        Entry *moved = entry_add_timer_prefix(pool, new_entry);
+        if (!moved)
         {
-            return current->expiration;
+            free_entry(pool, new_entry);
+            return false;
         }
-        current = current->next;
+        free_entry_memory(pool, new_entry);
+        new_entry = moved;
+        entry_set_timer(new_entry, timer);
+        timer->owner = new_entry;
     }
 
-    return 0; // Key not found
+    ks_replace(&k->shard->keys, current, new_entry);
+    discard_entry(k->db, k->shard, current, k->db->config.lazyfree_server_del != 0);
+    return true;
 }
 
-bool db_remove_expiration(Database *db, const char *key)
+// Store an integer in an existing string entry. A separate buffer is
+// released in place; an inline one shrinks the entry, so it is reallocated.
+static bool string_entry_set_int(const DbKey *k, Entry *entry, int64_t value)
 {
-    if (!db || !key)
-        return false;
-
-    unsigned int index = hash(key);
-
-    Entry *current = db->hash_table[index];
-    while (current)
+    if (entry->encoding == STRING_ENC_EMBSTR)
     {
-        if (strcmp(current->key, key) == 0)
-        {
-            if (current->expiration != 0)
-            {
-                current->expiration = 0;
-                return true;
-            }
-            return false; // Key exists but has no expiration
-        }
-        current = current->next;
+        Entry *new_entry = create_int_entry(k, value);
+        if (!new_entry)
+            return false;
+        return db_put_entry(k, entry, new_entry);
     }
 
-    return false; // Key not found
+    if (entry->encoding == STRING_ENC_RAW)
+        pool_sds_free(&k->shard->pool, MEM_VALUES, entry->value.string_value);
+
+    entry->encoding = STRING_ENC_INT;
+    entry->value.int_value = value;
+    return true;
 }
 
-static ListNode *create_list_node(const char *data)
+// Read-only lookup, safe under a shared shard lock: expired entries are
+// reported as missing and left for a later write to remove
+static Entry *get_entry_read(const DbKey *k)
 {
-    ListNode *node = (ListNode *)malloc(sizeof(ListNode));
-    if (!node)
+    Entry *entry = ks_find(&k->shard->keys, k->str, k->len, k->hash);
+    if (!entry || db_is_expired(entry))
         return NULL;
+    db_touch_entry(&k->db->config, entry);
+    return entry;
+}
 
-    node->data = my_strdup(data);
-    if (!node->data)
+// Lookup for write operations (exclusive shard lock): advances table
+// maintenance and removes the entry if it has expired
+static Entry *get_entry_write(const DbKey *k)
+{
+    Keyspace *keys = &k->shard->keys;
+
+    ks_maintain(keys);
+
+    Entry *entry = ks_find(keys, k->str, k->len, k->hash);
+    if (entry && db_is_expired(entry))
     {
-        free(node);
+        // Lazily remove expired entry
+        unlink_entry(k->db, k->shard, entry, k->db->config.lazyfree_server_del != 0);
+        k->shard->expired_lazy++;
         return NULL;
     }
+    if (entry)
+        db_touch_entry(&k->db->config, entry);
+    return entry;
+}
+
+// Unlink and free a key's entry, lazily if asked to
+static bool db_delete_key(const DbKey *k, bool lazy)
+{
+    Entry *entry = ks_find(&k->shard->keys, k->str, k->len, k->hash);
+    if (!entry)
+        return false; // Key not found
 
-    node->prev = NULL;
-    node->next = NULL;
-    return node;
+    unlink_entry(k->db, k->shard, entry, lazy);
+    return true;
 }
 
-void free_list_node(ListNode *node)
+// Create a new database split into shard_count independently locked shards
+Database *db_create(size_t shard_count)
 {
-    if (node)
+    if (shard_count == 0)
+        shard_count = DB_DEFAULT_SHARDS;
+    if (shard_count > DB_MAX_SHARDS)
+        shard_count = DB_MAX_SHARDS;
+
+    Database *db = (Database *)malloc(sizeof(Database));
+    DbShard *shards = (DbShard *)calloc(shard_count, sizeof(DbShard));
+    if (!db || !shards)
+    {
+        fprintf(stderr, "Failed to allocate memory for database\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < shard_count; i++)
     {
-        free(node->data);
-        free(node);
+        if (!ks_init(&shards[i].keys) || pthread_rwlock_init(&shards[i].lock, NULL) != 0)
+        {
+            fprintf(stderr, "Failed to initialize database shard\n");
+            exit(EXIT_FAILURE);
+        }
+        slab_pool_init(&shards[i].pool);
+        tw_init(&shards[i].expires, clock_refresh_ms());
+        radix_init(&shards[i].index);
     }
+
+    db->shards = shards;
+    db->shard_count = shard_count;
+    db->config.hash_max_entries = DB_HASH_MAX_ENTRIES;
+    db->config.hash_max_value = DB_HASH_MAX_VALUE;
+    db->config.maxmemory = 0;
+    db->config.maxmemory_policy = EVICT_NOEVICTION;
+    db->config.maxmemory_samples = DB_MAXMEMORY_SAMPLES;
+    db->config.lazyfree_user_del = 0;
+    db->config.lazyfree_server_del = 0;
+    db->config.key_index = 0;
+    db->expire_shard = 0;
+    db->indexed = false;
+    lazyfree_start(&db->lazyfree);
+    return db;
 }
 
-List *create_list()
+// Free database resources
+void db_free(Database *db)
 {
-    List *list = (List *)malloc(sizeof(List));
-    if (!list)
-        return NULL;
+    if (!db)
+        return;
 
-    list->head = NULL;
-    list->tail = NULL;
-    list->length = 0;
-    return list;
+    lazyfree_stop(&db->lazyfree);
+    for (size_t i = 0; i < db->shard_count; i++)
+    {
+        ks_release(&db->shards[i].keys, release_entry, &db->shards[i].pool);
+        tw_release(&db->shards[i].pool, &db->shards[i].expires);
+        radix_release(&db->shards[i].pool, &db->shards[i].index);
+        slab_pool_release(&db->shards[i].pool);
+        pthread_rwlock_destroy(&db->shards[i].lock);
+    }
+    free(db->shards);
+    free(db);
 }
 
-void free_list(List *list)
+// Remove every key from the database
+void db_clear(Database *db)
 {
-    if (!list)
+    if (!db)
         return;
 
-    ListNode *current = list->head;
-    while (current)
+    for (size_t i = 0; i < db->shard_count; i++)
     {
-        ListNode *next = current->next;
-        free_list_node(current);
-        current = next;
+        ks_release(&db->shards[i].keys, release_entry, &db->shards[i].pool);
+        tw_release(&db->shards[i].pool, &db->shards[i].expires);
+        radix_release(&db->shards[i].pool, &db->shards[i].index);
+        if (!ks_init(&db->shards[i].keys))
+        {
+            fprintf(stderr, "Failed to allocate memory for database\n");
+            exit(EXIT_FAILURE);
+        }
     }
-
-    free(list);
 }
 
-bool db_lpush(Database *db, const char *key, const char *value)
+bool db_apply_config(Database *db)
 {
-    if (!db || !key || !value)
-        return false;
+    bool enable = db->config.key_index != 0;
+    if (enable == db->indexed)
+        return true;
 
-    unsigned int index = hash(key);
-    Entry *entry = get_entry(db, key);
+    db->indexed = false;
+    for (size_t i = 0; i < db->shard_count; i++)
+        radix_release(&db->shards[i].pool, &db->shards[i].index);
+    if (!enable)
+        return true;
 
-    if (entry)
-    {
-        // Key exists, must be a list
-        if (entry->type != VALUE_LIST)
-            return false; // Type mismatch
-    }
-    else
+    for (size_t i = 0; i < db->shard_count; i++)
     {
-        // Create new list entry
-        entry = (Entry *)malloc(sizeof(Entry));
-        if (!entry)
+        DbShard *shard = &db->shards[i];
+        KsIterator it;
+        Entry *entry;
+        ks_iterator_init(&it, &shard->keys);
+        while ((entry = ks_iterator_next(&it)) != NULL)
+        {
+            if (!radix_insert(&shard->pool, &shard->index, entry->key, entry->key_len))
+            {
+                fprintf(stderr, "Failed to allocate memory for key index\n");
+                for (size_t j = 0; j <= i; j++)
+                    radix_release(&db->shards[j].pool, &db->shards[j].index);
+                return false;
+            }
+        }
+    }
+    db->indexed = true;
+    return true;
+}
+
+// Number of keys stored (including expired keys not yet removed)
+size_t db_size(Database *db)
+{
+    if (!db)
+        return 0;
+
+    size_t total = 0;
+    for (size_t i = 0; i < db->shard_count; i++)
+    {
+        total += ks_size(&db->shards[i].keys);
+    }
+    return total;
+}
+
+// ----------------------------------Shard locking-----------------------------------
+
+void db_lock_key(Database *db, const char *key, size_t key_len, bool exclusive)
+{
+    DbKey k = db_key(db, key, key_len);
+    if (exclusive)
+        pthread_rwlock_wrlock(&k.shard->lock);
+    else
+        pthread_rwlock_rdlock(&k.shard->lock);
+}
+
+void db_unlock_key(Database *db, const char *key, size_t key_len)
+{
+    DbKey k = db_key(db, key, key_len);
+    pthread_rwlock_unlock(&k.shard->lock);
+}
+
+// Shards are always locked in index order so whole-database operations
+// cannot deadlock with each other
+void db_lock_all(Database *db, bool exclusive)
+{
+    for (size_t i = 0; i < db->shard_count; i++)
+    {
+        if (exclusive)
+            pthread_rwlock_wrlock(&db->shards[i].lock);
+        else
+            pthread_rwlock_rdlock(&db->shards[i].lock);
+    }
+}
+
+void db_unlock_all(Database *db)
+{
+    for (size_t i = db->shard_count; i > 0; i--)
+    {
+        pthread_rwlock_unlock(&db->shards[i - 1].lock);
+    }
+}
+
+// ----------------------------------Iteration-----------------------------------
+
+void db_iterator_init(DbIterator *it, Database *db)
+{
+    it->db = db;
+    it->shard = 0;
+    ks_iterator_init(&it->keys, &db->shards[0].keys);
+}
+
+// Return the next entry, or NULL once every shard has been visited
+Entry *db_iterator_next(DbIterator *it)
+{
+    for (;;)
+    {
+        Entry *entry = ks_iterator_next(&it->keys);
+        if (entry)
+            return entry;
+
+        if (++it->shard >= it->db->shard_count)
+            return NULL;
+        ks_iterator_init(&it->keys, &it->db->shards[it->shard].keys);
+    }
+}
+
+// ----------------------------------Cursor scans-----------------------------------
+
+// Keys, or field/value pairs, collected by a scan step
+typedef struct
+{
+    const DbScanFilter *filter;
+    sds *items;
+    int count;
+    int capacity;
+    size_t visited; // Keys or fields looked at, kept or not
+    bool failed;    // Out of memory; the step is dropped
+} ScanBatch;
+
+static void scan_batch_add(ScanBatch *batch, const char *data, size_t len)
+{
+    if (batch->failed)
+        return;
+
+    if (batch->count == batch->capacity)
+    {
+        int capacity = batch->capacity ? batch->capacity * 2 : 16;
+        sds *items = (sds *)realloc(batch->items, (size_t)capacity * sizeof(sds));
+        if (!items)
+        {
+            batch->failed = true;
+            return;
+        }
+        batch->items = items;
+        batch->capacity = capacity;
+    }
+
+    batch->items[batch->count] = sds_new_len(data, len);
+    if (!batch->items[batch->count])
+        batch->failed = true;
+    else
+        batch->count++;
+}
+
+static bool scan_batch_matches(const ScanBatch *batch, const char *data, size_t len)
+{
+    const DbScanFilter *filter = batch->filter;
+    return !filter || !filter->pattern || glob_match(filter->pattern, filter->pattern_len, data, len, false);
+}
+
+// Hand the collected strings to the caller, or free them if the step failed
+static sds *scan_batch_finish(ScanBatch *batch, int *found)
+{
+    if (batch->failed)
+    {
+        sds_free_array(batch->items, batch->count);
+        *found = 0;
+        return NULL;
+    }
+    *found = batch->count;
+    return batch->items;
+}
+
+// ks_scan callback
+static void scan_key(Entry *entry, void *ctx)
+{
+    ScanBatch *batch = (ScanBatch *)ctx;
+    batch->visited++;
+    if (db_is_expired(entry))
+        return;
+    if (batch->filter && batch->filter->type != -1 && entry->type != batch->filter->type)
+        return;
+    if (scan_batch_matches(batch, entry->key, entry->key_len))
+        scan_batch_add(batch, entry->key, entry->key_len);
+}
+
+// Key index walk of a scan step or KEYS over one shard
+typedef struct
+{
+    DbShard *shard;
+    ScanBatch *batch;
+} IndexScan;
+
+// radix_walk_prefix callback: the entry is looked up to skip expired keys
+// and apply the type filter
+static bool scan_indexed_key(const char *key, size_t len, void *ctx)
+{
+    IndexScan *scan = (IndexScan *)ctx;
+    Entry *entry = ks_find(&scan->shard->keys, key, len, hash_bytes(key, len));
+    if (entry)
+        scan_key(entry, scan->batch);
+    return !scan->batch->failed;
+}
+
+// Collect every key of a shard passing the batch's filter from the key
+// index, if there is one and the pattern starts with literal bytes (caller
+// holds the shard lock). Only the keys with that prefix are visited and
+// matched against the whole pattern. False if the index cannot serve the
+// filter.
+static bool shard_scan_index(Database *db, DbShard *shard, ScanBatch *batch)
+{
+    const DbScanFilter *filter = batch->filter;
+    if (!db->indexed || !filter || !filter->pattern)
+        return false;
+    size_t prefix_len = glob_literal_prefix(filter->pattern, filter->pattern_len);
+    if (prefix_len == 0)
+        return false;
+
+    IndexScan scan = {shard, batch};
+    if (!radix_walk_prefix(&shard->index, filter->pattern, prefix_len, scan_indexed_key, &scan))
+        batch->failed = true;
+    return true;
+}
+
+// The shard is the cursor's lowest digit in base shard_count, the table
+// cursor of the shard the rest, so shards are scanned one after another
+sds *db_scan(Database *db, uint64_t *cursor, size_t count, const DbScanFilter *filter, int *found)
+{
+    *found = 0;
+    if (!db)
+        return NULL;
+    if (count == 0)
+        count = 1;
+
+    size_t shard_index = (size_t)(*cursor % db->shard_count);
+    uint64_t table_cursor = *cursor / db->shard_count;
+    DbShard *shard = &db->shards[shard_index];
+
+    ScanBatch batch = {filter, NULL, 0, 0, 0, false};
+    size_t buckets = count * SCAN_BUCKETS_PER_KEY;
+    pthread_rwlock_rdlock(&shard->lock);
+    // A shard served by its key index is done in one step
+    if (table_cursor != 0 || !shard_scan_index(db, shard, &batch))
+    {
+        do
+        {
+            table_cursor = ks_scan(&shard->keys, table_cursor, scan_key, &batch);
+        } while (table_cursor != 0 && batch.visited < count && --buckets > 0);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    // On failure the cursor stays, so the step can be retried
+    sds *keys = scan_batch_finish(&batch, found);
+    if (batch.failed)
+        return NULL;
+
+    if (table_cursor != 0)
+        *cursor = table_cursor * db->shard_count + shard_index;
+    else
+        *cursor = shard_index + 1 < db->shard_count ? shard_index + 1 : 0;
+    return keys;
+}
+
+sds *db_keys(Database *db, const char *pattern, size_t pattern_len, int *found)
+{
+    *found = 0;
+    if (!db)
+        return NULL;
+
+    DbScanFilter filter = {pattern, pattern_len, -1};
+    ScanBatch batch = {&filter, NULL, 0, 0, 0, false};
+    for (size_t i = 0; i < db->shard_count && !batch.failed; i++)
+    {
+        DbShard *shard = &db->shards[i];
+        pthread_rwlock_rdlock(&shard->lock);
+        if (!shard_scan_index(db, shard, &batch))
+        {
+            KsIterator it;
+            Entry *entry;
+            ks_iterator_init(&it, &shard->keys);
+            while (!batch.failed && (entry = ks_iterator_next(&it)) != NULL)
+                scan_key(entry, &batch);
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+    return scan_batch_finish(&batch, found);
+}
+
+bool db_count_prefix(Database *db, const char *prefix, size_t prefix_len, size_t *count)
+{
+    *count = 0;
+    if (!db)
+        return false;
+
+    for (size_t i = 0; i < db->shard_count; i++)
+    {
+        DbShard *shard = &db->shards[i];
+        pthread_rwlock_rdlock(&shard->lock);
+        bool indexed = db->indexed;
+        if (indexed)
+            *count += radix_count_prefix(&shard->index, prefix, prefix_len);
+        pthread_rwlock_unlock(&shard->lock);
+        if (!indexed)
+            return false;
+    }
+    return true;
+}
+
+// Add the slab usage of every shard to stats (caller holds all shard locks)
+void db_slab_stats(Database *db, SlabStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < db->shard_count; i++)
+    {
+        slab_pool_add_stats(&db->shards[i].pool, stats);
+    }
+}
+
+// ----------------------------------String operations-----------------------------------
+
+// Store a string value under a key whose current entry (if any) has been
+// looked up with get_entry_write
+static bool db_set_value(const DbKey *k, Entry *current, const char *value, size_t value_len)
+{
+    Entry *new_entry;
+
+    // Integers are stored unformatted
+    int64_t int_value;
+    if (string_to_int64(value, value_len, &int_value))
+    {
+        if (current && current->type == VALUE_STRING)
+        {
+            if (string_entry_set_int(k, current, int_value))
+                return true;
+            fprintf(stderr, "Failed to allocate memory for entry\n");
+            return false;
+        }
+
+        new_entry = create_int_entry(k, int_value);
+        if (!new_entry || !db_put_entry(k, current, new_entry))
+        {
+            fprintf(stderr, "Failed to allocate memory for entry\n");
             return false;
+        }
+        return true;
+    }
+
+    bool fits_inline = value_len <= DB_INLINE_VALUE_MAX;
+    if (current && current->type == VALUE_STRING)
+    {
+        // Overwrite in place when the layout stays the same and the new
+        // value fits the current buffer
+        StringEncoding wanted = fits_inline ? STRING_ENC_EMBSTR : STRING_ENC_RAW;
+        if (current->encoding == wanted &&
+            sds_assign(current->value.string_value, value, value_len))
+            return true;
+
+        // Large values are kept out of line, so only the value is replaced
+        if (!fits_inline && current->encoding != STRING_ENC_EMBSTR)
+        {
+            sds new_value = pool_sds_new(&k->shard->pool, MEM_VALUES, value, value_len);
+            if (!new_value)
+            {
+                fprintf(stderr, "Failed to allocate memory for value\n");
+                return false;
+            }
+            if (current->encoding == STRING_ENC_RAW)
+                pool_sds_free(&k->shard->pool, MEM_VALUES, current->value.string_value);
+            current->encoding = STRING_ENC_RAW;
+            current->value.string_value = new_value;
+            return true;
+        }
+    }
+
+    // Create new entry; if the value changed layout it replaces the old one
+    new_entry = create_string_entry(k, value, value_len);
+    if (!new_entry || !db_put_entry(k, current, new_entry))
+    {
+        fprintf(stderr, "Failed to allocate memory for entry\n");
+        return false;
+    }
+    return true;
+}
+
+// Set a key-value pair in the database
+void db_set(Database *db, const char *key, size_t key_len, const char *value, size_t value_len)
+{
+    if (!db || !key || !value)
+        return;
+
+    DbKey k = db_key(db, key, key_len);
+    db_set_value(&k, get_entry_write(&k), value, value_len);
+}
+
+bool db_set_with_options(Database *db, const char *key, size_t key_len, const char *value, size_t value_len,
+                         int flags, int64_t expiration)
+{
+    if (!db || !key || !value)
+        return false;
+
+    DbKey k = db_key(db, key, key_len);
+    Entry *current = get_entry_write(&k);
+    if ((flags & DB_SET_NX) && current)
+        return false;
+    if ((flags & DB_SET_XX) && !current)
+        return false;
+
+    if (!db_set_value(&k, current, value, value_len))
+        return false;
+    if (expiration == 0)
+        return true;
+
+    // The value may have moved to a new entry
+    Entry *entry = ks_find(&k.shard->keys, k.str, k.len, k.hash);
+    return entry && entry_set_expiration(&k, entry, expiration);
+}
+
+
+// Get a value by key from the database
+bool db_get(Database *db, const char *key, size_t key_len, DbString *out)
+{
+    if (!db || !key)
+        return false;
+
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = get_entry_read(&k);
+    if (!entry || entry->type != VALUE_STRING)
+        return false;
+
+    if (entry->encoding == STRING_ENC_INT)
+    {
+        out->len = int64_to_string(entry->value.int_value, out->buf);
+        out->data = out->buf;
+    }
+    else
+    {
+        out->data = entry->value.string_value;
+        out->len = sds_len(entry->value.string_value);
+    }
+    return true;
+}
+
+// Add delta to the integer stored at key, in place with a single lookup.
+// Missing keys count as 0. Fails if the value is not an integer or the
+// result would overflow.
+bool db_incrby(Database *db, const char *key, size_t key_len, int64_t delta, int64_t *result)
+{
+    if (!db || !key)
+        return false;
+
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = get_entry_write(&k);
+    int64_t value = 0;
+
+    if (entry)
+    {
+        if (entry->type != VALUE_STRING)
+            return false; // Type mismatch
+
+        if (entry->encoding == STRING_ENC_INT)
+        {
+            value = entry->value.int_value;
+        }
+        else if (!string_to_int64(entry->value.string_value, sds_len(entry->value.string_value), &value))
+        {
+            return false; // Not a valid integer
+        }
+    }
+
+    if ((delta > 0 && value > INT64_MAX - delta) || (delta < 0 && value < INT64_MIN - delta))
+        return false; // Would overflow
+
+    value += delta;
+
+    if (entry)
+    {
+        if (!string_entry_set_int(&k, entry, value))
+            return false;
+    }
+    else
+    {
+        entry = create_int_entry(&k, value);
+        if (!entry || !db_add_entry(&k, entry))
+            return false;
+    }
+
+    *result = value;
+    return true;
+}
+
+// Check if a key exists in the database
+bool db_exists(Database *db, const char *key, size_t key_len)
+{
+    if (!db || !key)
+        return false;
+
+    DbKey k = db_key(db, key, key_len);
+    return get_entry_read(&k) != NULL;
+}
+
+// Delete a key from the database
+bool db_delete(Database *db, const char *key, size_t key_len)
+{
+    if (!db || !key)
+        return false;
+
+    DbKey k = db_key(db, key, key_len);
+    ks_maintain(&k.shard->keys);
+    return db_delete_key(&k, db->config.lazyfree_user_del != 0);
+}
+
+bool db_unlink(Database *db, const char *key, size_t key_len)
+{
+    if (!db || !key)
+        return false;
+
+    DbKey k = db_key(db, key, key_len);
+    ks_maintain(&k.shard->keys);
+    return db_delete_key(&k, true);
+}
+
+// Check if an entry is expired
+bool db_is_expired(Entry *entry)
+{
+    if (!entry)
+        return false;
+
+    int64_t expiration = db_entry_expiration(entry);
+    return expiration != 0 && clock_cached_ms() >= expiration;
+}
+
+static long elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000L;
+}
+
+// Remove the keys of a shard that are due at now (caller holds its
+// exclusive lock), checking the time budget from start if one is given.
+// Returns false if the budget ran out first.
+static bool shard_expire_due(Database *db, DbShard *shard, int64_t now, const struct timespec *start,
+                             long budget_us, size_t *removed)
+{
+    bool finished = true;
+    size_t count = 0;
+
+    TimerNode *timer;
+    while ((timer = tw_next_due(&shard->expires, now)) != NULL)
+    {
+        unlink_entry(db, shard, (Entry *)timer->owner, db->config.lazyfree_server_del != 0);
+        count++;
+        if (start && count % EXPIRE_BUDGET_CHECK_KEYS == 0 && elapsed_us(start) >= budget_us)
+        {
+            finished = false;
+            break;
+        }
+    }
+
+    shard->expired_active += count;
+    *removed += count;
+    ks_maintain(&shard->keys);
+    return finished;
+}
+
+// Clean up expired entries from the database (caller holds all shard locks)
+void db_cleanup_expired(Database *db)
+{
+    if (!db)
+        return;
+
+    int64_t now = clock_refresh_ms();
+    size_t removed = 0;
+    for (size_t i = 0; i < db->shard_count; i++)
+        shard_expire_due(db, &db->shards[i], now, NULL, 0, &removed);
+}
+
+size_t db_active_expire_cycle(Database *db, long budget_us)
+{
+    if (!db)
+        return 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int64_t now = clock_refresh_ms();
+
+    size_t removed = 0;
+    for (size_t visited = 0; visited < db->shard_count; visited++)
+    {
+        DbShard *shard = &db->shards[db->expire_shard];
+        db->expire_shard = (db->expire_shard + 1) % db->shard_count;
+
+        pthread_rwlock_wrlock(&shard->lock);
+        bool finished = shard_expire_due(db, shard, now, &start, budget_us, &removed);
+        pthread_rwlock_unlock(&shard->lock);
+
+        // The next cycle resumes with the shard after this one
+        if (!finished || elapsed_us(&start) >= budget_us)
+            break;
+    }
+    return removed;
+}
+
+void db_expire_stats(Database *db, DbExpireStats *stats)
+{
+    stats->expires = 0;
+    stats->expired_active = 0;
+    stats->expired_lazy = 0;
+    for (size_t i = 0; i < db->shard_count; i++)
+    {
+        stats->expires += db->shards[i].expires.count;
+        stats->expired_active += db->shards[i].expired_active;
+        stats->expired_lazy += db->shards[i].expired_lazy;
+    }
+}
+
+// ----------------------------------Memory accounting-----------------------------------
+
+static size_t pool_sds_memory(const sds s)
+{
+    return slab_class_size(sds_mem_size(sds_alloc(s)));
+}
+
+static size_t hash_table_memory(const Hash *hash)
+{
+    size_t bytes = slab_class_size(sizeof(Hash));
+    for (int t = 0; t < 2; t++)
+    {
+        if (!hash->table[t])
+            continue;
+        bytes += slab_class_size(hash->size[t] * sizeof(HashField *));
+        for (size_t i = 0; i < hash->size[t]; i++)
+        {
+            for (const HashField *f = hash->table[t][i]; f; f = f->next)
+                bytes += slab_class_size(sizeof(HashField)) + pool_sds_memory(f->field) + pool_sds_memory(f->value);
+        }
+    }
+    return bytes;
+}
+
+// Pool memory of an entry and its value, plus its share of the key table
+static size_t entry_memory_usage(const DbShard *shard, const Entry *entry)
+{
+    size_t bytes = slab_class_size(entry_prefix_size(entry) + entry_alloc_size(entry));
+    if (db_entry_timer(entry))
+        bytes += slab_class_size(sizeof(TimerNode));
+    bytes += ks_memory(&shard->keys) / ks_size(&shard->keys);
+
+    if (entry->type == VALUE_STRING && entry->encoding == STRING_ENC_RAW)
+        bytes += pool_sds_memory(entry->value.string_value);
+    else if (entry->type == VALUE_LIST)
+        bytes += ql_memory(entry->value.list_value);
+    else if (entry->type == VALUE_HASH && entry->encoding == HASH_ENC_LISTPACK)
+        bytes += lp_memory(entry->value.listpack_value);
+    else if (entry->type == VALUE_HASH)
+        bytes += hash_table_memory(entry->value.hash_value);
+    return bytes;
+}
+
+bool db_memory_usage(Database *db, const char *key, size_t key_len, size_t *bytes)
+{
+    if (!db || !key)
+        return false;
+
+    // Not an access: the entry's LRU/LFU state is left alone
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = ks_find(&k.shard->keys, k.str, k.len, k.hash);
+    if (!entry || db_is_expired(entry))
+        return false;
+
+    *bytes = entry_memory_usage(k.shard, entry);
+    return true;
+}
+
+// ----------------------------------Eviction-----------------------------------
+
+static const char *const g_eviction_policy_names[] = {
+    "noeviction", "allkeys-lru", "volatile-lru", "allkeys-lfu", "volatile-lfu", "volatile-ttl", NULL};
+
+const char *db_eviction_policy_name(size_t policy)
+{
+    return policy < EVICT_VOLATILE_TTL + 1 ? g_eviction_policy_names[policy] : "unknown";
+}
+
+int db_eviction_policy_from_name(const char *name)
+{
+    for (int i = 0; g_eviction_policy_names[i]; i++)
+    {
+        if (strcasecmp(name, g_eviction_policy_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// How good an eviction candidate an entry is: the higher the better
+static uint32_t eviction_score(size_t policy, const Entry *entry)
+{
+    if (policy_is_lfu(policy))
+        return 0xFF - lfu_counter(entry->access);
+
+    uint32_t now = lru_clock();
+    return now > entry->access ? now - entry->access : 0;
+}
+
+// Approximate the policy's best key to evict by comparing a few sampled
+// ones; NULL if the shard has no key the policy may evict
+static Entry *shard_eviction_candidate(DbShard *shard, const DbConfig *config)
+{
+    size_t policy = config->maxmemory_policy;
+    if (policy == EVICT_VOLATILE_TTL)
+    {
+        TimerNode *timer = tw_first(&shard->expires);
+        return timer ? (Entry *)timer->owner : NULL;
+    }
 
-        entry->key = my_strdup(key);
-        if (!entry->key)
+    bool volatile_only = policy == EVICT_VOLATILE_LRU || policy == EVICT_VOLATILE_LFU;
+    size_t samples = config->maxmemory_samples > 0 ? config->maxmemory_samples : 1;
+    Entry *best = NULL;
+    uint32_t best_score = 0;
+    for (size_t i = 0; i < samples; i++)
+    {
+        Entry *entry;
+        if (volatile_only)
         {
-            free(entry);
-            return false;
+            TimerNode *timer = tw_random(&shard->expires);
+            entry = timer ? (Entry *)timer->owner : NULL;
         }
+        else
+        {
+            entry = ks_random(&shard->keys);
+        }
+        if (!entry)
+            return NULL;
 
-        entry->type = VALUE_LIST;
-        entry->value.list_value = create_list();
-        if (!entry->value.list_value)
+        uint32_t score = eviction_score(policy, entry);
+        if (!best || score > best_score)
         {
-            free(entry->key);
-            free(entry);
-            return false;
+            best = entry;
+            best_score = score;
         }
+    }
+    return best;
+}
 
-        entry->expiration = 0;
-        entry->next = db->hash_table[index];
-        db->hash_table[index] = entry;
+// Evict keys of a shard (caller holds its exclusive lock) until the
+// database is back under maxmemory; false if the shard runs out of keys
+// the policy may evict first
+static bool shard_evict(Database *db, DbShard *shard)
+{
+    while (mem_used_database() > db->config.maxmemory)
+    {
+        Entry *victim = shard_eviction_candidate(shard, &db->config);
+        if (!victim)
+            return false;
+        // Freed at once so the memory drops before the next check
+        unlink_entry(db, shard, victim, false);
+        shard->evicted++;
     }
+    return true;
+}
 
-    // Add to the left of list
-    ListNode *new_node = create_list_node(value);
-    if (!new_node)
+bool db_ensure_memory(Database *db, const char *key, size_t key_len)
+{
+    if (!db || db->config.maxmemory == 0 || mem_used_database() <= db->config.maxmemory)
+        return true;
+    if (db->config.maxmemory_policy == EVICT_NOEVICTION)
         return false;
 
-    List *list = entry->value.list_value;
+    DbKey k = db_key(db, key, key_len);
+    if (shard_evict(db, k.shard))
+        return true;
 
-    if (list->head == NULL)
+    // Then the other shards, starting after this one. Only those free right
+    // now: waiting for one while holding this shard's lock could deadlock.
+    size_t first = (size_t)(k.shard - db->shards);
+    for (size_t n = 1; n < db->shard_count; n++)
     {
-        // Empty list
-        list->head = list->tail = new_node;
+        DbShard *shard = &db->shards[(first + n) % db->shard_count];
+        if (pthread_rwlock_trywrlock(&shard->lock) != 0)
+            continue;
+        bool done = shard_evict(db, shard);
+        pthread_rwlock_unlock(&shard->lock);
+        if (done)
+            return true;
     }
-    else
+    return false;
+}
+
+size_t db_evicted_keys(Database *db)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < db->shard_count; i++)
+        total += db->shards[i].evicted;
+    return total;
+}
+
+// Set expiration time for a key; 0 removes it
+void db_set_expiration(Database *db, const char *key, size_t key_len, int64_t expiration)
+{
+    if (!db || !key)
+        return;
+
+    if (expiration == 0)
     {
-        // Add to beginning
-        new_node->next = list->head;
-        list->head->prev = new_node;
-        list->head = new_node;
+        db_remove_expiration(db, key, key_len);
+        return;
     }
 
-    list->length++;
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = ks_find(&k.shard->keys, k.str, k.len, k.hash);
+    if (entry)
+        entry_set_expiration(&k, entry, expiration);
+}
+
+// Get expiration time for a key
+int64_t db_get_expiration(Database *db, const char *key, size_t key_len)
+{
+    if (!db || !key)
+        return 0;
+
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = ks_find(&k.shard->keys, k.str, k.len, k.hash);
+    return entry ? db_entry_expiration(entry) : 0; // 0 if key not found
+}
+
+// Remove the expiration of a key. The entry keeps its room for a timer
+// pointer, so expiring it again does not reallocate it.
+bool db_remove_expiration(Database *db, const char *key, size_t key_len)
+{
+    if (!db || !key)
+        return false;
+
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = ks_find(&k.shard->keys, k.str, k.len, k.hash);
+    if (!entry)
+        return false; // Key not found
+
+    TimerNode *timer = db_entry_timer(entry);
+    if (!timer)
+        return false; // Key exists but has no expiration
+
+    tw_remove(&k.shard->pool, &k.shard->expires, timer);
+    entry_set_timer(entry, NULL);
     return true;
 }
 
-bool db_rpush(Database *db, const char *key, const char *value)
+// ----------------------------------List operations logic-----------------------------------
+
+// Push onto the list at key, creating it if needed
+static bool db_push(Database *db, const char *key, size_t key_len, const char *value, size_t value_len,
+                    bool at_head)
 {
     if (!db || !key || !value)
         return false;
 
-    unsigned int index = hash(key);
-    Entry *entry = get_entry(db, key);
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = get_entry_write(&k);
 
+    bool created = !entry;
     if (entry)
     {
         // Key exists, must be a list
@@ -523,262 +1433,641 @@ bool db_rpush(Database *db, const char *key, const char *value)
     else
     {
         // Create new list entry
-        entry = (Entry *)malloc(sizeof(Entry));
+        entry = create_entry(&k, VALUE_LIST);
         if (!entry)
             return false;
 
-        entry->key = my_strdup(key);
-        if (!entry->key)
-        {
-            free(entry);
-            return false;
-        }
-
-        entry->type = VALUE_LIST;
-        entry->value.list_value = create_list();
+        entry->value.list_value = ql_create(&k.shard->pool);
         if (!entry->value.list_value)
         {
-            free(entry->key);
-            free(entry);
+            free_entry(&k.shard->pool, entry);
             return false;
         }
 
-        entry->expiration = 0;
-        entry->next = db->hash_table[index];
-        db->hash_table[index] = entry;
+        if (!db_add_entry(&k, entry))
+            return false;
     }
 
-    // Add to right of list
-    ListNode *new_node = create_list_node(value);
-    if (!new_node)
+    if (!ql_push(&k.shard->pool, entry->value.list_value, value, value_len, at_head))
+    {
+        // A new key is never left behind as an empty list
+        if (created)
+            db_delete_key(&k, false);
         return false;
+    }
+    return true;
+}
+
+// Pop from the list at key, removing the key once the list is empty
+static sds db_pop(Database *db, const char *key, size_t key_len, bool at_head)
+{
+    if (!db || !key)
+        return NULL;
+
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = get_entry_write(&k);
+    if (!entry || entry->type != VALUE_LIST)
+        return NULL;
 
     List *list = entry->value.list_value;
+    sds data = ql_pop(&k.shard->pool, list, at_head);
 
-    if (list->tail == NULL)
-    {
-        // Empty list
-        list->head = list->tail = new_node;
-    }
-    else
+    // If list is empty, remove the key
+    if (list->length == 0)
     {
-        // Add to end
-        new_node->prev = list->tail;
-        list->tail->next = new_node;
-        list->tail = new_node;
+        db_delete_key(&k, false);
     }
 
-    list->length++;
-    return true;
+    return data;
 }
 
-char *db_lpop(Database *db, const char *key)
+bool db_lpush(Database *db, const char *key, size_t key_len, const char *value, size_t value_len)
 {
-    Entry *entry = get_entry(db, key);
+    return db_push(db, key, key_len, value, value_len, true);
+}
+
+bool db_rpush(Database *db, const char *key, size_t key_len, const char *value, size_t value_len)
+{
+    return db_push(db, key, key_len, value, value_len, false);
+}
+
+sds db_lpop(Database *db, const char *key, size_t key_len)
+{
+    return db_pop(db, key, key_len, true);
+}
+
+sds db_rpop(Database *db, const char *key, size_t key_len)
+{
+    return db_pop(db, key, key_len, false);
+}
+
+int db_llen(Database *db, const char *key, size_t key_len)
+{
+    if (!db || !key)
+        return 0;
+
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = get_entry_read(&k);
     if (!entry || entry->type != VALUE_LIST)
-        return NULL;
+        return 0;
+
+    return (int)entry->value.list_value->length;
+}
+
+size_t db_lrange(Database *db, const char *key, size_t key_len, int start, int stop, DbListRange *range)
+{
+    range->remaining = 0;
+    if (!db || !key)
+        return 0;
+
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = get_entry_read(&k);
+    if (!entry || entry->type != VALUE_LIST)
+        return 0;
 
     List *list = entry->value.list_value;
-    if (list->length == 0)
+    int len = (int)list->length;
+
+    if (len == 0)
+        return 0;
+
+    // Handle negative indices
+    if (start < 0)
+        start = len + start;
+    if (stop < 0)
+        stop = len + stop;
+
+    // Clamp to valid range
+    if (start < 0)
+        start = 0;
+    if (stop >= len)
+        stop = len - 1;
+    if (start > stop)
+        return 0;
+
+    // Seek to the start position, skipping whole chunks
+    ql_iterator_seek(&range->it, list, (size_t)start);
+    range->remaining = (size_t)(stop - start + 1);
+    return range->remaining;
+}
+
+bool db_lrange_next(DbListRange *range, DbString *out)
+{
+    if (range->remaining == 0 || !ql_iterator_next(&range->it, &out->data, &out->len))
+        return false;
+    range->remaining--;
+    return true;
+}
+
+// ----------------------------------Hash operations logic-----------------------------------
+
+// Compare a hash field against a field name and its hash
+static inline bool hash_field_matches(const HashField *f, const char *field, size_t field_len, uint64_t field_hash)
+{
+    return f->hash == field_hash && sds_len(f->field) == field_len && memcmp(f->field, field, field_len) == 0;
+}
+
+static void free_hash_field(SlabPool *pool, HashField *f)
+{
+    pool_sds_free(pool, MEM_HASH_FIELDS, f->field);
+    pool_sds_free(pool, MEM_HASH_FIELDS, f->value);
+    slab_free(pool, MEM_HASH_FIELDS, f, sizeof(HashField));
+}
+
+static bool hash_is_rehashing(const Hash *hash)
+{
+    return hash->rehash_index != -1;
+}
+
+static size_t hash_length(const Hash *hash)
+{
+    return hash->used[0] + hash->used[1];
+}
+
+// Smallest power of two bucket count that can hold n fields
+static size_t hash_table_size_for(size_t n)
+{
+    size_t size = HASH_BUCKET_SIZE;
+    while (size < n)
+        size *= 2;
+    return size;
+}
+
+static HashField **hash_alloc_table(SlabPool *pool, size_t size)
+{
+    HashField **table = (HashField **)slab_alloc(pool, MEM_HASH_FIELDS, size * sizeof(HashField *));
+    if (table)
+        memset(table, 0, size * sizeof(HashField *));
+    return table;
+}
+
+// Create a new hash structure sized for the given number of fields
+Hash *create_hash(SlabPool *pool, size_t fields)
+{
+    Hash *hash = (Hash *)slab_alloc(pool, MEM_HASH_FIELDS, sizeof(Hash));
+    if (!hash)
         return NULL;
 
-    ListNode *node = list->head;
-    char *data = my_strdup(node->data);
+    size_t size = hash_table_size_for(fields);
+    hash->table[0] = hash_alloc_table(pool, size);
+    if (!hash->table[0])
+    {
+        slab_free(pool, MEM_HASH_FIELDS, hash, sizeof(Hash));
+        return NULL;
+    }
+
+    hash->size[0] = size;
+    hash->used[0] = 0;
+    hash->table[1] = NULL;
+    hash->size[1] = 0;
+    hash->used[1] = 0;
+    hash->rehash_index = -1;
+    return hash;
+}
+
+// Free the fields of at most buckets buckets of a hash that is no longer
+// in use, resuming at *cursor (table[0], then table[1]); frees the tables
+// and the hash and returns true once every bucket is done
+static bool hash_release_step(SlabPool *pool, Hash *hash, size_t *cursor, size_t buckets)
+{
+    size_t size0 = hash->table[0] ? hash->size[0] : 0;
+    size_t total = size0 + (hash->table[1] ? hash->size[1] : 0);
+    size_t end = buckets < total - *cursor ? *cursor + buckets : total;
 
-    // Remove from list
-    if (list->length == 1)
+    for (; *cursor < end; (*cursor)++)
     {
-        list->head = list->tail = NULL;
+        HashField **bucket = *cursor < size0 ? &hash->table[0][*cursor] : &hash->table[1][*cursor - size0];
+        HashField *current = *bucket;
+        while (current)
+        {
+            HashField *next = current->next;
+            free_hash_field(pool, current);
+            current = next;
+        }
+        *bucket = NULL;
     }
-    else
+    if (*cursor < total)
+        return false;
+
+    for (int t = 0; t <= 1; t++)
     {
-        list->head = node->next;
-        list->head->prev = NULL;
+        if (hash->table[t])
+            slab_free(pool, MEM_HASH_FIELDS, hash->table[t], hash->size[t] * sizeof(HashField *));
     }
+    slab_free(pool, MEM_HASH_FIELDS, hash, sizeof(Hash));
+    return true;
+}
+
+// Free hash structure and all its fields
+void free_hash(SlabPool *pool, Hash *hash)
+{
+    if (!hash)
+        return;
 
-    list->length--;
-    free_list_node(node);
+    size_t cursor = 0;
+    hash_release_step(pool, hash, &cursor, SIZE_MAX);
+}
 
-    // If list is empty, remove the key
-    if (list->length == 0)
+// Start migrating the fields into a new table of the given size
+static void hash_resize(SlabPool *pool, Hash *hash, size_t new_size)
+{
+    if (hash_is_rehashing(hash) || new_size == hash->size[0])
+        return;
+
+    // On failure the hash keeps working with its current table
+    HashField **table = hash_alloc_table(pool, new_size);
+    if (!table)
+        return;
+
+    hash->table[1] = table;
+    hash->size[1] = new_size;
+    hash->used[1] = 0;
+    hash->rehash_index = 0;
+}
+
+// Grow or shrink the field table when the load factor leaves its bounds
+static void hash_check_resize(SlabPool *pool, Hash *hash)
+{
+    if (hash_is_rehashing(hash))
+        return;
+
+    if (hash->used[0] >= hash->size[0])
     {
-        db_delete(db, key);
+        hash_resize(pool, hash, hash_table_size_for(hash->used[0] * 2));
     }
+    else if (hash->size[0] > HASH_BUCKET_SIZE && hash->used[0] * HASH_SHRINK_RATIO < hash->size[0])
+    {
+        hash_resize(pool, hash, hash_table_size_for(hash->used[0]));
+    }
+}
 
-    return data;
+// Migrate up to 'buckets' non-empty buckets from table[0] to table[1],
+// visiting at most 10 empty buckets per requested bucket
+static void hash_rehash_step(SlabPool *pool, Hash *hash, size_t buckets)
+{
+    if (!hash_is_rehashing(hash))
+        return;
+
+    size_t empty_visits = buckets * 10;
+    size_t mask = hash->size[1] - 1;
+
+    while (buckets-- && hash->used[0] != 0)
+    {
+        while (hash->table[0][hash->rehash_index] == NULL)
+        {
+            hash->rehash_index++;
+            if (--empty_visits == 0)
+                return;
+        }
+
+        HashField *current = hash->table[0][hash->rehash_index];
+        while (current)
+        {
+            HashField *next = current->next;
+            size_t index = current->hash & mask;
+            current->next = hash->table[1][index];
+            hash->table[1][index] = current;
+            hash->used[0]--;
+            hash->used[1]++;
+            current = next;
+        }
+        hash->table[0][hash->rehash_index] = NULL;
+        hash->rehash_index++;
+    }
+
+    // Migration finished, table[1] becomes the main table
+    if (hash->used[0] == 0)
+    {
+        slab_free(pool, MEM_HASH_FIELDS, hash->table[0], hash->size[0] * sizeof(HashField *));
+        hash->table[0] = hash->table[1];
+        hash->size[0] = hash->size[1];
+        hash->used[0] = hash->used[1];
+        hash->table[1] = NULL;
+        hash->size[1] = 0;
+        hash->used[1] = 0;
+        hash->rehash_index = -1;
+    }
 }
 
-char *db_rpop(Database *db, const char *key)
+// Bounded table maintenance, run by every write to a table-encoded hash
+static void hash_maintain(SlabPool *pool, Hash *hash)
 {
-    Entry *entry = get_entry(db, key);
-    if (!entry || entry->type != VALUE_LIST)
-        return NULL;
+    hash_rehash_step(pool, hash, HASH_REHASH_STEP_BUCKETS);
+    hash_check_resize(pool, hash);
+}
 
-    List *list = entry->value.list_value;
-    if (list->length == 0)
-        return NULL;
+// Find a field in a table-encoded hash, looking in both tables
+static HashField *hash_table_find(const Hash *hash, const char *field, size_t field_len, uint64_t field_hash)
+{
+    for (int t = 0; t <= 1; t++)
+    {
+        HashField *current = hash->table[t][field_hash & (hash->size[t] - 1)];
+        while (current)
+        {
+            if (hash_field_matches(current, field, field_len, field_hash))
+                return current;
+            current = current->next;
+        }
+
+        if (!hash_is_rehashing(hash))
+            break;
+    }
+    return NULL;
+}
+
+// Add a field that is not present yet to a table-encoded hash; new fields
+// go to table[1] while rehashing
+static bool hash_table_add(SlabPool *pool, Hash *hash, const char *field, size_t field_len, uint64_t field_hash,
+                           const char *value, size_t value_len)
+{
+    HashField *new_field = (HashField *)slab_alloc(pool, MEM_HASH_FIELDS, sizeof(HashField));
+    if (!new_field)
+        return false;
+
+    new_field->field = pool_sds_new(pool, MEM_HASH_FIELDS, field, field_len);
+    new_field->value = pool_sds_new(pool, MEM_HASH_FIELDS, value, value_len);
+    if (!new_field->field || !new_field->value)
+    {
+        free_hash_field(pool, new_field);
+        return false;
+    }
+
+    int t = hash_is_rehashing(hash) ? 1 : 0;
+    size_t field_index = field_hash & (hash->size[t] - 1);
+    new_field->hash = field_hash;
+    new_field->next = hash->table[t][field_index];
+    hash->table[t][field_index] = new_field;
+    hash->used[t]++;
 
-    ListNode *node = list->tail;
-    char *data = my_strdup(node->data);
+    hash_check_resize(pool, hash);
+    return true;
+}
+
+// Unlink and free a field of a table-encoded hash
+static bool hash_table_delete(SlabPool *pool, Hash *hash, const char *field, size_t field_len)
+{
+    uint64_t field_hash = hash_bytes(field, field_len);
+
+    for (int t = 0; t <= 1; t++)
+    {
+        HashField **link = &hash->table[t][field_hash & (hash->size[t] - 1)];
+        while (*link)
+        {
+            HashField *current = *link;
+            if (hash_field_matches(current, field, field_len, field_hash))
+            {
+                *link = current->next;
+                free_hash_field(pool, current);
+                hash->used[t]--;
+                return true;
+            }
+            link = &current->next;
+        }
+
+        if (!hash_is_rehashing(hash))
+            break;
+    }
+    return false;
+}
 
-    // Remove from list
-    if (list->length == 1)
+// Offset of a field in a listpack-encoded hash, or lp->used if absent.
+// The value follows at *value_offset.
+static size_t hash_listpack_find(const Listpack *lp, const char *field, size_t field_len, size_t *value_offset)
+{
+    size_t offset = 0;
+    while (offset < lp->used)
     {
-        list->head = list->tail = NULL;
+        const char *current;
+        size_t current_len;
+        size_t next = lp_get(lp, offset, &current, &current_len);
+        if (current_len == field_len && memcmp(current, field, field_len) == 0)
+        {
+            *value_offset = next;
+            return offset;
+        }
+        offset = next + lp_element_size(lp->data + next);
     }
-    else
+    return lp->used;
+}
+
+// Give a new hash entry an empty value, compact unless it is known to
+// outgrow the listpack encoding straight away
+static bool create_hash_value(SlabPool *pool, Entry *entry, bool compact, size_t size)
+{
+    if (compact)
     {
-        list->tail = node->prev;
-        list->tail->next = NULL;
+        entry->encoding = HASH_ENC_LISTPACK;
+        entry->value.listpack_value = lp_create(pool, size);
+        return entry->value.listpack_value != NULL;
     }
 
-    list->length--;
-    free_list_node(node);
+    entry->encoding = HASH_ENC_TABLE;
+    entry->value.hash_value = create_hash(pool, 0);
+    return entry->value.hash_value != NULL;
+}
 
-    // If list is empty, remove the key
-    if (list->length == 0)
+// Move the fields of a listpack-encoded hash into a table
+static bool hash_convert_to_table(SlabPool *pool, Entry *entry)
+{
+    Listpack *lp = entry->value.listpack_value;
+    Hash *hash = create_hash(pool, lp->count / 2 + 1);
+    if (!hash)
+        return false;
+
+    size_t offset = 0;
+    while (offset < lp->used)
     {
-        db_delete(db, key);
+        const char *field, *value;
+        size_t field_len, value_len;
+        offset = lp_get(lp, offset, &field, &field_len);
+        offset = lp_get(lp, offset, &value, &value_len);
+        if (!hash_table_add(pool, hash, field, field_len, hash_bytes(field, field_len), value, value_len))
+        {
+            free_hash(pool, hash);
+            return false;
+        }
     }
 
-    return data;
+    lp_free(pool, lp);
+    entry->encoding = HASH_ENC_TABLE;
+    entry->value.hash_value = hash;
+    return true;
 }
 
-int db_llen(Database *db, const char *key)
+// Count a field visited by a scan step and keep it with its value if it
+// passes the filter
+static void scan_field(ScanBatch *batch, const char *field, size_t field_len, const char *value,
+                       size_t value_len)
 {
-    Entry *entry = get_entry(db, key);
-    if (!entry || entry->type != VALUE_LIST)
-        return 0;
+    batch->visited++;
+    if (!scan_batch_matches(batch, field, field_len))
+        return;
+    scan_batch_add(batch, field, field_len);
+    scan_batch_add(batch, value, value_len);
+}
 
-    return (int)entry->value.list_value->length;
+static void hash_scan_bucket(const HashField *f, ScanBatch *batch)
+{
+    for (; f; f = f->next)
+        scan_field(batch, f->field, sds_len(f->field), f->value, sds_len(f->value));
 }
 
-char **db_lrange(Database *db, const char *key, int start, int stop, int *count)
+// One step of a cursor scan over a field table, like ks_scan: while
+// rehashing, the cursor's bucket in the smaller table is visited along
+// with every bucket of the larger table it splits into
+static uint64_t hash_scan(const Hash *hash, uint64_t cursor, ScanBatch *batch)
 {
-    *count = 0;
-    Entry *entry = get_entry(db, key);
-    if (!entry || entry->type != VALUE_LIST)
-        return NULL;
+    if (!hash_is_rehashing(hash))
+    {
+        uint64_t mask = hash->size[0] - 1;
+        hash_scan_bucket(hash->table[0][cursor & mask], batch);
+        return scan_cursor_next(cursor, mask);
+    }
 
-    List *list = entry->value.list_value;
-    int len = (int)list->length;
+    int small = hash->size[0] <= hash->size[1] ? 0 : 1;
+    uint64_t small_mask = hash->size[small] - 1;
+    uint64_t large_mask = hash->size[1 - small] - 1;
 
-    if (len == 0)
-        return NULL;
+    hash_scan_bucket(hash->table[small][cursor & small_mask], batch);
+    do
+    {
+        hash_scan_bucket(hash->table[1 - small][cursor & large_mask], batch);
+        cursor = (((cursor | small_mask) + 1) & ~small_mask) | (cursor & small_mask);
+    } while (cursor & (small_mask ^ large_mask));
 
-    // Handle negative indices
-    if (start < 0)
-        start = len + start;
-    if (stop < 0)
-        stop = len + stop;
+    return scan_cursor_next(cursor, small_mask);
+}
 
-    // Clamp to valid range
-    if (start < 0)
-        start = 0;
-    if (stop >= len)
-        stop = len - 1;
-    if (start > stop)
-        return NULL;
+size_t db_hash_length(const Entry *entry)
+{
+    if (entry->encoding == HASH_ENC_LISTPACK)
+        return entry->value.listpack_value->count / 2;
+    return hash_length(entry->value.hash_value);
+}
 
-    int result_count = stop - start + 1;
-    char **result = (char **)malloc(result_count * sizeof(char *));
-    if (!result)
-        return NULL;
+void db_hash_iterator_init(HashIterator *it, const Entry *entry)
+{
+    it->entry = entry;
+    it->table = 0;
+    it->bucket = 0;
+    it->field = NULL;
+    it->offset = 0;
+}
 
-    // Navigate to start position
-    ListNode *current = list->head;
-    for (int i = 0; i < start && current; i++)
+bool db_hash_iterator_next(HashIterator *it, DbString *field, DbString *value)
+{
+    if (it->entry->encoding == HASH_ENC_LISTPACK)
     {
-        current = current->next;
+        const Listpack *lp = it->entry->value.listpack_value;
+        if (it->offset >= lp->used)
+            return false;
+
+        it->offset = lp_get(lp, it->offset, &field->data, &field->len);
+        it->offset = lp_get(lp, it->offset, &value->data, &value->len);
+        return true;
     }
 
-    // Collect elements
-    int idx = 0;
-    for (int i = start; i <= stop && current; i++)
+    const Hash *hash = it->entry->value.hash_value;
+    while (!it->field)
     {
-        result[idx] = my_strdup(current->data);
-        if (!result[idx])
+        if (it->bucket >= hash->size[it->table])
         {
-            // Cleanup on error
-            for (int j = 0; j < idx; j++)
-            {
-                free(result[j]);
-            }
-            free(result);
-            return NULL;
+            if (it->table == 1 || !hash_is_rehashing(hash))
+                return false;
+            it->table = 1;
+            it->bucket = 0;
+            continue;
         }
-        idx++;
-        current = current->next;
+        it->field = hash->table[it->table][it->bucket++];
     }
 
-    *count = result_count;
-    return result;
+    field->data = it->field->field;
+    field->len = sds_len(it->field->field);
+    value->data = it->field->value;
+    value->len = sds_len(it->field->value);
+    it->field = it->field->next;
+    return true;
 }
 
-// ----------------------------------Hash operations logic-----------------------------------
-
-// Hash function for hash fields
-static unsigned int hash_field(const char *field)
+// Store a field in an existing hash, converting it to a table if it
+// outgrows its listpack
+static bool hash_set_field(Database *db, SlabPool *pool, Entry *entry, const char *field, size_t field_len,
+                           const char *value, size_t value_len)
 {
-    unsigned int hash_val = 0;
-    while (*field)
+    // Pairs with a long field or value never stay in a listpack
+    bool small = field_len <= db->config.hash_max_value && value_len <= db->config.hash_max_value;
+    size_t pair_size = lp_len_size(field_len) + field_len + lp_len_size(value_len) + value_len;
+
+    if (entry->encoding == HASH_ENC_LISTPACK)
     {
-        hash_val = (hash_val << 5) + *field++;
-    }
-    return hash_val % HASH_BUCKET_SIZE;
-}
+        Listpack *lp = entry->value.listpack_value;
+        size_t value_offset;
+        bool exists = hash_listpack_find(lp, field, field_len, &value_offset) < lp->used;
 
-// Create a new hash structure
-Hash *create_hash()
-{
-    Hash *hash = (Hash *)malloc(sizeof(Hash));
-    if (!hash)
-        return NULL;
+        if (small && (exists || lp->count / 2 < db->config.hash_max_entries))
+        {
+            if (exists)
+            {
+                lp = lp_replace(pool, lp, value_offset, value, value_len);
+            }
+            else
+            {
+                // Reserve the whole pair first so it is never half added
+                lp = lp_reserve(pool, lp, pair_size);
+                if (lp)
+                {
+                    lp = lp_append(pool, lp, field, field_len);
+                    lp = lp_append(pool, lp, value, value_len);
+                }
+            }
 
-    hash->buckets = (HashField **)calloc(HASH_BUCKET_SIZE, sizeof(HashField *));
-    if (!hash->buckets)
-    {
-        free(hash);
-        return NULL;
-    }
+            if (!lp)
+                return false;
+            entry->value.listpack_value = lp;
+            return true;
+        }
 
-    hash->bucket_count = HASH_BUCKET_SIZE;
-    hash->field_count = 0;
-    return hash;
-}
+        // Outgrew the compact encoding
+        if (!hash_convert_to_table(pool, entry))
+            return false;
+    }
 
-// Free hash structure and all its fields
-void free_hash(Hash *hash)
-{
-    if (!hash)
-        return;
+    Hash *hash = entry->value.hash_value;
+    uint64_t field_hash = hash_bytes(field, field_len);
+    hash_maintain(pool, hash);
 
-    for (size_t i = 0; i < hash->bucket_count; i++)
+    // Check if field already exists
+    HashField *current = hash_table_find(hash, field, field_len, field_hash);
+    if (current)
     {
-        HashField *current = hash->buckets[i];
-        while (current)
-        {
-            HashField *next = current->next;
-            free(current->field);
-            free(current->value);
-            free(current);
-            current = next;
-        }
+        // Field exists, update value (in place if it fits)
+        if (sds_assign(current->value, value, value_len))
+            return true;
+
+        sds new_value = pool_sds_new(pool, MEM_HASH_FIELDS, value, value_len);
+        if (!new_value)
+            return false;
+        pool_sds_free(pool, MEM_HASH_FIELDS, current->value);
+        current->value = new_value;
+        return true;
     }
 
-    free(hash->buckets);
-    free(hash);
+    // Field doesn't exist, create new one
+    return hash_table_add(pool, hash, field, field_len, field_hash, value, value_len);
 }
 
 // HSET - Set field in hash stored at key
-bool db_hset(Database *db, const char *key, const char *field, const char *value)
+bool db_hset(Database *db, const char *key, size_t key_len, const char *field, size_t field_len,
+             const char *value, size_t value_len)
 {
     if (!db || !key || !field || !value)
         return false;
 
-    unsigned int index = hash(key);
-    Entry *entry = get_entry(db, key);
+    DbKey k = db_key(db, key, key_len);
+    SlabPool *pool = &k.shard->pool;
+    Entry *entry = get_entry_write(&k);
 
+    bool created = !entry;
     if (entry)
     {
         // Key exists, must be a hash
@@ -787,218 +2076,442 @@ bool db_hset(Database *db, const char *key, const char *field, const char *value
     }
     else
     {
-        // Create a new hash entry
-        entry = (Entry *)malloc(sizeof(Entry));
+        // Create new hash entry, sized for the first field
+        bool small = field_len <= db->config.hash_max_value && value_len <= db->config.hash_max_value;
+        size_t pair_size = lp_len_size(field_len) + field_len + lp_len_size(value_len) + value_len;
+        entry = create_entry(&k, VALUE_HASH);
         if (!entry)
             return false;
 
-        entry->key = my_strdup(key);
-        if (!entry->key)
+        if (!create_hash_value(pool, entry, small && db->config.hash_max_entries > 0, pair_size))
         {
-            free(entry);
+            free_entry(pool, entry);
             return false;
         }
 
-        entry->type = VALUE_HASH;
-        entry->value.hash_value = create_hash();
-        if (!entry->value.hash_value)
-        {
-            free(entry->key);
-            free(entry);
+        if (!db_add_entry(&k, entry))
             return false;
-        }
-
-        entry->expiration = 0;
-        entry->next = db->hash_table[index];
-        db->hash_table[index] = entry;
     }
 
-    Hash *hash = entry->value.hash_value;
-    unsigned int field_index = hash_field(field);
-
-    // Check if field already exists
-    HashField *current = hash->buckets[field_index];
-    while (current)
+    if (!hash_set_field(db, pool, entry, field, field_len, value, value_len))
     {
-        if (strcmp(current->field, field) == 0)
-        {
-            // Field exists, update value
-            free(current->value);
-            current->value = my_strdup(value);
-            return current->value != NULL;
-        }
-        current = current->next;
+        // A new key is never left behind as an empty hash
+        if (created)
+            db_delete_key(&k, false);
+        return false;
     }
+    return true;
+}
 
-    // Field doesn't exist, create new one
-    HashField *new_field = (HashField *)malloc(sizeof(HashField));
-    if (!new_field)
+// HGET - Get value of field in hash stored at a key
+bool db_hget(Database *db, const char *key, size_t key_len, const char *field, size_t field_len, DbString *out)
+{
+    if (!db || !key || !field)
         return false;
 
-    new_field->field = my_strdup(field);
-    new_field->value = my_strdup(value);
-    if (!new_field->field || !new_field->value)
-    {
-        free(new_field->field);
-        free(new_field->value);
-        free(new_field);
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = get_entry_read(&k);
+    if (!entry || entry->type != VALUE_HASH)
         return false;
+
+    if (entry->encoding == HASH_ENC_LISTPACK)
+    {
+        const Listpack *lp = entry->value.listpack_value;
+        size_t value_offset;
+        if (hash_listpack_find(lp, field, field_len, &value_offset) == lp->used)
+            return false; // Field not found
+
+        lp_get(lp, value_offset, &out->data, &out->len);
+        return true;
     }
 
-    new_field->next = hash->buckets[field_index];
-    hash->buckets[field_index] = new_field;
-    hash->field_count++;
+    HashField *current = hash_table_find(entry->value.hash_value, field, field_len, hash_bytes(field, field_len));
+    if (!current)
+        return false; // Field not found
 
+    out->data = current->value;
+    out->len = sds_len(current->value);
     return true;
 }
 
-// HGET - Get value of field in hash stored at a key
-char *db_hget(Database *db, const char *key, const char *field)
+// HEXISTS - Check if the field exists in hash
+bool db_hexists(Database *db, const char *key, size_t key_len, const char *field, size_t field_len)
+{
+    DbString value;
+    return db_hget(db, key, key_len, field, field_len, &value);
+}
+
+// HGETALL - Iterate over all fields and values in hash
+size_t db_hgetall(Database *db, const char *key, size_t key_len, HashIterator *it)
+{
+    if (!db || !key)
+        return 0;
+
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = get_entry_read(&k);
+    if (!entry || entry->type != VALUE_HASH)
+        return 0;
+
+    db_hash_iterator_init(it, entry);
+    return db_hash_length(entry);
+}
+
+// HDEL - Delete field from hash
+bool db_hdel(Database *db, const char *key, size_t key_len, const char *field, size_t field_len)
 {
     if (!db || !key || !field)
-        return NULL;
+        return false;
 
-    Entry *entry = get_entry(db, key);
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = get_entry_write(&k);
     if (!entry || entry->type != VALUE_HASH)
-        return NULL;
+        return false;
+
+    if (entry->encoding == HASH_ENC_LISTPACK)
+    {
+        Listpack *lp = entry->value.listpack_value;
+        size_t value_offset;
+        size_t field_offset = hash_listpack_find(lp, field, field_len, &value_offset);
+        if (field_offset == lp->used)
+            return false; // Field not found
+
+        lp_delete(lp, field_offset, 2);
+
+        // If hash is empty, remove the key
+        if (lp->count == 0)
+            db_delete_key(&k, false);
+        return true;
+    }
 
     Hash *hash = entry->value.hash_value;
-    unsigned int field_index = hash_field(field);
+    hash_maintain(&k.shard->pool, hash);
+    if (!hash_table_delete(&k.shard->pool, hash, field, field_len))
+        return false; // Field not found
 
-    HashField *current = hash->buckets[field_index];
-    while (current)
+    // If hash is empty, remove the key
+    if (hash_length(hash) == 0)
     {
-        if (strcmp(current->field, field) == 0)
-        {
-            return current->value;
-        }
-        current = current->next;
+        db_delete_key(&k, false);
     }
 
-    return NULL; // Field not found
+    return true;
 }
 
-// HEXISTS - Check if the field exists in hash
-bool db_hexists(Database *db, const char *key, const char *field)
+bool db_hscan(Database *db, const char *key, size_t key_len, uint64_t *cursor, size_t count,
+              const DbScanFilter *filter, sds **pairs, int *found)
 {
-    if (!db || !key || !field)
+    *pairs = NULL;
+    *found = 0;
+    if (!db || !key)
         return false;
+    if (count == 0)
+        count = 1;
 
-    Entry *entry = get_entry(db, key);
-    if (!entry || entry->type != VALUE_HASH)
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = get_entry_read(&k);
+    if (!entry)
+    {
+        *cursor = 0;
+        return true;
+    }
+    if (entry->type != VALUE_HASH)
         return false;
 
-    Hash *hash = entry->value.hash_value;
-    unsigned int field_index = hash_field(field);
-
-    HashField *current = hash->buckets[field_index];
-    while (current)
+    ScanBatch batch = {filter, NULL, 0, 0, 0, false};
+    uint64_t next = 0;
+    if (entry->encoding == HASH_ENC_LISTPACK)
+    {
+        HashIterator it;
+        DbString field, value;
+        db_hash_iterator_init(&it, entry);
+        while (db_hash_iterator_next(&it, &field, &value))
+            scan_field(&batch, field.data, field.len, value.data, value.len);
+    }
+    else
     {
-        if (strcmp(current->field, field) == 0)
+        size_t buckets = count * SCAN_BUCKETS_PER_KEY;
+        next = *cursor;
+        do
         {
-            return true;
-        }
-        current = current->next;
+            next = hash_scan(entry->value.hash_value, next, &batch);
+        } while (next != 0 && batch.visited < count && --buckets > 0);
     }
 
-    return false;
+    *pairs = scan_batch_finish(&batch, found);
+    if (!batch.failed)
+        *cursor = next;
+    return true;
 }
 
-// HGETALL - Get all fields and values in hash
-char **db_hgetall(Database *db, const char *key, int *count)
+// ----------------------------------Lazy freeing-----------------------------------
+
+// Job kind of a flushed shard's detached tables, next to the ValueTypes of
+// value jobs
+#define LAZYFREE_FLUSHED 0xFF
+
+// Tables detached from a shard by an asynchronous flush. The iterator
+// points into keys, so the struct never moves.
+typedef struct
 {
-    *count = 0;
-    if (!db || !key)
-        return NULL;
+    Keyspace keys;
+    TimerWheel expires;
+    RadixTree index;
+    KsIterator it;
+} FlushedShard;
 
-    Entry *entry = get_entry(db, key);
-    if (!entry || entry->type != VALUE_HASH)
-        return NULL;
+struct LazyFreeJob
+{
+    LazyFreeJob *next;
+    DbShard *shard;   // Owner of the memory; its lock is held for every step
+    uint8_t kind;     // ValueType of the value, or LAZYFREE_FLUSHED
+    size_t cursor;    // Next bucket of a hash
+    union
+    {
+        List *list;
+        Hash *hash;
+        FlushedShard *flushed;
+    } u;
+};
+
+// Steps needed to free an entry's value; strings and listpacks are single
+// allocations
+static size_t value_free_effort(const Entry *entry)
+{
+    if (entry->type == VALUE_LIST)
+        return entry->value.list_value->chunk_count;
+    if (entry->type == VALUE_HASH && entry->encoding == HASH_ENC_TABLE)
+        return hash_length(entry->value.hash_value);
+    return 1;
+}
 
-    Hash *hash = entry->value.hash_value;
-    if (hash->field_count == 0)
-        return NULL;
+static void lazyfree_push(LazyFree *lf, LazyFreeJob *job)
+{
+    job->next = NULL;
+    pthread_mutex_lock(&lf->mutex);
+    if (lf->tail)
+        lf->tail->next = job;
+    else
+        lf->head = job;
+    lf->tail = job;
+    lf->pending++;
+    pthread_cond_signal(&lf->cond);
+    pthread_mutex_unlock(&lf->mutex);
+}
 
-    // Allocate array for field value pairs (2 strings per field)
-    char **result = (char **)malloc(hash->field_count * 2 * sizeof(char *));
-    if (!result)
-        return NULL;
+// Queue the value of an unlinked entry if it is large enough to be worth
+// it (caller holds the shard's exclusive lock). The entry itself stays
+// with the caller. Returns false if the value was not taken.
+static bool lazyfree_value(LazyFree *lf, DbShard *shard, Entry *entry)
+{
+    if (value_free_effort(entry) <= LAZYFREE_THRESHOLD)
+        return false;
 
-    int idx = 0;
-    for (size_t i = 0; i < hash->bucket_count; i++)
-    {
-        HashField *current = hash->buckets[i];
-        while (current)
-        {
-            result[idx++] = my_strdup(current->field);
-            result[idx++] = my_strdup(current->value);
+    LazyFreeJob *job = (LazyFreeJob *)malloc(sizeof(LazyFreeJob));
+    if (!job)
+        return false; // Freed in place instead
 
-            // Check for allocation failure
-            if (!result[idx - 2] || !result[idx - 1])
-            {
-                // Cleanup on error
-                for (int j = 0; j < idx; j++)
-                {
-                    free(result[j]);
-                }
-                free(result);
-                return NULL;
-            }
+    job->shard = shard;
+    job->kind = entry->type;
+    job->cursor = 0;
+    if (entry->type == VALUE_LIST)
+        job->u.list = entry->value.list_value;
+    else
+        job->u.hash = entry->value.hash_value;
+    lazyfree_push(lf, job);
+    return true;
+}
 
-            current = current->next;
+// Free up to LAZYFREE_STEP keys of a flushed shard; large values become
+// jobs of their own. Returns true once the tables are gone.
+static bool lazyfree_flushed_step(LazyFree *lf, LazyFreeJob *job)
+{
+    FlushedShard *flushed = job->u.flushed;
+    SlabPool *pool = &job->shard->pool;
+
+    for (size_t n = 0; n < LAZYFREE_STEP; n++)
+    {
+        Entry *entry = ks_iterator_next(&flushed->it);
+        if (!entry)
+        {
+            // The tables and the index are empty by now
+            ks_release(&flushed->keys, release_entry, pool);
+            tw_release(pool, &flushed->expires);
+            radix_release(pool, &flushed->index);
+            free(flushed);
+            return true;
         }
+
+        TimerNode *timer = db_entry_timer(entry);
+        if (timer)
+            tw_remove(pool, &flushed->expires, timer);
+        ks_remove(&flushed->keys, entry->key, entry->key_len, entry->hash);
+        radix_remove(pool, &flushed->index, entry->key, entry->key_len);
+        if (lazyfree_value(lf, job->shard, entry))
+            free_entry_memory(pool, entry);
+        else
+            free_entry(pool, entry);
     }
+    return false;
+}
 
-    *count = hash->field_count * 2; // Return total count including both fields and values
-    return result;
+// One bounded step of a job (caller holds the shard's exclusive lock);
+// true once the job is done
+static bool lazyfree_step(LazyFree *lf, LazyFreeJob *job)
+{
+    SlabPool *pool = &job->shard->pool;
+    if (job->kind == LAZYFREE_FLUSHED)
+        return lazyfree_flushed_step(lf, job);
+    if (job->kind == VALUE_LIST)
+        return ql_release_step(pool, job->u.list, LAZYFREE_STEP);
+    return hash_release_step(pool, job->u.hash, &job->cursor, LAZYFREE_STEP);
 }
 
-// HDEL - Delete field from hash
-bool db_hdel(Database *db, const char *key, const char *field)
+// Lazy free thread: runs jobs in queue order, releasing the shard lock
+// between steps. When stopping, it returns once the queue is empty.
+static void *lazyfree_main(void *arg)
 {
-    if (!db || !key || !field)
-        return false;
+    LazyFree *lf = (LazyFree *)arg;
 
-    Entry *entry = get_entry(db, key);
-    if (!entry || entry->type != VALUE_HASH)
-        return false;
+    pthread_mutex_lock(&lf->mutex);
+    for (;;)
+    {
+        while (!lf->head && !lf->stopping)
+            pthread_cond_wait(&lf->cond, &lf->mutex);
+
+        LazyFreeJob *job = lf->head;
+        if (!job)
+            break;
+        lf->head = job->next;
+        if (!lf->head)
+            lf->tail = NULL;
+        pthread_mutex_unlock(&lf->mutex);
+
+        bool done = false;
+        while (!done)
+        {
+            pthread_rwlock_wrlock(&job->shard->lock);
+            done = lazyfree_step(lf, job);
+            pthread_rwlock_unlock(&job->shard->lock);
+        }
+        free(job);
 
-    Hash *hash = entry->value.hash_value;
-    unsigned int field_index = hash_field(field);
+        pthread_mutex_lock(&lf->mutex);
+        lf->pending--;
+        lf->freed++;
+    }
+    pthread_mutex_unlock(&lf->mutex);
+    return NULL;
+}
+
+static void lazyfree_start(LazyFree *lf)
+{
+    lf->head = NULL;
+    lf->tail = NULL;
+    lf->pending = 0;
+    lf->freed = 0;
+    lf->stopping = false;
+    if (pthread_mutex_init(&lf->mutex, NULL) != 0 || pthread_cond_init(&lf->cond, NULL) != 0 ||
+        pthread_create(&lf->thread, NULL, lazyfree_main, lf) != 0)
+    {
+        fprintf(stderr, "Failed to start lazy free thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
 
-    HashField *current = hash->buckets[field_index];
-    HashField *prev = NULL;
+// Finish the queued jobs and stop the thread (no shard lock held)
+static void lazyfree_stop(LazyFree *lf)
+{
+    pthread_mutex_lock(&lf->mutex);
+    lf->stopping = true;
+    pthread_cond_signal(&lf->cond);
+    pthread_mutex_unlock(&lf->mutex);
+
+    pthread_join(lf->thread, NULL);
+    pthread_cond_destroy(&lf->cond);
+    pthread_mutex_destroy(&lf->mutex);
+}
 
-    while (current)
+void db_flush(Database *db, bool async)
+{
+    if (!db)
+        return;
+    if (!async)
     {
-        if (strcmp(current->field, field) == 0)
-        {
-            // Remove field
-            if (prev)
-            {
-                prev->next = current->next;
-            }
-            else
-            {
-                hash->buckets[field_index] = current->next;
-            }
+        db_clear(db);
+        return;
+    }
 
-            free(current->field);
-            free(current->value);
-            free(current);
-            hash->field_count--;
+    for (size_t i = 0; i < db->shard_count; i++)
+    {
+        DbShard *shard = &db->shards[i];
+        if (ks_size(&shard->keys) == 0)
+            continue;
 
-            // If hash is empty, remove the key
-            if (hash->field_count == 0)
-            {
-                db_delete(db, key);
-            }
+        FlushedShard *flushed = (FlushedShard *)malloc(sizeof(FlushedShard));
+        LazyFreeJob *job = (LazyFreeJob *)malloc(sizeof(LazyFreeJob));
+        if (!flushed || !job)
+        {
+            // Flush this shard in place instead
+            free(flushed);
+            free(job);
+            ks_release(&shard->keys, release_entry, &shard->pool);
+            tw_release(&shard->pool, &shard->expires);
+            radix_release(&shard->pool, &shard->index);
+        }
+        else
+        {
+            flushed->keys = shard->keys;
+            flushed->expires = shard->expires;
+            flushed->index = shard->index;
+            ks_iterator_init(&flushed->it, &flushed->keys);
+            tw_init(&shard->expires, flushed->expires.current);
+            radix_init(&shard->index);
+
+            job->shard = shard;
+            job->kind = LAZYFREE_FLUSHED;
+            job->cursor = 0;
+            job->u.flushed = flushed;
+            lazyfree_push(&db->lazyfree, job);
+        }
 
-            return true;
+        if (!ks_init(&shard->keys))
+        {
+            fprintf(stderr, "Failed to allocate memory for database\n");
+            exit(EXIT_FAILURE);
         }
-        prev = current;
-        current = current->next;
     }
+}
+
+void db_lazyfree_stats(Database *db, size_t *pending, size_t *freed)
+{
+    pthread_mutex_lock(&db->lazyfree.mutex);
+    *pending = db->lazyfree.pending;
+    *freed = db->lazyfree.freed;
+    pthread_mutex_unlock(&db->lazyfree.mutex);
+}
+
+// ----------------------------------Object introspection-----------------------------------
+
+const char *db_object_encoding(Database *db, const char *key, size_t key_len)
+{
+    if (!db || !key)
+        return NULL;
+
+    DbKey k = db_key(db, key, key_len);
+    Entry *entry = get_entry_read(&k);
+    if (!entry)
+        return NULL;
 
-    return false; // Field not found
-}
\ No newline at end of file
+    switch (entry->type)
+    {
+    case VALUE_STRING:
+        if (entry->encoding == STRING_ENC_INT)
+            return "int";
+        return entry->encoding == STRING_ENC_EMBSTR ? "embstr" : "raw";
+    case VALUE_LIST:
+        return "quicklist";
+    case VALUE_HASH:
+        return entry->encoding == HASH_ENC_LISTPACK ? "listpack" : "hashtable";
+    }
+    return NULL;
+}
@@ -0,0 +1,129 @@
+#include "../include/hashfunc.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// wyhash (final version 4) by Wang Yi, released into the public domain.
+// Fast on short keys and resistant to the long shared prefixes typical of
+// namespaced keys; the per-process seed makes bucket collisions unpredictable.
+
+static const uint64_t wyp[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+                                0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+static uint64_t g_hash_seed = 0;
+
+static inline void wymum(uint64_t *a, uint64_t *b)
+{
+    __uint128_t r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+    wymum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t wyr8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t wyr4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t wyr3(const uint8_t *p, size_t k)
+{
+    return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+void hash_set_seed(uint64_t seed)
+{
+    g_hash_seed = seed;
+}
+
+void hash_seed_init(void)
+{
+    uint64_t seed = 0;
+    FILE *urandom = fopen("/dev/urandom", "rb");
+
+    if (!urandom || fread(&seed, sizeof(seed), 1, urandom) != 1)
+    {
+        // Fall back to a weaker but still per-process seed
+        seed = ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid() ^ (uint64_t)(uintptr_t)&seed;
+    }
+
+    if (urandom)
+        fclose(urandom);
+
+    hash_set_seed(seed);
+}
+
+uint64_t hash_bytes(const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t seed = g_hash_seed ^ wymix(g_hash_seed ^ wyp[0], wyp[1]);
+    uint64_t a, b;
+
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            a = wyr3(p, len);
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
+    }
+    else
+    {
+        size_t i = len;
+        if (i >= 48)
+        {
+            uint64_t see1 = seed, see2 = seed;
+            do
+            {
+                seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ wyp[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ wyp[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16)
+        {
+            seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+
+    a ^= wyp[1];
+    b ^= seed;
+    wymum(&a, &b);
+    return wymix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
+
+uint64_t hash_string(const char *str)
+{
+    return hash_bytes(str, strlen(str));
+}
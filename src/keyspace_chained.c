@@ -0,0 +1,360 @@
+#include "../include/keyspace.h"
+#include "../include/database.h"
+#include "../include/memtrack.h"
+#include "../include/utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef KV_KEYSPACE_SWISS
+
+// Shrink the table once it is less than 1/KS_SHRINK_RATIO full
+#define KS_SHRINK_RATIO 8
+
+const char *ks_engine_name(void)
+{
+    return "chained";
+}
+
+static bool ks_is_rehashing(const Keyspace *ks)
+{
+    return ks->rehash_index != -1;
+}
+
+// Smallest power of two bucket count that can hold n entries
+static size_t ks_table_size_for(size_t n)
+{
+    size_t size = KS_INITIAL_SIZE;
+    while (size < n)
+        size *= 2;
+    return size;
+}
+
+// Start migrating into a new table of the given size
+static bool ks_resize(Keyspace *ks, size_t new_size)
+{
+    if (ks_is_rehashing(ks) || new_size == ks->size[0])
+        return false;
+
+    Entry **table = (Entry **)calloc(new_size, sizeof(Entry *));
+    if (!table)
+    {
+        fprintf(stderr, "Failed to allocate memory for keyspace table\n");
+        return false;
+    }
+    mem_count_alloc(MEM_KEYS, new_size * sizeof(Entry *));
+
+    ks->table[1] = table;
+    ks->size[1] = new_size;
+    ks->used[1] = 0;
+    ks->rehash_index = 0;
+    return true;
+}
+
+// Grow or shrink the table when the load factor leaves its bounds
+static void ks_check_resize(Keyspace *ks)
+{
+    if (ks_is_rehashing(ks))
+        return;
+
+    if (ks->used[0] >= ks->size[0])
+    {
+        ks_resize(ks, ks_table_size_for(ks->used[0] * 2));
+    }
+    else if (ks->size[0] > KS_INITIAL_SIZE && ks->used[0] * KS_SHRINK_RATIO < ks->size[0])
+    {
+        ks_resize(ks, ks_table_size_for(ks->used[0]));
+    }
+}
+
+// Migrate up to 'buckets' non-empty buckets from table[0] to table[1].
+// Visits at most 10 empty buckets per requested bucket to bound the work.
+static void ks_rehash_step(Keyspace *ks, size_t buckets)
+{
+    if (!ks_is_rehashing(ks))
+        return;
+
+    size_t empty_visits = buckets * 10;
+    size_t mask = ks->size[1] - 1;
+
+    while (buckets-- && ks->used[0] != 0)
+    {
+        while (ks->table[0][ks->rehash_index] == NULL)
+        {
+            ks->rehash_index++;
+            if (--empty_visits == 0)
+                return;
+        }
+
+        Entry *current = ks->table[0][ks->rehash_index];
+        while (current)
+        {
+            Entry *next = current->next;
+            size_t index = current->hash & mask;
+            current->next = ks->table[1][index];
+            ks->table[1][index] = current;
+            ks->used[0]--;
+            ks->used[1]++;
+            current = next;
+        }
+        ks->table[0][ks->rehash_index] = NULL;
+        ks->rehash_index++;
+    }
+
+    // Migration finished, table[1] becomes the main table
+    if (ks->used[0] == 0)
+    {
+        mem_count_free(MEM_KEYS, ks->size[0] * sizeof(Entry *));
+        free(ks->table[0]);
+        ks->table[0] = ks->table[1];
+        ks->size[0] = ks->size[1];
+        ks->used[0] = ks->used[1];
+        ks->table[1] = NULL;
+        ks->size[1] = 0;
+        ks->used[1] = 0;
+        ks->rehash_index = -1;
+    }
+}
+
+bool ks_init(Keyspace *ks)
+{
+    ks->table[0] = (Entry **)calloc(KS_INITIAL_SIZE, sizeof(Entry *));
+    if (!ks->table[0])
+        return false;
+    mem_count_alloc(MEM_KEYS, KS_INITIAL_SIZE * sizeof(Entry *));
+
+    ks->size[0] = KS_INITIAL_SIZE;
+    ks->used[0] = 0;
+    ks->table[1] = NULL;
+    ks->size[1] = 0;
+    ks->used[1] = 0;
+    ks->rehash_index = -1;
+    return true;
+}
+
+void ks_release(Keyspace *ks, void (*free_entry)(Entry *, void *), void *ctx)
+{
+    for (int t = 0; t <= 1; t++)
+    {
+        if (!ks->table[t])
+            continue;
+
+        for (size_t i = 0; i < ks->size[t]; i++)
+        {
+            Entry *current = ks->table[t][i];
+            while (current)
+            {
+                Entry *next = current->next;
+                free_entry(current, ctx);
+                current = next;
+            }
+        }
+        mem_count_free(MEM_KEYS, ks->size[t] * sizeof(Entry *));
+        free(ks->table[t]);
+        ks->table[t] = NULL;
+        ks->size[t] = 0;
+        ks->used[t] = 0;
+    }
+    ks->rehash_index = -1;
+}
+
+size_t ks_size(const Keyspace *ks)
+{
+    return ks->used[0] + ks->used[1];
+}
+
+size_t ks_memory(const Keyspace *ks)
+{
+    return (ks->size[0] + ks->size[1]) * sizeof(Entry *);
+}
+
+// Pick a random bucket of either table until one is not empty, then a
+// random entry of its chain
+Entry *ks_random(Keyspace *ks)
+{
+    if (ks_size(ks) == 0)
+        return NULL;
+
+    Entry *chain = NULL;
+    while (!chain)
+    {
+        size_t index = (size_t)(random_u64() % (ks->size[0] + ks->size[1]));
+        if (index >= ks->size[0])
+            chain = ks->table[1][index - ks->size[0]];
+        else if (!ks_is_rehashing(ks) || index >= (size_t)ks->rehash_index)
+            chain = ks->table[0][index]; // Buckets before rehash_index have moved
+    }
+
+    size_t length = 0;
+    for (Entry *e = chain; e; e = e->next)
+        length++;
+    for (size_t skip = (size_t)(random_u64() % length); skip > 0; skip--)
+        chain = chain->next;
+    return chain;
+}
+
+static inline bool ks_entry_matches(const Entry *entry, const char *key, size_t key_len, uint64_t hash)
+{
+    return entry->hash == hash && entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0;
+}
+
+// Find an entry by key in either table
+Entry *ks_find(Keyspace *ks, const char *key, size_t key_len, uint64_t hash)
+{
+    for (int t = 0; t <= 1; t++)
+    {
+        Entry *current = ks->table[t][hash & (ks->size[t] - 1)];
+        while (current)
+        {
+            if (ks_entry_matches(current, key, key_len, hash))
+                return current;
+            current = current->next;
+        }
+
+        if (!ks_is_rehashing(ks))
+            break;
+    }
+    return NULL;
+}
+
+// Link a new entry into the table; new keys go to table[1] while rehashing
+bool ks_insert(Keyspace *ks, Entry *entry)
+{
+    int t = ks_is_rehashing(ks) ? 1 : 0;
+    size_t index = entry->hash & (ks->size[t] - 1);
+
+    entry->next = ks->table[t][index];
+    ks->table[t][index] = entry;
+    ks->used[t]++;
+
+    ks_check_resize(ks);
+    return true;
+}
+
+// Unlink an entry by key from whichever table holds it
+Entry *ks_remove(Keyspace *ks, const char *key, size_t key_len, uint64_t hash)
+{
+    for (int t = 0; t <= 1; t++)
+    {
+        size_t index = hash & (ks->size[t] - 1);
+        Entry *current = ks->table[t][index];
+        Entry *prev = NULL;
+
+        while (current)
+        {
+            if (ks_entry_matches(current, key, key_len, hash))
+            {
+                if (prev)
+                {
+                    prev->next = current->next;
+                }
+                else
+                {
+                    ks->table[t][index] = current->next;
+                }
+                ks->used[t]--;
+                return current;
+            }
+            prev = current;
+            current = current->next;
+        }
+
+        if (!ks_is_rehashing(ks))
+            break;
+    }
+    return NULL;
+}
+
+void ks_replace(Keyspace *ks, Entry *old_entry, Entry *new_entry)
+{
+    for (int t = 0; t <= 1; t++)
+    {
+        Entry **link = &ks->table[t][old_entry->hash & (ks->size[t] - 1)];
+        while (*link)
+        {
+            if (*link == old_entry)
+            {
+                new_entry->next = old_entry->next;
+                *link = new_entry;
+                return;
+            }
+            link = &(*link)->next;
+        }
+
+        if (!ks_is_rehashing(ks))
+            break;
+    }
+}
+
+void ks_maintain(Keyspace *ks)
+{
+    ks_rehash_step(ks, KS_REHASH_STEP_BUCKETS);
+    ks_check_resize(ks);
+}
+
+static void ks_scan_bucket(Entry *entry, void (*fn)(Entry *, void *), void *ctx)
+{
+    while (entry)
+    {
+        Entry *next = entry->next;
+        fn(entry, ctx);
+        entry = next;
+    }
+}
+
+uint64_t ks_scan(Keyspace *ks, uint64_t cursor, void (*fn)(Entry *, void *), void *ctx)
+{
+    if (!ks_is_rehashing(ks))
+    {
+        uint64_t mask = ks->size[0] - 1;
+        ks_scan_bucket(ks->table[0][cursor & mask], fn, ctx);
+        return scan_cursor_next(cursor, mask);
+    }
+
+    // While rehashing, visit the cursor's bucket in the smaller table and
+    // every bucket of the larger table that it splits into
+    int small = ks->size[0] <= ks->size[1] ? 0 : 1;
+    uint64_t small_mask = ks->size[small] - 1;
+    uint64_t large_mask = ks->size[1 - small] - 1;
+
+    ks_scan_bucket(ks->table[small][cursor & small_mask], fn, ctx);
+    do
+    {
+        ks_scan_bucket(ks->table[1 - small][cursor & large_mask], fn, ctx);
+        cursor = (((cursor | small_mask) + 1) & ~small_mask) | (cursor & small_mask);
+    } while (cursor & (small_mask ^ large_mask));
+
+    return scan_cursor_next(cursor, small_mask);
+}
+
+void ks_iterator_init(KsIterator *it, Keyspace *ks)
+{
+    it->ks = ks;
+    it->table = 0;
+    it->bucket = 0;
+    it->next = NULL;
+}
+
+// Return the next entry, or NULL once both tables are exhausted
+Entry *ks_iterator_next(KsIterator *it)
+{
+    while (!it->next)
+    {
+        Keyspace *ks = it->ks;
+        if (it->bucket >= ks->size[it->table])
+        {
+            if (it->table == 1 || !ks_is_rehashing(ks))
+                return NULL;
+            it->table = 1;
+            it->bucket = 0;
+            continue;
+        }
+        it->next = ks->table[it->table][it->bucket++];
+    }
+
+    Entry *entry = it->next;
+    it->next = entry->next;
+    return entry;
+}
+
+#endif /* !KV_KEYSPACE_SWISS */
@@ -0,0 +1,469 @@
+#include "../include/keyspace.h"
+#include "../include/database.h"
+#include "../include/memtrack.h"
+#include "../include/utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef KV_KEYSPACE_SWISS
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Control byte values. Full slots hold the low 7 bits of the hash (0..127),
+// so the high bit alone tells free slots from full ones.
+#define CTRL_EMPTY ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+
+// Maximum load (live entries plus tombstones) is 7/8 of the capacity
+#define KS_MAX_LOAD_NUM 7
+#define KS_MAX_LOAD_DEN 8
+
+// Shrink the table once it is less than 1/KS_SHRINK_RATIO full
+#define KS_SHRINK_RATIO 8
+
+const char *ks_engine_name(void)
+{
+    return "swiss";
+}
+
+static inline int8_t ks_h2(uint64_t hash)
+{
+    return (int8_t)(hash & 0x7f);
+}
+
+static inline size_t ks_h1(uint64_t hash)
+{
+    return (size_t)(hash >> 7);
+}
+
+// Bitmask of the slots in a group whose control byte equals value
+static inline uint32_t group_match(const int8_t *group, int8_t value)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < KS_GROUP_SIZE; i++)
+    {
+        if (group[i] == value)
+            mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+// Bitmask of the empty or deleted slots in a group
+static inline uint32_t group_match_free(const int8_t *group)
+{
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < KS_GROUP_SIZE; i++)
+    {
+        if (group[i] < 0)
+            mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static void slot_set_key(KsSlot *slot, const char *key, size_t key_len)
+{
+    slot->key_len = (uint32_t)key_len;
+    memset(slot->prefix, 0, KS_KEY_PREFIX);
+    memcpy(slot->prefix, key, key_len < KS_KEY_PREFIX ? key_len : KS_KEY_PREFIX);
+}
+
+static bool table_alloc(KsTable *table, size_t capacity)
+{
+    int8_t *ctrl = (int8_t *)malloc(capacity);
+    KsSlot *slots = (KsSlot *)malloc(capacity * sizeof(KsSlot));
+    if (!ctrl || !slots)
+    {
+        free(ctrl);
+        free(slots);
+        fprintf(stderr, "Failed to allocate memory for keyspace table\n");
+        return false;
+    }
+
+    mem_count_alloc(MEM_KEYS, capacity * (1 + sizeof(KsSlot)));
+    memset(ctrl, CTRL_EMPTY, capacity);
+    table->ctrl = ctrl;
+    table->slots = slots;
+    table->capacity = capacity;
+    table->used = 0;
+    table->deleted = 0;
+    return true;
+}
+
+static void table_free(KsTable *table)
+{
+    if (table->ctrl)
+        mem_count_free(MEM_KEYS, table->capacity * (1 + sizeof(KsSlot)));
+    free(table->ctrl);
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+}
+
+// Whether one more entry would take the table past its maximum load
+static bool table_is_full(const KsTable *table)
+{
+    return (table->used + table->deleted + 1) * KS_MAX_LOAD_DEN > table->capacity * KS_MAX_LOAD_NUM;
+}
+
+// First free slot on the probe sequence of hash. Groups are probed
+// triangularly, which visits every group of a power-of-two table.
+static size_t table_find_free_slot(const KsTable *table, uint64_t hash)
+{
+    size_t group_mask = table->capacity / KS_GROUP_SIZE - 1;
+    size_t group = ks_h1(hash) & group_mask;
+
+    for (size_t step = 1;; step++)
+    {
+        uint32_t free_mask = group_match_free(table->ctrl + group * KS_GROUP_SIZE);
+        if (free_mask)
+            return group * KS_GROUP_SIZE + (size_t)__builtin_ctz(free_mask);
+        group = (group + step) & group_mask;
+    }
+}
+
+// Slot index holding key, or capacity if absent
+static size_t table_find_slot(const KsTable *table, const char *key, size_t key_len, uint64_t hash)
+{
+    size_t group_mask = table->capacity / KS_GROUP_SIZE - 1;
+    size_t group = ks_h1(hash) & group_mask;
+    int8_t h2 = ks_h2(hash);
+    size_t prefix_len = key_len < KS_KEY_PREFIX ? key_len : KS_KEY_PREFIX;
+
+    for (size_t step = 1; step <= group_mask + 1; step++)
+    {
+        const int8_t *ctrl = table->ctrl + group * KS_GROUP_SIZE;
+        uint32_t match = group_match(ctrl, h2);
+
+        while (match)
+        {
+            size_t index = group * KS_GROUP_SIZE + (size_t)__builtin_ctz(match);
+            const KsSlot *slot = &table->slots[index];
+
+            // Length and prefix are inline; only touch the entry when they match
+            if (slot->key_len == key_len && memcmp(slot->prefix, key, prefix_len) == 0)
+            {
+                const Entry *entry = slot->entry;
+                if (entry->hash == hash && memcmp(entry->key, key, key_len) == 0)
+                    return index;
+            }
+            match &= match - 1;
+        }
+
+        // An empty slot ends the probe sequence
+        if (group_match(ctrl, CTRL_EMPTY))
+            break;
+
+        group = (group + step) & group_mask;
+    }
+    return table->capacity;
+}
+
+// Free a full slot
+static void table_clear_slot(KsTable *table, size_t index)
+{
+    const int8_t *group = table->ctrl + (index / KS_GROUP_SIZE) * KS_GROUP_SIZE;
+
+    // Lookups already stop at a group containing an empty slot, so the slot
+    // can become empty again; otherwise leave a tombstone for the probe chain
+    if (group_match(group, CTRL_EMPTY))
+    {
+        table->ctrl[index] = CTRL_EMPTY;
+    }
+    else
+    {
+        table->ctrl[index] = CTRL_DELETED;
+        table->deleted++;
+    }
+    table->used--;
+}
+
+static bool ks_is_migrating(const Keyspace *ks)
+{
+    return ks->migrate_group != -1;
+}
+
+// Slot of key in either table, setting *table_out; false if absent
+static bool ks_find_slot(Keyspace *ks, const char *key, size_t key_len, uint64_t hash,
+                         KsTable **table_out, size_t *index_out)
+{
+    for (int t = 0; t <= 1; t++)
+    {
+        KsTable *table = &ks->table[t];
+        size_t index = table_find_slot(table, key, key_len, hash);
+        if (index < table->capacity)
+        {
+            *table_out = table;
+            *index_out = index;
+            return true;
+        }
+
+        if (!ks_is_migrating(ks))
+            break;
+    }
+    return false;
+}
+
+// Smallest capacity keeping n entries at or below half load
+static size_t ks_capacity_for(size_t n)
+{
+    size_t capacity = KS_INITIAL_SIZE;
+    while (capacity < n * 2)
+        capacity *= 2;
+    return capacity;
+}
+
+// Start migrating into a new table of the given capacity, which drops the
+// tombstones even when it is the same
+static bool ks_resize(Keyspace *ks, size_t new_capacity)
+{
+    if (ks_is_migrating(ks) || !table_alloc(&ks->table[1], new_capacity))
+        return false;
+
+    ks->migrate_group = 0;
+    return true;
+}
+
+// Move the entries of up to 'groups' groups of table[0] to table[1].
+// Cached hashes and inline key data are reused, nothing is recomputed.
+static void ks_migrate_step(Keyspace *ks, size_t groups)
+{
+    if (!ks_is_migrating(ks))
+        return;
+
+    KsTable *from = &ks->table[0];
+    KsTable *to = &ks->table[1];
+    size_t group_count = from->capacity / KS_GROUP_SIZE;
+
+    while (groups-- && (size_t)ks->migrate_group < group_count && from->used != 0)
+    {
+        size_t first = (size_t)ks->migrate_group * KS_GROUP_SIZE;
+        for (size_t index = first; index < first + KS_GROUP_SIZE; index++)
+        {
+            if (from->ctrl[index] < 0)
+                continue;
+
+            size_t to_index = table_find_free_slot(to, from->slots[index].entry->hash);
+            if (to->ctrl[to_index] == CTRL_DELETED)
+                to->deleted--;
+            to->ctrl[to_index] = from->ctrl[index];
+            to->slots[to_index] = from->slots[index];
+            to->used++;
+            table_clear_slot(from, index);
+        }
+        ks->migrate_group++;
+    }
+
+    // Migration finished, table[1] becomes the main table
+    if (from->used == 0)
+    {
+        table_free(from);
+        ks->table[0] = ks->table[1];
+        memset(&ks->table[1], 0, sizeof(ks->table[1]));
+        ks->migrate_group = -1;
+    }
+}
+
+bool ks_init(Keyspace *ks)
+{
+    memset(&ks->table[1], 0, sizeof(ks->table[1]));
+    ks->migrate_group = -1;
+    return table_alloc(&ks->table[0], KS_INITIAL_SIZE);
+}
+
+void ks_release(Keyspace *ks, void (*free_entry)(Entry *, void *), void *ctx)
+{
+    for (int t = 0; t <= 1; t++)
+    {
+        KsTable *table = &ks->table[t];
+        for (size_t i = 0; i < table->capacity; i++)
+        {
+            if (table->ctrl[i] >= 0)
+                free_entry(table->slots[i].entry, ctx);
+        }
+        table_free(table);
+    }
+    ks->migrate_group = -1;
+}
+
+size_t ks_size(const Keyspace *ks)
+{
+    return ks->table[0].used + ks->table[1].used;
+}
+
+Entry *ks_find(Keyspace *ks, const char *key, size_t key_len, uint64_t hash)
+{
+    KsTable *table;
+    size_t index;
+    return ks_find_slot(ks, key, key_len, hash, &table, &index) ? table->slots[index].entry : NULL;
+}
+
+// Link a new entry; new keys go to table[1] while migrating
+bool ks_insert(Keyspace *ks, Entry *entry)
+{
+    // Maintenance steps keep migrations well ahead of inserts; should the
+    // new table fill up anyway, the migration is finished first
+    if (ks_is_migrating(ks) && table_is_full(&ks->table[1]))
+        ks_migrate_step(ks, ks->table[0].capacity / KS_GROUP_SIZE);
+
+    if (!ks_is_migrating(ks) && table_is_full(&ks->table[0]))
+    {
+        // Mostly tombstones: clean up at the same size, otherwise double
+        KsTable *table = &ks->table[0];
+        size_t new_capacity = table->deleted > table->used ? table->capacity : table->capacity * 2;
+        if (!ks_resize(ks, new_capacity))
+            return false;
+    }
+
+    KsTable *table = &ks->table[ks_is_migrating(ks) ? 1 : 0];
+    size_t index = table_find_free_slot(table, entry->hash);
+
+    if (table->ctrl[index] == CTRL_DELETED)
+        table->deleted--;
+
+    table->ctrl[index] = ks_h2(entry->hash);
+    table->slots[index].entry = entry;
+    slot_set_key(&table->slots[index], entry->key, entry->key_len);
+    table->used++;
+    return true;
+}
+
+Entry *ks_remove(Keyspace *ks, const char *key, size_t key_len, uint64_t hash)
+{
+    KsTable *table;
+    size_t index;
+    if (!ks_find_slot(ks, key, key_len, hash, &table, &index))
+        return NULL;
+
+    Entry *entry = table->slots[index].entry;
+    table_clear_slot(table, index);
+    return entry;
+}
+
+void ks_replace(Keyspace *ks, Entry *old_entry, Entry *new_entry)
+{
+    KsTable *table;
+    size_t index;
+    if (ks_find_slot(ks, old_entry->key, old_entry->key_len, old_entry->hash, &table, &index))
+        table->slots[index].entry = new_entry;
+}
+
+void ks_maintain(Keyspace *ks)
+{
+    ks_migrate_step(ks, KS_MIGRATE_STEP_GROUPS);
+
+    const KsTable *table = &ks->table[0];
+    if (!ks_is_migrating(ks) && table->capacity > KS_INITIAL_SIZE && table->used * KS_SHRINK_RATIO < table->capacity)
+        ks_resize(ks, ks_capacity_for(table->used));
+}
+
+size_t ks_memory(const Keyspace *ks)
+{
+    return (ks->table[0].capacity + ks->table[1].capacity) * (1 + sizeof(KsSlot));
+}
+
+// Scan forward from a random slot of either table to the first full one
+Entry *ks_random(Keyspace *ks)
+{
+    if (ks_size(ks) == 0)
+        return NULL;
+
+    size_t capacity0 = ks->table[0].capacity;
+    size_t total = capacity0 + ks->table[1].capacity;
+    size_t position = (size_t)(random_u64() % total);
+    for (;;)
+    {
+        const KsTable *table = &ks->table[position < capacity0 ? 0 : 1];
+        size_t index = position < capacity0 ? position : position - capacity0;
+        if (table->ctrl[index] >= 0)
+            return table->slots[index].entry;
+        position = (position + 1) % total;
+    }
+}
+
+// Call fn on the entries of a table whose probe sequence starts at group
+// home. They all sit before the first group on that sequence with an empty
+// slot, where lookups stop too.
+static void table_scan_group(const KsTable *table, size_t home, void (*fn)(Entry *, void *), void *ctx)
+{
+    size_t group_mask = table->capacity / KS_GROUP_SIZE - 1;
+    size_t group = home;
+
+    for (size_t step = 1; step <= group_mask + 1; step++)
+    {
+        const int8_t *ctrl = table->ctrl + group * KS_GROUP_SIZE;
+        for (size_t i = 0; i < KS_GROUP_SIZE; i++)
+        {
+            if (ctrl[i] < 0)
+                continue;
+            Entry *entry = table->slots[group * KS_GROUP_SIZE + i].entry;
+            if ((ks_h1(entry->hash) & group_mask) == home)
+                fn(entry, ctx);
+        }
+
+        if (group_match(ctrl, CTRL_EMPTY))
+            break;
+        group = (group + step) & group_mask;
+    }
+}
+
+// The cursor designates a home group. While migrating, the cursor's group
+// in the smaller table is visited along with every group of the larger
+// table that it splits into.
+uint64_t ks_scan(Keyspace *ks, uint64_t cursor, void (*fn)(Entry *, void *), void *ctx)
+{
+    if (!ks_is_migrating(ks))
+    {
+        uint64_t mask = ks->table[0].capacity / KS_GROUP_SIZE - 1;
+        table_scan_group(&ks->table[0], (size_t)(cursor & mask), fn, ctx);
+        return scan_cursor_next(cursor, mask);
+    }
+
+    int small = ks->table[0].capacity <= ks->table[1].capacity ? 0 : 1;
+    uint64_t small_mask = ks->table[small].capacity / KS_GROUP_SIZE - 1;
+    uint64_t large_mask = ks->table[1 - small].capacity / KS_GROUP_SIZE - 1;
+
+    table_scan_group(&ks->table[small], (size_t)(cursor & small_mask), fn, ctx);
+    do
+    {
+        table_scan_group(&ks->table[1 - small], (size_t)(cursor & large_mask), fn, ctx);
+        cursor = (((cursor | small_mask) + 1) & ~small_mask) | (cursor & small_mask);
+    } while (cursor & (small_mask ^ large_mask));
+
+    return scan_cursor_next(cursor, small_mask);
+}
+
+void ks_iterator_init(KsIterator *it, Keyspace *ks)
+{
+    it->ks = ks;
+    it->table = 0;
+    it->slot = 0;
+}
+
+// Return the next entry, or NULL once both tables are exhausted
+Entry *ks_iterator_next(KsIterator *it)
+{
+    for (; it->table <= 1; it->table++, it->slot = 0)
+    {
+        const KsTable *table = &it->ks->table[it->table];
+        while (it->slot < table->capacity)
+        {
+            size_t index = it->slot++;
+            if (table->ctrl[index] >= 0)
+                return table->slots[index].entry;
+        }
+    }
+    return NULL;
+}
+
+#endif /* KV_KEYSPACE_SWISS */
@@ -0,0 +1,122 @@
+#include "../include/listpack.h"
+#include <stdio.h>
+#include <string.h>
+
+#define LP_HEADER offsetof(Listpack, data)
+
+// Listpacks only hold small hashes, so they count as hash memory
+#define LP_MEM_CATEGORY MEM_HASH_FIELDS
+
+// Allocation for a listpack holding size bytes of data. Slab-sized ones fill
+// their class; larger ones get headroom so repeated appends stay cheap.
+static Listpack *lp_alloc(SlabPool *pool, size_t size)
+{
+    size_t alloc = LP_HEADER + size;
+    if (alloc > SLAB_MAX_OBJECT)
+        alloc += alloc / 2;
+    alloc = slab_class_size(alloc);
+    if (alloc - LP_HEADER > UINT32_MAX)
+    {
+        fprintf(stderr, "Listpack too large: %zu bytes\n", size);
+        return NULL;
+    }
+
+    Listpack *lp = (Listpack *)slab_alloc(pool, LP_MEM_CATEGORY, alloc);
+    if (!lp)
+        return NULL;
+
+    lp->count = 0;
+    lp->used = 0;
+    lp->size = (uint32_t)(alloc - LP_HEADER);
+    return lp;
+}
+
+Listpack *lp_reserve(SlabPool *pool, Listpack *lp, size_t extra)
+{
+    if (lp->used + extra <= lp->size)
+        return lp;
+
+    Listpack *grown = lp_alloc(pool, lp->used + extra);
+    if (!grown)
+        return NULL;
+
+    memcpy(grown->data, lp->data, lp->used);
+    grown->count = lp->count;
+    grown->used = lp->used;
+    lp_free(pool, lp);
+    return grown;
+}
+
+Listpack *lp_create(SlabPool *pool, size_t size)
+{
+    return lp_alloc(pool, size);
+}
+
+void lp_free(SlabPool *pool, Listpack *lp)
+{
+    if (lp)
+        slab_free(pool, LP_MEM_CATEGORY, lp, LP_HEADER + lp->size);
+}
+
+size_t lp_memory(const Listpack *lp)
+{
+    return slab_class_size(LP_HEADER + lp->size);
+}
+
+size_t lp_get(const Listpack *lp, size_t offset, const char **data, size_t *len)
+{
+    size_t prefix = lp_read_len(lp->data + offset, len);
+    *data = lp->data + offset + prefix;
+    return offset + prefix + *len;
+}
+
+Listpack *lp_append(SlabPool *pool, Listpack *lp, const char *data, size_t len)
+{
+    size_t need = lp_len_size(len) + len;
+    lp = lp_reserve(pool, lp, need);
+    if (!lp)
+        return NULL;
+
+    char *p = lp->data + lp->used;
+    p += lp_write_len(p, len);
+    memcpy(p, data, len);
+
+    lp->used += (uint32_t)need;
+    lp->count++;
+    return lp;
+}
+
+Listpack *lp_replace(SlabPool *pool, Listpack *lp, size_t offset, const char *data, size_t len)
+{
+    size_t old_size = lp_element_size(lp->data + offset);
+    size_t new_size = lp_len_size(len) + len;
+
+    if (new_size > old_size)
+    {
+        lp = lp_reserve(pool, lp, new_size - old_size);
+        if (!lp)
+            return NULL;
+    }
+
+    // Shift the tail, then write the element in place
+    char *p = lp->data + offset;
+    if (new_size != old_size)
+        memmove(p + new_size, p + old_size, lp->used - offset - old_size);
+
+    p += lp_write_len(p, len);
+    memmove(p, data, len);
+
+    lp->used = (uint32_t)(lp->used - old_size + new_size);
+    return lp;
+}
+
+void lp_delete(Listpack *lp, size_t offset, size_t count)
+{
+    size_t end = offset;
+    for (size_t i = 0; i < count; i++)
+        end += lp_element_size(lp->data + end);
+
+    memmove(lp->data + offset, lp->data + end, lp->used - end);
+    lp->used -= (uint32_t)(end - offset);
+    lp->count -= (uint32_t)count;
+}
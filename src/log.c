@@ -0,0 +1,269 @@
+#include "../include/log.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+// Pause of the writer thread when it found nothing to write
+#define LOG_WRITER_IDLE_MS 10
+
+static const char *const g_level_names[] = {"debug", "verbose", "notice", "warning"};
+static const char g_level_marks[] = {'.', '-', '*', '#'};
+
+static int g_log_level = LOG_DEFAULT_LEVEL;
+
+// Header of a message in a ring, followed by its text
+typedef struct
+{
+    uint32_t len;
+    int32_t level;
+    int64_t time_ms;
+} LogRecord;
+
+// A thread's messages. Only the thread writes messages and moves the tail;
+// only the writer, holding g_drain_mutex, reads them and moves the head.
+// Positions grow forever and are taken modulo the size.
+typedef struct LogRing
+{
+    struct LogRing *next;
+    uint64_t head;    // (atomic)
+    uint64_t tail;    // (atomic)
+    uint64_t dropped; // Messages that did not fit (atomic)
+    uint64_t dropped_reported;
+    char data[LOG_RING_SIZE];
+} LogRing;
+
+static __thread LogRing *t_ring = NULL;
+static LogRing *g_rings = NULL; // Every thread's ring, never removed (atomic)
+static pthread_mutex_t g_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool g_writer_running = false; // (atomic)
+
+bool log_level_active(int level)
+{
+    return level >= __atomic_load_n(&g_log_level, __ATOMIC_RELAXED);
+}
+
+int log_get_level(void)
+{
+    return __atomic_load_n(&g_log_level, __ATOMIC_RELAXED);
+}
+
+void log_set_level(int level)
+{
+    __atomic_store_n(&g_log_level, level, __ATOMIC_RELAXED);
+}
+
+int log_level_from_name(const char *name)
+{
+    for (int level = LOG_LEVEL_DEBUG; level <= LOG_LEVEL_WARNING; level++)
+    {
+        if (strcasecmp(name, g_level_names[level]) == 0)
+            return level;
+    }
+    return -1;
+}
+
+const char *log_level_name(int level)
+{
+    if (level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_WARNING)
+        return "unknown";
+    return g_level_names[level];
+}
+
+static int64_t log_now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Write one message line: time, level mark and text
+static void log_write_line(FILE *out, int level, int64_t time_ms, const char *text, size_t len)
+{
+    time_t seconds = (time_t)(time_ms / 1000);
+    struct tm local;
+    char stamp[32];
+    localtime_r(&seconds, &local);
+    strftime(stamp, sizeof(stamp), "%d %b %Y %H:%M:%S", &local);
+    fprintf(out, "%s.%03d %c %.*s\n", stamp, (int)(time_ms % 1000), g_level_marks[level], (int)len, text);
+}
+
+// The calling thread's ring, registered on first use; NULL if out of memory
+static LogRing *log_thread_ring(void)
+{
+    if (t_ring)
+        return t_ring;
+
+    LogRing *ring = (LogRing *)calloc(1, sizeof(LogRing));
+    if (!ring)
+        return NULL;
+
+    pthread_mutex_lock(&g_rings_mutex);
+    ring->next = g_rings;
+    __atomic_store_n(&g_rings, ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_rings_mutex);
+    t_ring = ring;
+    return ring;
+}
+
+static void ring_copy_in(LogRing *ring, uint64_t pos, const void *data, size_t len)
+{
+    size_t offset = (size_t)(pos % LOG_RING_SIZE);
+    size_t first = len < LOG_RING_SIZE - offset ? len : LOG_RING_SIZE - offset;
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, (const char *)data + first, len - first);
+}
+
+static void ring_copy_out(const LogRing *ring, uint64_t pos, void *data, size_t len)
+{
+    size_t offset = (size_t)(pos % LOG_RING_SIZE);
+    size_t first = len < LOG_RING_SIZE - offset ? len : LOG_RING_SIZE - offset;
+    memcpy(data, ring->data + offset, first);
+    memcpy((char *)data + first, ring->data, len - first);
+}
+
+void log_message(int level, const char *format, ...)
+{
+    if (level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_WARNING || !log_level_active(level))
+        return;
+
+    char text[LOG_LINE_MAX];
+    va_list args;
+    va_start(args, format);
+    int formatted = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (formatted < 0)
+        return;
+    size_t len = (size_t)formatted < sizeof(text) ? (size_t)formatted : sizeof(text) - 1;
+
+    int64_t time_ms = log_now_ms();
+    LogRing *ring = __atomic_load_n(&g_writer_running, __ATOMIC_ACQUIRE) ? log_thread_ring() : NULL;
+    if (!ring)
+    {
+        log_write_line(stdout, level, time_ms, text, len);
+        fflush(stdout);
+        return;
+    }
+
+    LogRecord record = {(uint32_t)len, level, time_ms};
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    if (LOG_RING_SIZE - (tail - head) < sizeof(record) + len)
+    {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    ring_copy_in(ring, tail, &record, sizeof(record));
+    ring_copy_in(ring, tail + sizeof(record), text, len);
+    __atomic_store_n(&ring->tail, tail + sizeof(record) + len, __ATOMIC_RELEASE);
+}
+
+// Write out every queued message and the count of those dropped; returns
+// how many lines were written
+static size_t log_drain(void)
+{
+    size_t written = 0;
+    pthread_mutex_lock(&g_drain_mutex);
+    for (LogRing *ring = __atomic_load_n(&g_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        while (head < tail)
+        {
+            LogRecord record;
+            char text[LOG_LINE_MAX];
+            ring_copy_out(ring, head, &record, sizeof(record));
+            ring_copy_out(ring, head + sizeof(record), text, record.len);
+            log_write_line(stdout, record.level, record.time_ms, text, record.len);
+            head += sizeof(record) + record.len;
+            written++;
+        }
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+        uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        if (dropped > ring->dropped_reported)
+        {
+            int64_t now = log_now_ms();
+            char text[64];
+            int len = snprintf(text, sizeof(text), "%llu log messages dropped",
+                               (unsigned long long)(dropped - ring->dropped_reported));
+            log_write_line(stdout, LOG_LEVEL_WARNING, now, text, (size_t)len);
+            ring->dropped_reported = dropped;
+            written++;
+        }
+    }
+    if (written > 0)
+        fflush(stdout);
+    pthread_mutex_unlock(&g_drain_mutex);
+    return written;
+}
+
+void log_flush(void)
+{
+    log_drain();
+}
+
+static void *log_writer(void *arg)
+{
+    (void)arg;
+
+    // Signals are left to the threads serving clients
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    struct timespec idle = {0, LOG_WRITER_IDLE_MS * 1000000L};
+    for (;;)
+    {
+        if (log_drain() == 0)
+            nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+bool log_start(void)
+{
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, log_writer, NULL) != 0)
+    {
+        perror("Failed to create log writer thread");
+        return false;
+    }
+    pthread_detach(writer);
+    atexit(log_flush);
+    __atomic_store_n(&g_writer_running, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+size_t log_escape(char *out, size_t out_size, const char *data, size_t len)
+{
+    if (out_size == 0)
+        return 0;
+
+    // Room for the longest escape and "..." is kept at the end
+    size_t used = 0;
+    size_t i;
+    for (i = 0; i < len && used + 8 < out_size; i++)
+    {
+        unsigned char c = (unsigned char)data[i];
+        if (c == '\r')
+            used += (size_t)snprintf(out + used, out_size - used, "\\r");
+        else if (c == '\n')
+            used += (size_t)snprintf(out + used, out_size - used, "\\n");
+        else if (c >= 32 && c <= 126)
+            out[used++] = (char)c;
+        else
+            used += (size_t)snprintf(out + used, out_size - used, "\\x%02x", c);
+    }
+    if (i < len)
+        used += (size_t)snprintf(out + used, out_size - used, "...");
+    out[used] = '\0';
+    return used;
+}
@@ -3,6 +3,8 @@
 #include "../include/utils.h"
 #include "../include/persistence.h"
 #include "../include/server.h"
+#include "../include/hashfunc.h"
+#include "../include/log.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +13,7 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <strings.h>
+#include <inttypes.h>
 
 void print_usage(const char *program_name)
 {
@@ -19,21 +22,39 @@ void print_usage(const char *program_name)
     printf("  -p PORT     Specify server port (default: 8520)\n");
     printf("  -i          Interactive mode (CLI)\n");
     printf("  -f FILE     Load database from file at startup\n");
+    printf("  -s SHARDS   Number of keyspace shards (default: %d, max: %d)\n",
+           DB_DEFAULT_SHARDS, DB_MAX_SHARDS);
+    printf("  -t, --io-threads THREADS\n");
+    printf("              Number of event loop threads serving clients (default: %d, max: %d)\n",
+           DEFAULT_IO_THREADS, MAX_IO_THREADS);
+    printf("  --io-backend epoll|uring\n");
+    printf("              Socket I/O of the event loops (default: epoll); uring needs Linux 6.0+\n");
+    printf("  --loglevel debug|verbose|notice|warning\n");
+    printf("              Least severe messages logged (default: %s)\n", log_level_name(LOG_DEFAULT_LEVEL));
     printf("  -h          Display this help message\n");
 }
 
 // Main function
 int main(int argc, char *argv[])
 {
-    // Create database
-    Database *db = db_create();
+    // Seed the shared hash function before any table is populated
+    hash_seed_init();
+
     int port = DEFAULT_PORT;
+    int shards = DB_DEFAULT_SHARDS;
+    int io_threads = DEFAULT_IO_THREADS;
+    IoBackend io_backend = IO_BACKEND_EPOLL;
     bool interactive_mode = false;
     char *load_file = NULL;
 
     // Parse command line arguments
+    static const struct option long_options[] = {
+        {"io-threads", required_argument, NULL, 't'},
+        {"io-backend", required_argument, NULL, 'b'},
+        {"loglevel", required_argument, NULL, 'l'},
+        {NULL, 0, NULL, 0}};
     int opt;
-    while ((opt = getopt(argc, argv, "p:if:h")) != -1)
+    while ((opt = getopt_long(argc, argv, "p:if:s:t:h", long_options, NULL)) != -1)
     {
         switch (opt)
         {
@@ -51,6 +72,41 @@ int main(int argc, char *argv[])
         case 'f':
             load_file = optarg;
             break;
+        case 's':
+            shards = atoi(optarg);
+            if (shards <= 0 || shards > DB_MAX_SHARDS)
+            {
+                fprintf(stderr, "Invalid shard count\n");
+                return 1;
+            }
+            break;
+        case 't':
+            io_threads = atoi(optarg);
+            if (io_threads <= 0 || io_threads > MAX_IO_THREADS)
+            {
+                fprintf(stderr, "Invalid I/O thread count\n");
+                return 1;
+            }
+            break;
+        case 'b':
+            if (strcasecmp(optarg, "epoll") == 0)
+                io_backend = IO_BACKEND_EPOLL;
+            else if (strcasecmp(optarg, "uring") == 0 || strcasecmp(optarg, "io_uring") == 0)
+                io_backend = IO_BACKEND_URING;
+            else
+            {
+                fprintf(stderr, "Invalid I/O backend\n");
+                return 1;
+            }
+            break;
+        case 'l':
+            if (log_level_from_name(optarg) < 0)
+            {
+                fprintf(stderr, "Invalid log level\n");
+                return 1;
+            }
+            log_set_level(log_level_from_name(optarg));
+            break;
         case 'h':
             print_usage(argv[0]);
             return 0;
@@ -60,6 +116,14 @@ int main(int argc, char *argv[])
         }
     }
 
+    // Create database
+    Database *db = db_create((size_t)shards);
+    if (!db)
+    {
+        fprintf(stderr, "Failed to create database\n");
+        return 1;
+    }
+
     // Load database if specified
     if (load_file)
     {
@@ -106,7 +170,8 @@ int main(int argc, char *argv[])
 
             // Tokenise command
             int token_count = 0;
-            char **tokens = tokenise_command(command, &token_count);
+            sds *tokens = tokenise_command(command, &token_count);
+            clock_refresh_ms();
 
             if (token_count == 0)
             {
@@ -116,14 +181,27 @@ int main(int argc, char *argv[])
             // Process commands
             if (strcasecmp(tokens[0], "SET") == 0)
             {
-                if (token_count != 3)
+                if (token_count < 3)
                 {
                     printf("(error) Wrong number of arguments for 'SET' command\n");
                 }
                 else
                 {
-                    set_command(db, tokens[1], tokens[2]);
-                    printf("OK\n");
+                    switch (set_command(db, tokens[1], tokens[2], tokens + 3, token_count - 3))
+                    {
+                    case SET_OK:
+                        printf("OK\n");
+                        break;
+                    case SET_NOT_PERFORMED:
+                        printf("(nil)\n");
+                        break;
+                    case SET_SYNTAX_ERROR:
+                        printf("(error) Syntax error\n");
+                        break;
+                    case SET_INVALID_EXPIRE:
+                        printf("(error) Invalid expire time\n");
+                        break;
+                    }
                 }
             }
             else if (strcasecmp(tokens[0], "GET") == 0)
@@ -134,10 +212,10 @@ int main(int argc, char *argv[])
                 }
                 else
                 {
-                    char *value = get_command(db, tokens[1]);
-                    if (value)
+                    DbString value;
+                    if (get_command(db, tokens[1], &value))
                     {
-                        printf("\"%s\"\n", value);
+                        printf("\"%.*s\"\n", (int)value.len, value.data);
                     }
                     else
                     {
@@ -189,10 +267,10 @@ int main(int argc, char *argv[])
                 }
                 else
                 {
-                    int new_value;
+                    int64_t new_value;
                     if (incr_command(db, tokens[1], &new_value))
                     {
-                        printf("(integer) %d\n", new_value);
+                        printf("(integer) %" PRId64 "\n", new_value);
                     }
                     else
                     {
@@ -208,10 +286,50 @@ int main(int argc, char *argv[])
                 }
                 else
                 {
-                    int new_value;
+                    int64_t new_value;
                     if (decr_command(db, tokens[1], &new_value))
                     {
-                        printf("(integer) %d\n", new_value);
+                        printf("(integer) %" PRId64 "\n", new_value);
+                    }
+                    else
+                    {
+                        printf("(error) Value is not an integer or out of range\n");
+                    }
+                }
+            }
+            else if (strcasecmp(tokens[0], "INCRBY") == 0)
+            {
+                if (token_count != 3)
+                {
+                    printf("(error) Wrong number of arguments for 'INCRBY' command\n");
+                }
+                else
+                {
+                    int64_t delta, new_value;
+                    if (string_to_int64(tokens[2], sds_len(tokens[2]), &delta) &&
+                        incrby_command(db, tokens[1], delta, &new_value))
+                    {
+                        printf("(integer) %" PRId64 "\n", new_value);
+                    }
+                    else
+                    {
+                        printf("(error) Value is not an integer or out of range\n");
+                    }
+                }
+            }
+            else if (strcasecmp(tokens[0], "DECRBY") == 0)
+            {
+                if (token_count != 3)
+                {
+                    printf("(error) Wrong number of arguments for 'DECRBY' command\n");
+                }
+                else
+                {
+                    int64_t delta, new_value;
+                    if (string_to_int64(tokens[2], sds_len(tokens[2]), &delta) &&
+                        decrby_command(db, tokens[1], delta, &new_value))
+                    {
+                        printf("(integer) %" PRId64 "\n", new_value);
                     }
                     else
                     {
@@ -245,16 +363,36 @@ int main(int argc, char *argv[])
                     }
                 }
             }
-            else if (strcasecmp(tokens[0], "TTL") == 0)
+            else if (strcasecmp(tokens[0], "PEXPIRE") == 0 || strcasecmp(tokens[0], "PEXPIREAT") == 0)
+            {
+                bool absolute = strcasecmp(tokens[0], "PEXPIREAT") == 0;
+                int64_t time_ms;
+                if (token_count != 3)
+                {
+                    printf("(error) Wrong number of arguments for '%s' command\n", absolute ? "PEXPIREAT" : "PEXPIRE");
+                }
+                else if (!string_to_int64(tokens[2], sds_len(tokens[2]), &time_ms) || time_ms < 0)
+                {
+                    printf("(error) Invalid expire time\n");
+                }
+                else
+                {
+                    bool result = absolute ? pexpireat_command(db, tokens[1], time_ms)
+                                           : pexpire_command(db, tokens[1], time_ms);
+                    printf("(integer) %d\n", result ? 1 : 0);
+                }
+            }
+            else if (strcasecmp(tokens[0], "TTL") == 0 || strcasecmp(tokens[0], "PTTL") == 0)
             {
+                bool millis = strcasecmp(tokens[0], "PTTL") == 0;
                 if (token_count != 2)
                 {
-                    printf("(error) Wrong number of arguments for 'TTL' command\n");
+                    printf("(error) Wrong number of arguments for '%s' command\n", millis ? "PTTL" : "TTL");
                 }
                 else
                 {
-                    int ttl = ttl_command(db, tokens[1]);
-                    printf("(integer) %d\n", ttl);
+                    int64_t ttl = millis ? pttl_command(db, tokens[1]) : ttl_command(db, tokens[1]);
+                    printf("(integer) %" PRId64 "\n", ttl);
                 }
             }
             else if (strcasecmp(tokens[0], "PERSIST") == 0)
@@ -321,11 +459,11 @@ int main(int argc, char *argv[])
                 }
                 else
                 {
-                    char *value = lpop_command(db, tokens[1]);
+                    sds value = lpop_command(db, tokens[1]);
                     if (value)
                     {
                         printf("\"%s\"\n", value);
-                        free(value);
+                        sds_free(value);
                     }
                     else
                     {
@@ -341,11 +479,11 @@ int main(int argc, char *argv[])
                 }
                 else
                 {
-                    char *value = rpop_command(db, tokens[1]);
+                    sds value = rpop_command(db, tokens[1]);
                     if (value)
                     {
                         printf("\"%s\"\n", value);
-                        free(value);
+                        sds_free(value);
                     }
                     else
                     {
@@ -375,19 +513,16 @@ int main(int argc, char *argv[])
                 {
                     int start = atoi(tokens[2]);
                     int stop = atoi(tokens[3]);
-                    int count;
-                    char **values = lrange_command(db, tokens[1], start, stop, &count);
-
-                    if (values)
+                    DbListRange range;
+                    if (lrange_command(db, tokens[1], start, stop, &range) > 0)
                     {
-                        for (int i = 0; i < count; i++)
+                        DbString value;
+                        for (int i = 1; db_lrange_next(&range, &value); i++)
                         {
-                            printf("%d) \"%s\"\n", i + 1, values[i]);
-                            free(values[i]);
+                            printf("%d) \"%.*s\"\n", i, (int)value.len, value.data);
                         }
-                        free(values);
                     }
-                    else if (count == 0)
+                    else
                     {
                         printf("(empty list or set)\n");
                     }
@@ -419,10 +554,10 @@ int main(int argc, char *argv[])
                 }
                 else
                 {
-                    char *value = hget_command(db, tokens[1], tokens[2]);
-                    if (value)
+                    DbString value;
+                    if (hget_command(db, tokens[1], tokens[2], &value))
                     {
-                        printf("\"%s\"\n", value);
+                        printf("\"%.*s\"\n", (int)value.len, value.data);
                     }
                     else
                     {
@@ -438,17 +573,15 @@ int main(int argc, char *argv[])
                 }
                 else
                 {
-                    int count;
-                    char **fields_and_values = hgetall_command(db, tokens[1], &count);
-
-                    if (fields_and_values && count > 0)
+                    HashIterator it;
+                    if (hgetall_command(db, tokens[1], &it) > 0)
                     {
-                        for (int i = 0; i < count; i++)
+                        DbString field, value;
+                        for (int i = 1; db_hash_iterator_next(&it, &field, &value); i += 2)
                         {
-                            printf("%d) \"%s\"\n", i + 1, fields_and_values[i]);
-                            free(fields_and_values[i]);
+                            printf("%d) \"%.*s\"\n", i, (int)field.len, field.data);
+                            printf("%d) \"%.*s\"\n", i + 1, (int)value.len, value.data);
                         }
-                        free(fields_and_values);
                     }
                     else
                     {
@@ -539,8 +672,10 @@ int main(int argc, char *argv[])
     // Server mode (default)
     else
     {
-        printf("Starting server on port %d\n", port);
-        if (!start_server(db, port))
+        // Server messages are written by a background thread from here on
+        log_start();
+        log_notice("Starting server on port %d", port);
+        if (!start_server(db, port, io_threads, io_backend))
         {
             fprintf(stderr, "Failed to start server\n");
             db_free(db);
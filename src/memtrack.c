@@ -0,0 +1,151 @@
+#include "../include/memtrack.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Header in front of each tracked block, sized to keep the block maximally
+// aligned
+typedef union
+{
+    struct
+    {
+        size_t size;
+        MemCategory category;
+    } info;
+    long double align;
+} MemHeader;
+
+static size_t g_allocated[MEM_CATEGORY_COUNT];
+static size_t g_peak;
+
+static const char *const g_category_names[MEM_CATEGORY_COUNT] = {
+    "keys", "values", "list_nodes", "hash_fields", "expires", "key_index", "client_buffers", "pubsub"};
+
+const char *mem_category_name(MemCategory category)
+{
+    return category < MEM_CATEGORY_COUNT ? g_category_names[category] : "unknown";
+}
+
+void mem_count_alloc(MemCategory category, size_t size)
+{
+    __atomic_add_fetch(&g_allocated[category], size, __ATOMIC_RELAXED);
+}
+
+void mem_count_free(MemCategory category, size_t size)
+{
+    __atomic_sub_fetch(&g_allocated[category], size, __ATOMIC_RELAXED);
+}
+
+static void *mem_track(MemHeader *header, MemCategory category, size_t size)
+{
+    header->info.size = size;
+    header->info.category = category;
+    mem_count_alloc(category, size);
+    return header + 1;
+}
+
+void *mem_alloc(MemCategory category, size_t size)
+{
+    if (size > SIZE_MAX - sizeof(MemHeader))
+        return NULL;
+
+    MemHeader *header = (MemHeader *)malloc(sizeof(MemHeader) + size);
+    return header ? mem_track(header, category, size) : NULL;
+}
+
+void *mem_calloc(MemCategory category, size_t count, size_t size)
+{
+    if (size != 0 && count > (SIZE_MAX - sizeof(MemHeader)) / size)
+        return NULL;
+
+    MemHeader *header = (MemHeader *)calloc(1, sizeof(MemHeader) + count * size);
+    return header ? mem_track(header, category, count * size) : NULL;
+}
+
+void *mem_realloc(MemCategory category, void *ptr, size_t size)
+{
+    if (!ptr)
+        return mem_alloc(category, size);
+    if (size > SIZE_MAX - sizeof(MemHeader))
+        return NULL;
+
+    MemHeader *header = (MemHeader *)ptr - 1;
+    size_t old_size = header->info.size;
+    category = header->info.category;
+
+    header = (MemHeader *)realloc(header, sizeof(MemHeader) + size);
+    if (!header)
+        return NULL;
+
+    mem_count_free(category, old_size);
+    return mem_track(header, category, size);
+}
+
+char *mem_strdup(MemCategory category, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = (char *)mem_alloc(category, len);
+    if (copy)
+        memcpy(copy, str, len);
+    return copy;
+}
+
+void mem_free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    MemHeader *header = (MemHeader *)ptr - 1;
+    mem_count_free(header->info.category, header->info.size);
+    free(header);
+}
+
+size_t mem_allocated(MemCategory category)
+{
+    return __atomic_load_n(&g_allocated[category], __ATOMIC_RELAXED);
+}
+
+size_t mem_used(void)
+{
+    size_t total = 0;
+    for (int c = 0; c < MEM_CATEGORY_COUNT; c++)
+        total += mem_allocated((MemCategory)c);
+    return total;
+}
+
+size_t mem_used_database(void)
+{
+    size_t total = 0;
+    for (int c = 0; c < MEM_CLIENT_BUFFERS; c++)
+        total += mem_allocated((MemCategory)c);
+    return total;
+}
+
+size_t mem_update_peak(size_t used)
+{
+    size_t peak = __atomic_load_n(&g_peak, __ATOMIC_RELAXED);
+    while (used > peak &&
+           !__atomic_compare_exchange_n(&g_peak, &peak, used, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+    return used > peak ? used : peak;
+}
+
+size_t mem_rss(void)
+{
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (!file)
+        return 0;
+
+    unsigned long pages_total, pages_resident;
+    int fields = fscanf(file, "%lu %lu", &pages_total, &pages_resident);
+    fclose(file);
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (fields != 2 || page_size <= 0)
+        return 0;
+    return (size_t)pages_resident * (size_t)page_size;
+}
@@ -1,10 +1,19 @@
 #include "../include/persistence.h"
 #include "../include/database.h"
+#include "../include/utils.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <errno.h>
+#include <inttypes.h>
+
+// Read the length line written before a string. Only its newline is
+// consumed: the bytes that follow may themselves start with whitespace.
+static bool read_length(FILE *file, int *len)
+{
+    return fscanf(file, "%d", len) == 1 && *len >= 0 && fgetc(file) == '\n';
+}
 
 // Save command implementation
 bool save_command(Database *db, const char *filename)
@@ -49,96 +58,86 @@ bool save_command(Database *db, const char *filename)
     // Write file signature and version
     fprintf(file, "%s\n%d\n", DB_FILE_SIGNATURE, DB_FILE_VERSION);
 
-    // Write entries
-    int total_entries = 0;
-
-    // First pass to count entries
-    for (int i = 0; i < HASH_TABLE_SIZE; i++)
-    {
-        Entry *current = db->hash_table[i];
-        while (current)
-        {
-            total_entries++;
-            current = current->next;
-        }
-    }
-
     // Write entry count
-    fprintf(file, "%d\n", total_entries);
+    fprintf(file, "%d\n", (int)db_size(db));
 
-    // Write each entry
-    for (int i = 0; i < HASH_TABLE_SIZE; i++)
+    // Write each entry (the iterator covers both tables during a rehash)
+    DbIterator it;
+    db_iterator_init(&it, db);
+    Entry *current;
+    while ((current = db_iterator_next(&it)) != NULL)
     {
-        Entry *current = db->hash_table[i];
-        while (current)
-        {
-            // Write key length and key
-            int key_len = strlen(current->key);
-            fprintf(file, "%d\n", key_len);
-            fwrite(current->key, 1, key_len, file);
-            fprintf(file, "\n");
+        // Write key length and key
+        int key_len = (int)current->key_len;
+        fprintf(file, "%d\n", key_len);
+        fwrite(current->key, 1, key_len, file);
+        fprintf(file, "\n");
 
-            // Write entry type
-            fprintf(file, "%d\n", current->type);
+        // Write entry type
+        fprintf(file, "%d\n", current->type);
 
-            // Write expiration
-            fprintf(file, "%d\n", (int)current->expiration);
+        // Write expiration
+        fprintf(file, "%" PRId64 "\n", db_entry_expiration(current));
 
-            // Write value based on type
-            if (current->type == VALUE_STRING)
+        // Write value based on type
+        if (current->type == VALUE_STRING)
+        {
+            // Write string value; integers are written in decimal form
+            char int_buf[DB_INT_BUF_SIZE];
+            const char *value = current->value.string_value;
+            int value_len;
+            if (current->encoding == STRING_ENC_INT)
             {
-                // Write string value
-                int value_len = strlen(current->value.string_value);
-                fprintf(file, "%d\n", value_len);
-                fwrite(current->value.string_value, 1, value_len, file);
-                fprintf(file, "\n");
+                value_len = (int)int64_to_string(current->value.int_value, int_buf);
+                value = int_buf;
             }
-            else if (current->type == VALUE_LIST)
+            else
             {
-                // Write list length
-                List *list = current->value.list_value;
-                fprintf(file, "%d\n", (int)list->length);
-
-                // Write each list element
-                ListNode *node = list->head;
-                while (node)
-                {
-                    int data_len = strlen(node->data);
-                    fprintf(file, "%d\n", data_len);
-                    fwrite(node->data, 1, data_len, file);
-                    fprintf(file, "\n");
-                    node = node->next;
-                }
+                value_len = (int)sds_len(current->value.string_value);
+            }
+            fprintf(file, "%d\n", value_len);
+            fwrite(value, 1, value_len, file);
+            fprintf(file, "\n");
+        }
+        else if (current->type == VALUE_LIST)
+        {
+            // Write list length
+            List *list = current->value.list_value;
+            fprintf(file, "%d\n", (int)list->length);
+
+            // Write each list element
+            ListIterator it;
+            const char *data;
+            size_t data_len;
+            ql_iterator_seek(&it, list, 0);
+            while (ql_iterator_next(&it, &data, &data_len))
+            {
+                fprintf(file, "%d\n", (int)data_len);
+                fwrite(data, 1, data_len, file);
+                fprintf(file, "\n");
             }
-            else if (current->type == VALUE_HASH)
+        }
+        else if (current->type == VALUE_HASH)
+        {
+            // Write hash field count
+            fprintf(file, "%d\n", (int)db_hash_length(current));
+
+            // Write each hash field-value pair
+            HashIterator it;
+            DbString field, value;
+            db_hash_iterator_init(&it, current);
+            while (db_hash_iterator_next(&it, &field, &value))
             {
-                // Write hash field count
-                Hash *hash = current->value.hash_value;
-                fprintf(file, "%d\n", (int)hash->field_count);
+                // Write field name length and field name
+                fprintf(file, "%d\n", (int)field.len);
+                fwrite(field.data, 1, field.len, file);
+                fprintf(file, "\n");
 
-                // Write each hash field-value pair
-                for (size_t bucket = 0; bucket < hash->bucket_count; bucket++)
-                {
-                    HashField *field = hash->buckets[bucket];
-                    while (field)
-                    {
-                        // Write field name length and field name
-                        int field_len = strlen(field->field);
-                        fprintf(file, "%d\n", field_len);
-                        fwrite(field->field, 1, field_len, file);
-                        fprintf(file, "\n");
-
-                        // Write field value length and field value
-                        int value_len = strlen(field->value);
-                        fprintf(file, "%d\n", value_len);
-                        fwrite(field->value, 1, value_len, file);
-                        fprintf(file, "\n");
-
-                        field = field->next;
-                    }
-                }
+                // Write field value length and field value
+                fprintf(file, "%d\n", (int)value.len);
+                fwrite(value.data, 1, value.len, file);
+                fprintf(file, "\n");
             }
-            current = current->next;
         }
     }
 
@@ -205,7 +204,7 @@ bool load_command(Database *db, const char *filename)
 
     // Read and verify version
     int version;
-    if (fscanf(file, "%d\n", &version) != 1 || version != DB_FILE_VERSION)
+    if (fscanf(file, "%d\n", &version) != 1 || version < DB_FILE_VERSION_SECONDS || version > DB_FILE_VERSION)
     {
         fprintf(stderr, "Unsupported database file version: %d\n", version);
         fclose(file);
@@ -230,38 +229,14 @@ bool load_command(Database *db, const char *filename)
     }
 
     // Clear existing database
-    for (int i = 0; i < HASH_TABLE_SIZE; i++)
-    {
-        Entry *current = db->hash_table[i];
-        while (current)
-        {
-            Entry *next = current->next;
-            free(current->key);
-
-            if (current->type == VALUE_STRING)
-            {
-                free(current->value.string_value);
-            }
-            else if (current->type == VALUE_LIST)
-            {
-                free_list(current->value.list_value);
-            }
-            else if (current->type == VALUE_HASH)
-            {
-                free_hash(current->value.hash_value);
-            }
-            free(current);
-            current = next;
-        }
-        db->hash_table[i] = NULL;
-    }
+    db_clear(db);
 
     // Read entries
     for (int i = 0; i < entry_count; i++)
     {
         // Read key length
         int key_len;
-        if (fscanf(file, "%d\n", &key_len) != 1)
+        if (!read_length(file, &key_len))
         {
             fprintf(stderr, "Failed to read key length for entry %d\n", i);
             fclose(file);
@@ -316,8 +291,8 @@ bool load_command(Database *db, const char *filename)
         }
 
         // Read expiration
-        int expiration;
-        if (fscanf(file, "%d\n", &expiration) != 1)
+        int64_t expiration;
+        if (fscanf(file, "%" SCNd64 "\n", &expiration) != 1)
         {
             fprintf(stderr, "Failed to read expiration for entry %d\n", i);
             free(key);
@@ -328,12 +303,14 @@ bool load_command(Database *db, const char *filename)
                 free(full_filename);
             return false;
         }
+        if (version == DB_FILE_VERSION_SECONDS && expiration > 0)
+            expiration *= 1000;
 
         if (type == VALUE_STRING)
         {
             // Read string value
             int value_len;
-            if (fscanf(file, "%d\n", &value_len) != 1)
+            if (!read_length(file, &value_len))
             {
                 fprintf(stderr, "Failed to read value length for entry %d\n", i);
                 free(key);
@@ -374,8 +351,8 @@ bool load_command(Database *db, const char *filename)
             fgetc(file); // Skip newline
 
             // Store string value
-            db_set(db, key, value);
-            db_set_expiration(db, key, (time_t)expiration);
+            db_set(db, key, key_len, value, value_len);
+            db_set_expiration(db, key, key_len, expiration);
 
             free(value);
         }
@@ -399,7 +376,7 @@ bool load_command(Database *db, const char *filename)
             for (int j = 0; j < list_len; j++)
             {
                 int data_len;
-                if (fscanf(file, "%d\n", &data_len) != 1)
+                if (!read_length(file, &data_len))
                 {
                     fprintf(stderr, "Failed to read list element length for entry %d, element %d\n", i, j);
                     free(key);
@@ -440,7 +417,7 @@ bool load_command(Database *db, const char *filename)
                 fgetc(file); // Skip newline
 
                 // Add to list (this will create the list entry on first call)
-                if (!db_rpush(db, key, data))
+                if (!db_rpush(db, key, key_len, data, data_len))
                 {
                     fprintf(stderr, "Failed to add element to list for key %s\n", key);
                     free(data);
@@ -458,7 +435,7 @@ bool load_command(Database *db, const char *filename)
             // Set expiration for the list
             if (expiration != 0)
             {
-                db_set_expiration(db, key, (time_t)expiration);
+                db_set_expiration(db, key, key_len, expiration);
             }
         }
         else if (type == VALUE_HASH)
@@ -482,7 +459,7 @@ bool load_command(Database *db, const char *filename)
             {
                 // Read field name length
                 int field_len;
-                if (fscanf(file, "%d\n", &field_len) != 1)
+                if (!read_length(file, &field_len))
                 {
                     fprintf(stderr, "Failed to read field name length for entry %d, field %d\n", i, j);
                     free(key);
@@ -525,7 +502,7 @@ bool load_command(Database *db, const char *filename)
 
                 // Read field value length
                 int field_value_len;
-                if (fscanf(file, "%d\n", &field_value_len) != 1)
+                if (!read_length(file, &field_value_len))
                 {
                     fprintf(stderr, "Failed to read field value length for entry %d, field %d\n", i, j);
                     free(key);
@@ -570,7 +547,7 @@ bool load_command(Database *db, const char *filename)
                 fgetc(file); // Skip newline
 
                 // Set hash field (this will create the hash entry on first call)
-                if (!db_hset(db, key, field_name, field_value))
+                if (!db_hset(db, key, key_len, field_name, field_len, field_value, field_value_len))
                 {
                     fprintf(stderr, "Failed to set hash field for key %s, field %s\n", key, field_name);
                     free(field_name);
@@ -590,7 +567,7 @@ bool load_command(Database *db, const char *filename)
             // Set expiration for the hash
             if (expiration != 0)
             {
-                db_set_expiration(db, key, (time_t)expiration);
+                db_set_expiration(db, key, key_len, expiration);
             }
         }
 
@@ -1,5 +1,8 @@
 #include "../include/pubsub.h"
 #include "../include/server.h"
+#include "../include/hashfunc.h"
+#include "../include/memtrack.h"
+#include "../include/log.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +10,8 @@
 #include <sys/socket.h>
 #include <pthread.h>
 
+// Copies handed to callers, who release them with free. The manager's own
+// structures are allocated with mem_alloc and counted as MEM_PUBSUB.
 static char *my_strdup(const char *s)
 {
     if (!s)
@@ -20,22 +25,16 @@ static char *my_strdup(const char *s)
     return new_str;
 }
 
-// Hash function for channel names
+// Hash function for channel names (bucket index in the channel table)
 unsigned int pubsub_hash(const char *str)
 {
-    unsigned int hash = 5381;
-    int c;
-    while ((c = *str++))
-    {
-        hash = ((hash << 5) + hash) + c;
-    }
-    return hash % 1024;
+    return (unsigned int)(hash_string(str) & (1024 - 1));
 }
 
 // Create pub/sub manager
 PubSubManager *pubsub_create()
 {
-    PubSubManager *pubsub = malloc(sizeof(PubSubManager));
+    PubSubManager *pubsub = mem_alloc(MEM_PUBSUB, sizeof(PubSubManager));
     if (!pubsub)
         return NULL;
 
@@ -44,11 +43,12 @@ PubSubManager *pubsub_create()
     {
         pubsub->channels[i] = NULL;
     }
+    pubsub->deliver = NULL;
 
     // Initialize mutex
     if (pthread_mutex_init(&pubsub->mutex, NULL) != 0)
     {
-        free(pubsub);
+        mem_free(pubsub);
         return NULL;
     }
 
@@ -61,7 +61,7 @@ static void free_subscriber_node(Subscriber *sub)
     if (!sub)
         return;
 
-    free(sub);
+    mem_free(sub);
 }
 
 // Free channel and its subscriber references
@@ -70,7 +70,7 @@ static void free_channel(Channel *channel)
     if (!channel)
         return;
 
-    free(channel->name);
+    mem_free(channel->name);
 
     // Free subscriber nodes
     Subscriber *sub = channel->subscribers;
@@ -81,7 +81,7 @@ static void free_channel(Channel *channel)
         sub = next;
     }
 
-    free(channel);
+    mem_free(channel);
 }
 
 // Free all subscriber data for a specific client
@@ -101,9 +101,9 @@ static void free_subscriber_data(PubSubManager *pubsub, int client_socket)
                     // Free the channel names array
                     for (size_t j = 0; j < sub->channel_count; j++)
                     {
-                        free(sub->channels[j]);
+                        mem_free(sub->channels[j]);
                     }
-                    free(sub->channels);
+                    mem_free(sub->channels);
                     sub->channels = NULL;
                     sub->channel_count = 0;
                     sub->channel_capacity = 0;
@@ -182,7 +182,7 @@ void pubsub_free(PubSubManager *pubsub)
 
     pthread_mutex_unlock(&pubsub->mutex);
     pthread_mutex_destroy(&pubsub->mutex);
-    free(pubsub);
+    mem_free(pubsub);
 }
 
 // Get or create channel
@@ -205,14 +205,14 @@ Channel *pubsub_get_or_create_channel(PubSubManager *pubsub, const char *channel
     }
 
     // Create new channel
-    channel = malloc(sizeof(Channel));
+    channel = mem_alloc(MEM_PUBSUB, sizeof(Channel));
     if (!channel)
         return NULL;
 
-    channel->name = my_strdup(channel_name);
+    channel->name = mem_strdup(MEM_PUBSUB, channel_name);
     if (!channel->name)
     {
-        free(channel);
+        mem_free(channel);
         return NULL;
     }
 
@@ -304,7 +304,7 @@ static bool add_channel_to_subscriber(Subscriber *sub, const char *channel_name)
     if (sub->channel_count >= sub->channel_capacity)
     {
         size_t new_capacity = sub->channel_capacity == 0 ? 4 : sub->channel_capacity * 2;
-        char **new_channels = realloc(sub->channels, new_capacity * sizeof(char *));
+        char **new_channels = mem_realloc(MEM_PUBSUB, sub->channels, new_capacity * sizeof(char *));
         if (!new_channels)
             return false;
         sub->channels = new_channels;
@@ -312,7 +312,7 @@ static bool add_channel_to_subscriber(Subscriber *sub, const char *channel_name)
     }
 
     // Add channel
-    sub->channels[sub->channel_count] = my_strdup(channel_name);
+    sub->channels[sub->channel_count] = mem_strdup(MEM_PUBSUB, channel_name);
     if (!sub->channels[sub->channel_count])
         return false;
 
@@ -327,7 +327,7 @@ static void remove_channel_from_subscriber(Subscriber *sub, const char *channel_
     {
         if (strcmp(sub->channels[i], channel_name) == 0)
         {
-            free(sub->channels[i]);
+            mem_free(sub->channels[i]);
             // Shift remaining channels
             for (size_t j = i; j < sub->channel_count - 1; j++)
             {
@@ -342,7 +342,7 @@ static void remove_channel_from_subscriber(Subscriber *sub, const char *channel_
 // Create a new subscriber node (without channels array)
 static Subscriber *create_subscriber_node(int client_socket)
 {
-    Subscriber *sub = malloc(sizeof(Subscriber));
+    Subscriber *sub = mem_alloc(MEM_PUBSUB, sizeof(Subscriber));
     if (!sub)
         return NULL;
 
@@ -401,7 +401,7 @@ bool pubsub_subscribe(PubSubManager *pubsub, int client_socket, const char *chan
     {
         if (main_sub->channel_count == 0)
         {
-            free(main_sub);
+            mem_free(main_sub);
         }
         pthread_mutex_unlock(&pubsub->mutex);
         return false;
@@ -415,8 +415,8 @@ bool pubsub_subscribe(PubSubManager *pubsub, int client_socket, const char *chan
         remove_channel_from_subscriber(main_sub, channel_name);
         if (main_sub->channel_count == 0)
         {
-            free(main_sub->channels);
-            free(main_sub);
+            mem_free(main_sub->channels);
+            mem_free(main_sub);
         }
         pthread_mutex_unlock(&pubsub->mutex);
         return false;
@@ -429,7 +429,7 @@ bool pubsub_subscribe(PubSubManager *pubsub, int client_socket, const char *chan
         main_sub->next = channel->subscribers;
         channel->subscribers = main_sub;
         channel->subscriber_count++;
-        free(channel_sub); // Don't need the extra node
+        mem_free(channel_sub); // Don't need the extra node
     }
     else
     {
@@ -477,8 +477,8 @@ bool pubsub_unsubscribe(PubSubManager *pubsub, int client_socket, const char *ch
                         if (to_remove->channel_count == 0)
                         {
                             // No more channels, free the subscriber data
-                            free(to_remove->channels);
-                            free(to_remove);
+                            mem_free(to_remove->channels);
+                            mem_free(to_remove);
                         }
                         else
                         {
@@ -505,7 +505,7 @@ bool pubsub_unsubscribe(PubSubManager *pubsub, int client_socket, const char *ch
                     else
                     {
                         // This is just a reference node, free it
-                        free(to_remove);
+                        mem_free(to_remove);
                     }
 
                     // Remove empty channel
@@ -603,6 +603,13 @@ int pubsub_publish(PubSubManager *pubsub, const char *channel_name, const char *
                          strlen(message), message);
 
                 // Send to subscriber (non-blocking)
+                if (pubsub->deliver)
+                {
+                    pubsub->deliver(sub->client_socket, response, strlen(response));
+                    delivered++;
+                    sub = sub->next;
+                    continue;
+                }
                 ssize_t result = send(sub->client_socket, response, strlen(response), MSG_NOSIGNAL);
                 if (result > 0)
                 {
@@ -611,7 +618,7 @@ int pubsub_publish(PubSubManager *pubsub, const char *channel_name, const char *
                 else
                 {
                     // Client might be disconnected
-                    printf("Failed to deliver message to client %d\n", sub->client_socket);
+                    log_warning("Failed to deliver message to client %d", sub->client_socket);
                 }
                 sub = sub->next;
             }
@@ -0,0 +1,280 @@
+#include "../include/quicklist.h"
+#include "../include/listpack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QL_CHUNK_HEADER offsetof(ListChunk, data)
+
+// Chunk with room for at least size bytes of data; the allocation is
+// rounded up to its slab class and the slack becomes spare capacity
+static ListChunk *ql_chunk_create(SlabPool *pool, size_t size)
+{
+    size_t alloc = slab_class_size(QL_CHUNK_HEADER + size);
+    ListChunk *chunk = (ListChunk *)slab_alloc(pool, MEM_LIST_NODES, alloc);
+    if (!chunk)
+        return NULL;
+
+    chunk->prev = NULL;
+    chunk->next = NULL;
+    chunk->count = 0;
+    chunk->used = 0;
+    chunk->size = (uint32_t)(alloc - QL_CHUNK_HEADER);
+    return chunk;
+}
+
+static void ql_chunk_free(SlabPool *pool, ListChunk *chunk)
+{
+    slab_free(pool, MEM_LIST_NODES, chunk, QL_CHUNK_HEADER + chunk->size);
+}
+
+// Move a chunk into a larger allocation with room for extra more bytes
+static ListChunk *ql_chunk_grow(SlabPool *pool, List *list, ListChunk *chunk, size_t extra)
+{
+    ListChunk *grown = ql_chunk_create(pool, chunk->used + extra);
+    if (!grown)
+        return NULL;
+
+    memcpy(grown->data, chunk->data, chunk->used);
+    grown->count = chunk->count;
+    grown->used = chunk->used;
+    grown->prev = chunk->prev;
+    grown->next = chunk->next;
+
+    if (grown->prev)
+        grown->prev->next = grown;
+    else
+        list->head = grown;
+    if (grown->next)
+        grown->next->prev = grown;
+    else
+        list->tail = grown;
+
+    ql_chunk_free(pool, chunk);
+    return grown;
+}
+
+static void ql_unlink_chunk(List *list, ListChunk *chunk)
+{
+    if (chunk->prev)
+        chunk->prev->next = chunk->next;
+    else
+        list->head = chunk->next;
+    if (chunk->next)
+        chunk->next->prev = chunk->prev;
+    else
+        list->tail = chunk->prev;
+    list->chunk_count--;
+}
+
+List *ql_create(SlabPool *pool)
+{
+    List *list = (List *)slab_alloc(pool, MEM_LIST_NODES, sizeof(List));
+    if (!list)
+        return NULL;
+
+    list->head = NULL;
+    list->tail = NULL;
+    list->length = 0;
+    list->chunk_count = 0;
+    return list;
+}
+
+void ql_release(SlabPool *pool, List *list)
+{
+    if (list)
+        ql_release_step(pool, list, SIZE_MAX);
+}
+
+bool ql_release_step(SlabPool *pool, List *list, size_t chunks)
+{
+    for (; list->head && chunks > 0; chunks--)
+    {
+        ListChunk *next = list->head->next;
+        ql_chunk_free(pool, list->head);
+        list->head = next;
+        list->chunk_count--;
+    }
+    if (list->head)
+        return false;
+
+    slab_free(pool, MEM_LIST_NODES, list, sizeof(List));
+    return true;
+}
+
+size_t ql_memory(const List *list)
+{
+    size_t bytes = slab_class_size(sizeof(List));
+    for (const ListChunk *chunk = list->head; chunk; chunk = chunk->next)
+        bytes += slab_class_size(QL_CHUNK_HEADER + chunk->size);
+    return bytes;
+}
+
+bool ql_push(SlabPool *pool, List *list, const char *data, size_t len, bool at_head)
+{
+    if (len > UINT32_MAX - QL_CHUNK_HEADER - LP_MAX_LEN_SIZE)
+    {
+        fprintf(stderr, "List element too long: %zu bytes\n", len);
+        return false;
+    }
+
+    size_t need = lp_len_size(len) + len;
+    ListChunk *chunk = at_head ? list->head : list->tail;
+
+    if (chunk && chunk->used + need > chunk->size)
+    {
+        // Grow the end chunk while it stays small, otherwise start a new one
+        if (QL_CHUNK_HEADER + chunk->used + need <= QL_CHUNK_MAX)
+        {
+            chunk = ql_chunk_grow(pool, list, chunk, need);
+            if (!chunk)
+                return false;
+        }
+        else
+        {
+            chunk = NULL;
+        }
+    }
+
+    if (!chunk)
+    {
+        chunk = ql_chunk_create(pool, need);
+        if (!chunk)
+            return false;
+
+        if (at_head)
+        {
+            chunk->next = list->head;
+            if (list->head)
+                list->head->prev = chunk;
+            else
+                list->tail = chunk;
+            list->head = chunk;
+        }
+        else
+        {
+            chunk->prev = list->tail;
+            if (list->tail)
+                list->tail->next = chunk;
+            else
+                list->head = chunk;
+            list->tail = chunk;
+        }
+        list->chunk_count++;
+    }
+
+    char *p;
+    if (at_head)
+    {
+        memmove(chunk->data + need, chunk->data, chunk->used);
+        p = chunk->data;
+    }
+    else
+    {
+        p = chunk->data + chunk->used;
+    }
+
+    p += lp_write_len(p, len);
+    memcpy(p, data, len);
+
+    chunk->used += (uint32_t)need;
+    chunk->count++;
+    list->length++;
+    return true;
+}
+
+sds ql_pop(SlabPool *pool, List *list, bool at_head)
+{
+    ListChunk *chunk = at_head ? list->head : list->tail;
+    if (!chunk)
+        return NULL;
+
+    // The last element of a chunk is found by walking its length prefixes
+    size_t offset = 0;
+    if (!at_head)
+    {
+        for (uint32_t i = 1; i < chunk->count; i++)
+            offset += lp_element_size(chunk->data + offset);
+    }
+
+    size_t len;
+    size_t prefix = lp_read_len(chunk->data + offset, &len);
+    sds value = sds_new_len(chunk->data + offset + prefix, len);
+    if (!value)
+        return NULL;
+
+    size_t size = prefix + len;
+    if (at_head)
+        memmove(chunk->data, chunk->data + size, chunk->used - size);
+
+    chunk->used -= (uint32_t)size;
+    chunk->count--;
+    list->length--;
+
+    if (chunk->count == 0)
+    {
+        ql_unlink_chunk(list, chunk);
+        ql_chunk_free(pool, chunk);
+    }
+    return value;
+}
+
+void ql_iterator_seek(ListIterator *it, const List *list, size_t index)
+{
+    it->chunk = NULL;
+    it->offset = 0;
+    it->index = 0;
+    if (index >= list->length)
+        return;
+
+    // Skip whole chunks from whichever end is closer; first is the list
+    // index of the chunk's first element
+    ListChunk *chunk;
+    size_t first;
+    if (index < list->length / 2)
+    {
+        chunk = list->head;
+        first = 0;
+        while (index >= first + chunk->count)
+        {
+            first += chunk->count;
+            chunk = chunk->next;
+        }
+    }
+    else
+    {
+        chunk = list->tail;
+        first = list->length - chunk->count;
+        while (index < first)
+        {
+            chunk = chunk->prev;
+            first -= chunk->count;
+        }
+    }
+
+    it->chunk = chunk;
+    for (; first < index; first++)
+    {
+        it->offset += (uint32_t)lp_element_size(chunk->data + it->offset);
+        it->index++;
+    }
+}
+
+bool ql_iterator_next(ListIterator *it, const char **data, size_t *len)
+{
+    while (it->chunk && it->index >= it->chunk->count)
+    {
+        it->chunk = it->chunk->next;
+        it->offset = 0;
+        it->index = 0;
+    }
+    if (!it->chunk)
+        return false;
+
+    const char *p = it->chunk->data + it->offset;
+    size_t prefix = lp_read_len(p, len);
+    *data = p + prefix;
+    it->offset += (uint32_t)(prefix + *len);
+    it->index++;
+    return true;
+}
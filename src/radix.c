@@ -0,0 +1,383 @@
+#include "../include/radix.h"
+#include <stdlib.h>
+#include <string.h>
+
+static size_t radix_node_size(size_t label_len)
+{
+    return offsetof(RadixNode, label) + label_len;
+}
+
+// Node with room for a label of label_len bytes, left for the caller to fill
+static RadixNode *radix_node_alloc(SlabPool *pool, size_t label_len)
+{
+    if (label_len > UINT32_MAX)
+        return NULL;
+
+    RadixNode *node = (RadixNode *)slab_alloc(pool, MEM_KEY_INDEX, radix_node_size(label_len));
+    if (!node)
+        return NULL;
+
+    node->children = NULL;
+    node->keys = 0;
+    node->label_len = (uint32_t)label_len;
+    node->child_count = 0;
+    node->child_capacity = 0;
+    node->is_key = 0;
+    return node;
+}
+
+static RadixNode *radix_node_new(SlabPool *pool, const char *label, size_t label_len)
+{
+    RadixNode *node = radix_node_alloc(pool, label_len);
+    if (node && label_len > 0)
+        memcpy(node->label, label, label_len);
+    return node;
+}
+
+// Free a node and its child array, not the children themselves
+static void radix_node_free(SlabPool *pool, RadixNode *node)
+{
+    if (node->children)
+        slab_free(pool, MEM_KEY_INDEX, node->children, node->child_capacity * sizeof(RadixNode *));
+    slab_free(pool, MEM_KEY_INDEX, node, radix_node_size(node->label_len));
+}
+
+// Hand a node's children, key flag and count over to another node
+static void radix_node_move_contents(RadixNode *to, RadixNode *from)
+{
+    to->children = from->children;
+    to->child_count = from->child_count;
+    to->child_capacity = from->child_capacity;
+    to->keys = from->keys;
+    to->is_key = from->is_key;
+    from->children = NULL;
+    from->child_count = 0;
+    from->child_capacity = 0;
+}
+
+// Index of the child whose label starts with byte, or where it would go
+static size_t radix_child_index(const RadixNode *node, unsigned char byte, bool *found)
+{
+    size_t low = 0;
+    size_t high = node->child_count;
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        unsigned char first = (unsigned char)node->children[mid]->label[0];
+        if (first == byte)
+        {
+            *found = true;
+            return mid;
+        }
+        if (first < byte)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    *found = false;
+    return low;
+}
+
+static RadixNode *radix_child(const RadixNode *node, unsigned char byte)
+{
+    bool found;
+    size_t index = radix_child_index(node, byte, &found);
+    return found ? node->children[index] : NULL;
+}
+
+static bool radix_add_child(SlabPool *pool, RadixNode *node, size_t index, RadixNode *child)
+{
+    if (node->child_count == node->child_capacity)
+    {
+        // At most 256 children, one per first byte
+        size_t capacity = node->child_capacity ? node->child_capacity * 2 : 2;
+        RadixNode **children = (RadixNode **)slab_alloc(pool, MEM_KEY_INDEX, capacity * sizeof(RadixNode *));
+        if (!children)
+            return false;
+
+        if (node->children)
+        {
+            memcpy(children, node->children, node->child_count * sizeof(RadixNode *));
+            slab_free(pool, MEM_KEY_INDEX, node->children, node->child_capacity * sizeof(RadixNode *));
+        }
+        node->children = children;
+        node->child_capacity = (uint16_t)capacity;
+    }
+
+    memmove(node->children + index + 1, node->children + index,
+            (node->child_count - index) * sizeof(RadixNode *));
+    node->children[index] = child;
+    node->child_count++;
+    return true;
+}
+
+static void radix_remove_child(SlabPool *pool, RadixNode *node, size_t index)
+{
+    node->child_count--;
+    memmove(node->children + index, node->children + index + 1,
+            (node->child_count - index) * sizeof(RadixNode *));
+    if (node->child_count == 0)
+    {
+        slab_free(pool, MEM_KEY_INDEX, node->children, node->child_capacity * sizeof(RadixNode *));
+        node->children = NULL;
+        node->child_capacity = 0;
+    }
+}
+
+// Split the label of a node's child after its first common bytes: a new
+// child with the first part gets a single child with the rest, which takes
+// over the original's contents. Returns the new child, NULL if out of memory.
+static RadixNode *radix_split(SlabPool *pool, RadixNode *node, size_t index, size_t common)
+{
+    RadixNode *child = node->children[index];
+    RadixNode *head = radix_node_new(pool, child->label, common);
+    RadixNode *tail = radix_node_new(pool, child->label + common, child->label_len - common);
+    if (!head || !tail || !radix_add_child(pool, head, 0, tail))
+    {
+        if (head)
+            radix_node_free(pool, head);
+        if (tail)
+            radix_node_free(pool, tail);
+        return NULL;
+    }
+
+    radix_node_move_contents(tail, child);
+    head->keys = tail->keys;
+    node->children[index] = head;
+    radix_node_free(pool, child);
+    return head;
+}
+
+// Replace a keyless node that has a single child by one node with both
+// labels. Left as it is if out of memory, which only costs compactness.
+static void radix_merge(SlabPool *pool, RadixNode *parent, RadixNode *node)
+{
+    RadixNode *child = node->children[0];
+    RadixNode *merged = radix_node_alloc(pool, (size_t)node->label_len + child->label_len);
+    if (!merged)
+        return;
+
+    memcpy(merged->label, node->label, node->label_len);
+    memcpy(merged->label + node->label_len, child->label, child->label_len);
+    radix_node_move_contents(merged, child);
+
+    bool found;
+    size_t index = radix_child_index(parent, (unsigned char)node->label[0], &found);
+    parent->children[index] = merged;
+    radix_node_free(pool, child);
+    radix_node_free(pool, node);
+}
+
+static size_t common_prefix_len(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    size_t limit = a_len < b_len ? a_len : b_len;
+    size_t i = 0;
+    while (i < limit && a[i] == b[i])
+        i++;
+    return i;
+}
+
+// Add delta to the counts of every node on the path of a key in the tree
+static void radix_adjust_counts(RadixTree *tree, const char *key, size_t len, int delta)
+{
+    RadixNode *node = tree->root;
+    node->keys += (size_t)(ptrdiff_t)delta;
+    for (size_t pos = 0; pos < len; pos += node->label_len)
+    {
+        node = radix_child(node, (unsigned char)key[pos]);
+        node->keys += (size_t)(ptrdiff_t)delta;
+    }
+}
+
+// Node at which the keys starting with prefix hang: the node the prefix
+// ends at or inside of. *start is set to the length of the keys' bytes
+// before that node's label. NULL if no key has the prefix.
+static const RadixNode *radix_find_prefix(const RadixTree *tree, const char *prefix, size_t len, size_t *start)
+{
+    const RadixNode *node = tree->root;
+    size_t pos = 0;
+    *start = 0;
+    while (node && pos < len)
+    {
+        const RadixNode *child = radix_child(node, (unsigned char)prefix[pos]);
+        if (!child)
+            return NULL;
+
+        size_t compare = child->label_len < len - pos ? child->label_len : len - pos;
+        if (memcmp(child->label, prefix + pos, compare) != 0)
+            return NULL;
+        *start = pos;
+        pos += child->label_len;
+        node = child;
+    }
+    return node;
+}
+
+void radix_init(RadixTree *tree)
+{
+    tree->root = NULL;
+}
+
+static void radix_free_subtree(SlabPool *pool, RadixNode *node)
+{
+    for (size_t i = 0; i < node->child_count; i++)
+        radix_free_subtree(pool, node->children[i]);
+    radix_node_free(pool, node);
+}
+
+void radix_release(SlabPool *pool, RadixTree *tree)
+{
+    if (tree->root)
+        radix_free_subtree(pool, tree->root);
+    tree->root = NULL;
+}
+
+bool radix_insert(SlabPool *pool, RadixTree *tree, const char *key, size_t len)
+{
+    if (!tree->root)
+    {
+        tree->root = radix_node_new(pool, NULL, 0);
+        if (!tree->root)
+            return false;
+    }
+
+    RadixNode *node = tree->root;
+    size_t pos = 0;
+    while (pos < len)
+    {
+        bool found;
+        size_t index = radix_child_index(node, (unsigned char)key[pos], &found);
+        if (!found)
+        {
+            RadixNode *leaf = radix_node_new(pool, key + pos, len - pos);
+            if (!leaf || !radix_add_child(pool, node, index, leaf))
+            {
+                if (leaf)
+                    radix_node_free(pool, leaf);
+                return false;
+            }
+            node = leaf;
+            break;
+        }
+
+        RadixNode *child = node->children[index];
+        size_t common = common_prefix_len(child->label, child->label_len, key + pos, len - pos);
+        if (common < child->label_len)
+        {
+            child = radix_split(pool, node, index, common);
+            if (!child)
+                return false;
+        }
+        node = child;
+        pos += common;
+    }
+
+    if (!node->is_key)
+    {
+        node->is_key = 1;
+        radix_adjust_counts(tree, key, len, 1);
+    }
+    return true;
+}
+
+bool radix_remove(SlabPool *pool, RadixTree *tree, const char *key, size_t len)
+{
+    RadixNode *grandparent = NULL;
+    RadixNode *parent = NULL;
+    RadixNode *node = tree->root;
+    size_t pos = 0;
+    while (node && pos < len)
+    {
+        RadixNode *child = radix_child(node, (unsigned char)key[pos]);
+        if (!child || child->label_len > len - pos || memcmp(child->label, key + pos, child->label_len) != 0)
+            return false;
+        grandparent = parent;
+        parent = node;
+        node = child;
+        pos += child->label_len;
+    }
+    if (!node || !node->is_key)
+        return false;
+
+    radix_adjust_counts(tree, key, len, -1);
+    node->is_key = 0;
+
+    // Keep the tree compressed: drop a node that leads to no key any more,
+    // then merge what is left with its only child if it holds no key
+    if (!parent)
+        return true;
+    if (node->child_count == 0)
+    {
+        bool found;
+        radix_remove_child(pool, parent, radix_child_index(parent, (unsigned char)node->label[0], &found));
+        radix_node_free(pool, node);
+        node = parent;
+        parent = grandparent;
+        if (!parent)
+            return true;
+    }
+    if (!node->is_key && node->child_count == 1)
+        radix_merge(pool, parent, node);
+    return true;
+}
+
+size_t radix_count_prefix(const RadixTree *tree, const char *prefix, size_t len)
+{
+    size_t start;
+    const RadixNode *node = radix_find_prefix(tree, prefix, len, &start);
+    return node ? node->keys : 0;
+}
+
+// Depth-first walk state; buf holds the bytes of the key being built
+typedef struct
+{
+    char *buf;
+    size_t len;
+    size_t capacity;
+    bool (*fn)(const char *key, size_t len, void *ctx);
+    void *ctx;
+} RadixWalk;
+
+static bool radix_walk_node(RadixWalk *walk, const RadixNode *node)
+{
+    if (walk->len + node->label_len > walk->capacity)
+    {
+        size_t capacity = (walk->len + node->label_len) * 2;
+        char *buf = (char *)realloc(walk->buf, capacity);
+        if (!buf)
+            return false;
+        walk->buf = buf;
+        walk->capacity = capacity;
+    }
+    memcpy(walk->buf + walk->len, node->label, node->label_len);
+    walk->len += node->label_len;
+
+    bool more = !node->is_key || walk->fn(walk->buf, walk->len, walk->ctx);
+    for (size_t i = 0; more && i < node->child_count; i++)
+        more = radix_walk_node(walk, node->children[i]);
+
+    walk->len -= node->label_len;
+    return more;
+}
+
+bool radix_walk_prefix(const RadixTree *tree, const char *prefix, size_t len,
+                       bool (*fn)(const char *key, size_t len, void *ctx), void *ctx)
+{
+    size_t start;
+    const RadixNode *node = radix_find_prefix(tree, prefix, len, &start);
+    if (!node)
+        return true;
+
+    RadixWalk walk = {NULL, 0, 0, fn, ctx};
+    walk.capacity = start + 64;
+    walk.buf = (char *)malloc(walk.capacity);
+    if (!walk.buf)
+        return false;
+    if (start > 0)
+        memcpy(walk.buf, prefix, start);
+    walk.len = start;
+
+    bool completed = radix_walk_node(&walk, node);
+    free(walk.buf);
+    return completed;
+}
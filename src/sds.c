@@ -0,0 +1,74 @@
+#include "../include/sds.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+sds sds_init(void *mem, size_t alloc, const void *data, size_t len)
+{
+    SdsHeader *header = (SdsHeader *)mem;
+    header->len = (uint32_t)len;
+    header->alloc = (uint32_t)alloc;
+    if (len)
+        memcpy(header->buf, data, len);
+    header->buf[len] = '\0';
+    return header->buf;
+}
+
+sds sds_new_len(const void *data, size_t len)
+{
+    if (len > SDS_MAX_LEN)
+    {
+        fprintf(stderr, "String too long: %zu bytes\n", len);
+        return NULL;
+    }
+
+    void *mem = malloc(sds_mem_size(len));
+    if (!mem)
+        return NULL;
+
+    return sds_init(mem, len, data, len);
+}
+
+sds sds_new(const char *str)
+{
+    if (!str)
+        return NULL;
+    return sds_new_len(str, strlen(str));
+}
+
+sds sds_dup(const sds s)
+{
+    if (!s)
+        return NULL;
+    return sds_new_len(s, sds_len(s));
+}
+
+void sds_free(sds s)
+{
+    if (s)
+        free(sds_header(s));
+}
+
+void sds_free_array(sds *array, int count)
+{
+    if (!array)
+        return;
+
+    for (int i = 0; i < count; i++)
+    {
+        sds_free(array[i]);
+    }
+    free(array);
+}
+
+bool sds_assign(sds s, const void *data, size_t len)
+{
+    SdsHeader *header = sds_header(s);
+    if (len > header->alloc)
+        return false;
+
+    memmove(header->buf, data, len);
+    header->buf[len] = '\0';
+    header->len = (uint32_t)len;
+    return true;
+}
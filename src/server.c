@@ -2,53 +2,108 @@
 #include "../include/database.h"
 #include "../include/commands.h"
 #include "../include/utils.h"
+#include "../include/memtrack.h"
 #include "../include/persistence.h"
 #include "../include/pubsub.h"
+#include "../include/uring.h"
+#include "../include/log.h"
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <signal.h>
 #include <pthread.h>
 #include <errno.h>
+#include <inttypes.h>
+
+// Linux value, hidden by the POSIX feature level the tree is built with
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT 15
+#endif
 
 // Global variables for server management
-static int g_server_socket = -1;
-static volatile bool g_server_running = true;
+static bool g_server_running = true; // Cleared by a shutdown signal (atomic)
+static int g_shutdown_signal = 0;    // The signal that cleared it (atomic)
 static int g_active_connections = 0;
 static pthread_mutex_t g_connection_mutex = PTHREAD_MUTEX_INITIALIZER;
 static PubSubManager *g_pubsub_manager = NULL;
+static IoBackend g_io_backend = IO_BACKEND_EPOLL;
 
 // Maximum connections and buffer sizes
-#define MAX_CONNECTIONS 100
+#define MAX_CONNECTIONS 65536
 #define INITIAL_BUFFER_SIZE 4096
 #define MAX_BUFFER_SIZE (1024 * 1024) // 1MB max command size
 #define MAX_COMMAND_SIZE (512 * 1024) // 512KB max single command
 
-// Dynamic buffer structure
+// Event loop: events handled per epoll_wait, bytes read per recv, and file
+// descriptors kept for other uses when sizing the client table
+#define EVENT_BATCH_SIZE 256
+#define READ_CHUNK_SIZE (16 * 1024)
+#define RESERVED_FDS 64
+
+// Queued reply bytes written without waiting for the end of the batch
+#define REPLY_EAGER_WRITE_SIZE (64 * 1024)
+
+// Queued replies: size of the blocks small replies are gathered in, and
+// blocks written per system call
+#define REPLY_BLOCK_SIZE (16 * 1024)
+#define REPLY_IOV_COUNT 16
+
+// Replies written straight from the values they reference, when nothing is
+// queued ahead of them, from this many bytes
+#define REPLY_DIRECT_SIZE (64 * 1024)
+
+// Queued reply bytes past which a client is closed, so one that does not
+// read its replies, or a slow subscriber, cannot grow them without bound
+#define REPLY_MAX_PENDING (256 * 1024 * 1024)
+
+// io_uring backend: submission queue entries per loop, and the receive
+// buffers of READ_CHUNK_SIZE bytes each loop provides to the kernel
+#define URING_ENTRIES 4096
+#define URING_BUFFER_COUNT 512
+#define URING_BUFFER_GROUP 0
+
+// io_uring requests are told apart by the low bits of their user data, the
+// rest being the client they are for, if any
+#define URING_OP_ACCEPT 0
+#define URING_OP_RECV 1
+#define URING_OP_SEND 2
+#define URING_OP_WAKE 3
+#define URING_OP_MASK 3
+
+// Background maintenance: cycles per second, and the share of each period
+// (in percent) the active expire cycle may hold shard locks for
+#define SERVER_CRON_HZ 10
+#define ACTIVE_EXPIRE_CYCLE_PERCENT 25
+
+// Dynamic buffer structure, counted as MEM_CLIENT_BUFFERS. An empty
+// buffer may have no storage; it is allocated on the first append.
 typedef struct
 {
     char *data;
     size_t size;
     size_t capacity;
+    size_t max_capacity; // Appends that would grow past this fail
 } DynamicBuffer;
 
-// Initialize dynamic buffer
-static bool buffer_init(DynamicBuffer *buf, size_t initial_capacity)
+// Initialize an empty dynamic buffer without storage
+static void buffer_init(DynamicBuffer *buf, size_t max_capacity)
 {
-    buf->data = malloc(initial_capacity);
-    if (!buf->data)
-        return false;
-
+    buf->data = NULL;
     buf->size = 0;
-    buf->capacity = initial_capacity;
-    buf->data[0] = '\0';
-    return true;
+    buf->capacity = 0;
+    buf->max_capacity = max_capacity;
 }
 
 // Append data to dynamic buffer
@@ -57,17 +112,17 @@ static bool buffer_append(DynamicBuffer *buf, const char *data, size_t len)
     if (buf->size + len + 1 > buf->capacity)
     {
         // Need to resize
-        size_t new_capacity = buf->capacity * 2;
+        size_t new_capacity = buf->capacity ? buf->capacity * 2 : INITIAL_BUFFER_SIZE;
         while (new_capacity < buf->size + len + 1)
             new_capacity *= 2;
 
-        if (new_capacity > MAX_BUFFER_SIZE)
+        if (new_capacity > buf->max_capacity)
         {
             fprintf(stderr, "Buffer size limit exceeded\n");
             return false;
         }
 
-        char *new_data = realloc(buf->data, new_capacity);
+        char *new_data = mem_realloc(MEM_CLIENT_BUFFERS, buf->data, new_capacity);
         if (!new_data)
         {
             fprintf(stderr, "Failed to reallocate buffer\n");
@@ -102,117 +157,711 @@ static void buffer_consume(DynamicBuffer *buf, size_t len)
 // Free dynamic buffer
 static void buffer_free(DynamicBuffer *buf)
 {
-    free(buf->data);
+    mem_free(buf->data);
     buf->data = NULL;
     buf->size = 0;
     buf->capacity = 0;
 }
 
-// Thread argument structure
+// Queued output of a client, written with one sendmsg over all of its
+// blocks. A reply is copied whole into the last block if it has room, else
+// into a new block of REPLY_BLOCK_SIZE bytes, or of the reply's own size for
+// a large value, which so takes a single copy and is written from an iovec
+// of its own. Large replies only get here for what the socket did not take
+// when written from where they are (see client_queue_reply): values are not
+// reference counted, and the shard lock that keeps them in place is not
+// held until the socket is writable. Blocks never move while queued and are
+// freed once written.
+typedef struct ReplyBlock
+{
+    struct ReplyBlock *next;
+    size_t size;
+    size_t capacity;
+    char data[];
+} ReplyBlock;
+
 typedef struct
 {
-    int client_socket;
+    ReplyBlock *head;
+    ReplyBlock *tail;
+    size_t head_sent; // Bytes of the head block already written
+    size_t pending;   // Bytes queued and not written yet
+} ReplyList;
+
+static void reply_list_init(ReplyList *list)
+{
+    list->head = NULL;
+    list->tail = NULL;
+    list->head_sent = 0;
+    list->pending = 0;
+}
+
+// Bytes of a reply made of count parts
+static size_t iov_length(const struct iovec *parts, int count)
+{
+    size_t len = 0;
+    for (int i = 0; i < count; i++)
+        len += parts[i].iov_len;
+    return len;
+}
+
+// Queue a reply made of count parts, but for its first skip bytes, already
+// written; false, with nothing queued, if out of memory
+static bool reply_list_append(ReplyList *list, const struct iovec *parts, int count, size_t skip)
+{
+    size_t len = iov_length(parts, count);
+    if (len <= skip)
+        return true;
+    len -= skip;
+
+    ReplyBlock *block = list->tail;
+    if (!block || block->capacity - block->size < len)
+    {
+        size_t capacity = len > REPLY_BLOCK_SIZE ? len : REPLY_BLOCK_SIZE;
+        block = (ReplyBlock *)mem_alloc(MEM_CLIENT_BUFFERS, offsetof(ReplyBlock, data) + capacity);
+        if (!block)
+            return false;
+
+        block->next = NULL;
+        block->size = 0;
+        block->capacity = capacity;
+        if (list->tail)
+            list->tail->next = block;
+        else
+            list->head = block;
+        list->tail = block;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (skip >= parts[i].iov_len)
+        {
+            skip -= parts[i].iov_len;
+            continue;
+        }
+        memcpy(block->data + block->size, (const char *)parts[i].iov_base + skip, parts[i].iov_len - skip);
+        block->size += parts[i].iov_len - skip;
+        skip = 0;
+    }
+    list->pending += len;
+    return true;
+}
+
+// Point up to max iovecs at the bytes not written yet; returns how many
+static int reply_list_iov(const ReplyList *list, struct iovec *iov, int max)
+{
+    int count = 0;
+    size_t offset = list->head_sent;
+    for (ReplyBlock *block = list->head; block && count < max; block = block->next)
+    {
+        if (block->size > offset)
+        {
+            iov[count].iov_base = block->data + offset;
+            iov[count].iov_len = block->size - offset;
+            count++;
+        }
+        offset = 0;
+    }
+    return count;
+}
+
+// Drop len written bytes, freeing the blocks they complete
+static void reply_list_consume(ReplyList *list, size_t len)
+{
+    list->pending -= len;
+    while (len > 0)
+    {
+        ReplyBlock *block = list->head;
+        size_t left = block->size - list->head_sent;
+        if (len < left)
+        {
+            list->head_sent += len;
+            return;
+        }
+
+        len -= left;
+        list->head = block->next;
+        list->head_sent = 0;
+        if (!list->head)
+            list->tail = NULL;
+        mem_free(block);
+    }
+}
+
+static void reply_list_free(ReplyList *list)
+{
+    while (list->head)
+    {
+        ReplyBlock *block = list->head;
+        list->head = block->next;
+        mem_free(block);
+    }
+    reply_list_init(list);
+}
+
+typedef struct EventLoop EventLoop;
+
+// A connected client, owned by one event loop. Replies are queued in its
+// reply buffer and written when the socket is writable.
+typedef struct Client
+{
+    int socket;
+    struct sockaddr_in addr;
+    EventLoop *loop;      // Loop owning the client
+    DynamicBuffer query;  // Received bytes not parsed into commands yet
+    pthread_mutex_t reply_lock; // Guards the reply, which other loops add pub/sub messages to
+    ReplyList reply;      // Queued replies
+    bool close_requested; // A reply was lost; closed by its loop (atomic)
+    bool pending_write;   // In the loop's pending write list
+    struct Client *pending_prev;
+    struct Client *pending_next;
+
+    // io_uring loops only
+    struct msghdr send_msg; // Send in flight, over the first queued blocks
+    struct iovec send_iov[REPLY_IOV_COUNT];
+    bool sending;
+    unsigned pending_ops;   // Requests in flight for the client
+    bool closing;           // Closed, freed once its requests are done
+    bool remote_pending;    // In the loop's remote write list
+    struct Client *remote_next;
+} Client;
+
+// An event loop thread: its own SO_REUSEPORT listening socket, among which
+// the kernel spreads new connections, its own epoll instance, and the
+// clients accepted on that socket, served by this thread only. Writing to
+// its eventfd wakes it, to stop or to pick up remote writes.
+struct EventLoop
+{
+    int index;
+    pthread_t thread;
+    int epoll_fd;
+    int listen_socket;
+    int wake_fd;
     Database *db;
-    PubSubManager *pubsub;
-    struct sockaddr_in client_addr;
-} ThreadArgs;
+    Client *pending_writes;    // Clients with replies queued since their last write
+    size_t connections;        // Clients connected (atomic)
+    size_t commands_processed; // Commands run for its clients (atomic)
+
+    // With io_uring, sockets are served through the ring instead of epoll.
+    // Other threads queuing replies to its clients put them in the remote
+    // write list and signal the eventfd the loop keeps a read pending on.
+    bool uring; // (atomic)
+    Uring ring;
+    UringBufRing buffers;
+    uint64_t wake_value;
+    pthread_mutex_t remote_lock;
+    Client *remote_writes;
+};
+
+// Event loops, and the loop of the calling thread (NULL outside of them)
+static EventLoop *g_loops = NULL;
+static int g_loop_count = 0;
+static __thread EventLoop *t_loop = NULL;
+
+// Clients by socket. Each slot is only written by the loop owning the
+// socket, but a closed socket's number may be reused by another loop's
+// next connection, so slots are accessed atomically. Other loops look
+// subscribers up under the pub/sub mutex, which a client leaves before it
+// is freed.
+static Client **g_clients = NULL;
+static int g_client_slots = 0;
+
+static bool server_running(void)
+{
+    return __atomic_load_n(&g_server_running, __ATOMIC_RELAXED);
+}
+
+// Wake every event loop through its eventfd, so it sees the server stopping.
+// Safe in a signal handler.
+static void server_wake_loops(void)
+{
+    int saved_errno = errno;
+    uint64_t one = 1;
+    int count = __atomic_load_n(&g_loop_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++)
+    {
+        ssize_t written = write(g_loops[i].wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+    errno = saved_errno;
+}
 
-// Signal handler for graceful shutdown
+// Signal handler for graceful shutdown. It only stops and wakes the event
+// loops; start_server tears the server down once they have all returned.
 void handle_signal(int signal)
 {
-    printf("\nReceived signal %d. Shutting down server...\n", signal);
-    g_server_running = false;
+    __atomic_store_n(&g_shutdown_signal, signal, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_server_running, false, __ATOMIC_RELAXED);
+    server_wake_loops();
+}
+
+static bool set_nonblocking(int socket)
+{
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+}
 
-    if (g_server_socket >= 0)
+// Size the client table from the file descriptor limit, raised to its hard
+// maximum so tens of thousands of clients can connect
+static bool client_table_init(void)
+{
+    struct rlimit limit = {RLIM_INFINITY, RLIM_INFINITY};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
     {
-        close(g_server_socket);
-        g_server_socket = -1;
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0)
+            perror("Failed to raise the open file limit");
+        getrlimit(RLIMIT_NOFILE, &limit);
     }
 
-    if (g_pubsub_manager)
+    rlim_t slots = MAX_CONNECTIONS + RESERVED_FDS;
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < slots)
+        slots = limit.rlim_cur;
+
+    g_clients = (Client **)calloc((size_t)slots, sizeof(Client *));
+    if (!g_clients)
+        return false;
+    g_client_slots = (int)slots;
+    return true;
+}
+
+static void run_event_loop(EventLoop *loop);
+
+static Client *client_lookup(int socket)
+{
+    if (socket < 0 || socket >= g_client_slots)
+        return NULL;
+    return __atomic_load_n(&g_clients[socket], __ATOMIC_ACQUIRE);
+}
+
+static void client_unlink_pending(Client *client)
+{
+    if (!client->pending_write)
+        return;
+
+    EventLoop *loop = client->loop;
+    if (client->pending_prev)
+        client->pending_prev->pending_next = client->pending_next;
+    else
+        loop->pending_writes = client->pending_next;
+    if (client->pending_next)
+        client->pending_next->pending_prev = client->pending_prev;
+    client->pending_write = false;
+}
+
+// Write queued replies until they are all sent or the socket is full, in
+// which case the rest waits for the socket to become writable (caller
+// holds the reply lock). False if the connection failed.
+static bool client_write_locked(Client *client)
+{
+    while (client->reply.pending > 0)
     {
-        pubsub_free(g_pubsub_manager);
-        g_pubsub_manager = NULL;
+        struct iovec iov[REPLY_IOV_COUNT];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)reply_list_iov(&client->reply, iov, REPLY_IOV_COUNT);
+
+        ssize_t result = sendmsg(client->socket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            if (errno != EPIPE && errno != ECONNRESET)
+                perror("Error sending response");
+            return false;
+        }
+        // Idle clients hold no buffers
+        reply_list_consume(&client->reply, (size_t)result);
+    }
+    return true;
+}
+
+static bool client_write(Client *client)
+{
+    pthread_mutex_lock(&client->reply_lock);
+    bool written = client_write_locked(client);
+    pthread_mutex_unlock(&client->reply_lock);
+    return written;
+}
+
+static void client_link_pending(Client *client)
+{
+    if (client->pending_write)
+        return;
+
+    EventLoop *loop = client->loop;
+    client->pending_write = true;
+    client->pending_prev = NULL;
+    client->pending_next = loop->pending_writes;
+    if (loop->pending_writes)
+        loop->pending_writes->pending_prev = client;
+    loop->pending_writes = client;
+}
+
+// Hand a client another thread queued replies for to its io_uring loop,
+// waking the loop if its remote write list was empty
+static void client_post_remote(Client *client)
+{
+    EventLoop *loop = client->loop;
+    pthread_mutex_lock(&loop->remote_lock);
+    bool wake = !loop->remote_writes;
+    if (!client->remote_pending)
+    {
+        client->remote_pending = true;
+        client->remote_next = loop->remote_writes;
+        loop->remote_writes = client;
+    }
+    pthread_mutex_unlock(&loop->remote_lock);
+
+    uint64_t one = 1;
+    if (wake && write(loop->wake_fd, &one, sizeof(one)) < 0)
+        perror("Failed to wake event loop");
+}
+
+static void client_unlink_remote(Client *client)
+{
+    EventLoop *loop = client->loop;
+    pthread_mutex_lock(&loop->remote_lock);
+    if (client->remote_pending)
+    {
+        Client **link = &loop->remote_writes;
+        while (*link != client)
+            link = &(*link)->remote_next;
+        *link = client->remote_next;
+        client->remote_pending = false;
+    }
+    pthread_mutex_unlock(&loop->remote_lock);
+}
+
+// Give up on a client whose replies can no longer be queued: after a lost
+// one, every later reply would answer the wrong command (caller holds the
+// reply lock). Later
+// replies are dropped, and shutting the socket down makes the owning loop
+// see a hang-up and close the client.
+static void client_fail_locked(Client *client, const char *reason)
+{
+    if (client->close_requested)
+        return;
+
+    log_warning("Closing client %s:%d: %s",
+           inet_ntoa(client->addr.sin_addr),
+           ntohs(client->addr.sin_port), reason);
+    __atomic_store_n(&client->close_requested, true, __ATOMIC_RELAXED);
+    shutdown(client->socket, SHUT_RDWR);
+}
+
+// Whether the calling thread may write to the client's socket now (caller
+// holds the reply lock): any thread for an epoll loop's client, only its
+// own loop with no send in flight for an io_uring one
+static bool client_can_write(const Client *client)
+{
+    return !client->loop->uring || (client->loop == t_loop && !client->sending);
+}
+
+// Write as much of a reply as the socket takes at once, straight from the
+// memory its parts point to (caller holds the reply lock, nothing queued).
+// Returns the bytes written; failures are left to the owner to notice.
+static size_t client_write_direct(Client *client, const struct iovec *parts, int count)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)parts;
+    msg.msg_iovlen = (size_t)count;
+
+    ssize_t result;
+    do
+        result = sendmsg(client->socket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    while (result < 0 && errno == EINTR);
+    return result > 0 ? (size_t)result : 0;
+}
+
+// Queue reply bytes (caller holds the reply lock). The owning loop writes
+// them after its current batch of events, or as they grow for large
+// replies, so fast readers never hold them whole. Messages published from
+// another loop are written at once, what the socket does not take being
+// left to the owner's next writable event. A failed write is noticed again,
+// and the client closed, by the owner. An io_uring loop does all of its
+// clients' writes itself, so other threads only queue and wake it. A large
+// reply is first written from the values it references, once what is
+// queued ahead of it is written, so only what the socket does not take is
+// copied. A client whose reply cannot be queued, or whose queued replies
+// grow past REPLY_MAX_PENDING, is closed.
+static void client_queue_locked(Client *client, const struct iovec *parts, int count)
+{
+    if (client->close_requested)
+        return;
+
+    size_t written = 0;
+    if (iov_length(parts, count) >= REPLY_DIRECT_SIZE && client_can_write(client))
+    {
+        if (client->reply.pending > 0)
+            client_write_locked(client);
+        if (client->reply.pending == 0)
+            written = client_write_direct(client, parts, count);
+    }
+
+    if (!reply_list_append(&client->reply, parts, count, written))
+    {
+        client_fail_locked(client, "out of memory for its replies");
+        return;
     }
 
-    // Give some time for connections to close
-    sleep(1);
-    exit(0);
+    EventLoop *loop = client->loop;
+    if (!loop->uring && (loop != t_loop || client->reply.pending >= REPLY_EAGER_WRITE_SIZE))
+        client_write_locked(client);
+    if (client->reply.pending > REPLY_MAX_PENDING)
+        client_fail_locked(client, "queued replies over the output limit");
 }
 
-// Thread function to handle client connections
-void *client_handler(void *arg)
+// Have the owning loop write what was queued for the client
+static void client_reply_queued(Client *client)
 {
-    ThreadArgs *args = (ThreadArgs *)arg;
-    int client_socket = args->client_socket;
-    Database *db = args->db;
-    // PubSubManager *pubsub = args->pubsub;
-    struct sockaddr_in client_addr = args->client_addr;
+    EventLoop *loop = client->loop;
+    if (loop == t_loop)
+        client_link_pending(client);
+    else if (loop->uring)
+        client_post_remote(client);
+}
 
-    printf("Thread started for client %s:%d\n",
-           inet_ntoa(client_addr.sin_addr),
-           ntohs(client_addr.sin_port));
+static void client_queue_reply(Client *client, const struct iovec *parts, int count)
+{
+    pthread_mutex_lock(&client->reply_lock);
+    client_queue_locked(client, parts, count);
+    pthread_mutex_unlock(&client->reply_lock);
+    client_reply_queued(client);
+}
 
-    // Increment connection counter
+static void client_free(Client *client)
+{
+    EventLoop *loop = client->loop;
+    __atomic_store_n(&g_clients[client->socket], NULL, __ATOMIC_RELEASE);
+    close(client->socket);
+    buffer_free(&client->query);
+    reply_list_free(&client->reply);
+    pthread_mutex_destroy(&client->reply_lock);
+    mem_free(client);
+
+    __atomic_sub_fetch(&loop->connections, 1, __ATOMIC_RELAXED);
     pthread_mutex_lock(&g_connection_mutex);
-    g_active_connections++;
+    g_active_connections--;
     pthread_mutex_unlock(&g_connection_mutex);
+}
 
-    // Handle client connection
-    handle_client(client_socket, db, g_pubsub_manager);
+static void client_close(Client *client)
+{
+    if (client->closing)
+        return;
+
+    log_verbose("Client %s:%d disconnected",
+           inet_ntoa(client->addr.sin_addr),
+           ntohs(client->addr.sin_port));
 
-    // Unsubscribe from all channels when client disconnects
+    // Unsubscribe from all channels when client disconnects; no other loop
+    // reaches the client afterwards
     if (g_pubsub_manager)
+        pubsub_unsubscribe_all(g_pubsub_manager, client->socket);
+
+    EventLoop *loop = client->loop;
+    client_unlink_pending(client);
+    if (!loop->uring)
     {
-        pubsub_unsubscribe_all(g_pubsub_manager, client_socket);
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, client->socket, NULL);
+        client_free(client);
+        return;
     }
 
-    // Cleanup
-    close(client_socket);
-    free(args);
+    // Requests in flight still refer to the client: shutting the socket
+    // down ends them, and the last one to complete frees it
+    client_unlink_remote(client);
+    client->closing = true;
+    shutdown(client->socket, SHUT_RDWR);
+    if (client->pending_ops == 0)
+        client_free(client);
+}
 
-    // Decrement connection counter
+// Take on a connection accepted by a loop. NULL, with the socket closed, if
+// the connection limit is reached or the client cannot be set up.
+static Client *client_create(EventLoop *loop, int client_socket, const struct sockaddr_in *client_addr)
+{
+    // Check connection limit
     pthread_mutex_lock(&g_connection_mutex);
-    g_active_connections--;
+    int current_connections = g_active_connections;
+    bool accepted = current_connections < MAX_CONNECTIONS && client_socket < g_client_slots;
+    if (accepted)
+        g_active_connections++;
     pthread_mutex_unlock(&g_connection_mutex);
 
-    printf("Client %s:%d disconnected\n",
-           inet_ntoa(client_addr.sin_addr),
-           ntohs(client_addr.sin_port));
+    if (!accepted)
+    {
+        log_warning("Connection limit reached, rejecting client %s:%d",
+               inet_ntoa(client_addr->sin_addr),
+               ntohs(client_addr->sin_port));
+
+        const char *error_msg = "-ERR Server busy, too many connections\r\n";
+        send(client_socket, error_msg, strlen(error_msg), MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(client_socket);
+        return NULL;
+    }
+
+    // io_uring waits for sockets itself; they stay blocking there
+    Client *client = (Client *)mem_alloc(MEM_CLIENT_BUFFERS, sizeof(Client));
+    if (!client || (!loop->uring && !set_nonblocking(client_socket)) ||
+        pthread_mutex_init(&client->reply_lock, NULL) != 0)
+    {
+        perror("Failed to set up client");
+        mem_free(client);
+        close(client_socket);
+        pthread_mutex_lock(&g_connection_mutex);
+        g_active_connections--;
+        pthread_mutex_unlock(&g_connection_mutex);
+        return NULL;
+    }
 
-    pthread_exit(NULL);
+    // Replies are written once per batch, so there is nothing to
+    // gain from delaying small segments
+    int opt = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    client->socket = client_socket;
+    client->addr = *client_addr;
+    client->loop = loop;
+    buffer_init(&client->query, MAX_BUFFER_SIZE);
+    reply_list_init(&client->reply);
+    client->close_requested = false;
+    client->pending_write = false;
+    client->pending_prev = NULL;
+    client->pending_next = NULL;
+    client->sending = false;
+    client->pending_ops = 0;
+    client->closing = false;
+    client->remote_pending = false;
+    client->remote_next = NULL;
+    __atomic_store_n(&g_clients[client_socket], client, __ATOMIC_RELEASE);
+
+    if (!loop->uring)
+    {
+        // Edge-triggered for both directions: reads drain the socket and
+        // writes stop at a full socket, each until the next readiness change
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = client;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0)
+        {
+            perror("Failed to watch client socket");
+            __atomic_store_n(&g_clients[client_socket], NULL, __ATOMIC_RELEASE);
+            pthread_mutex_destroy(&client->reply_lock);
+            mem_free(client);
+            close(client_socket);
+            pthread_mutex_lock(&g_connection_mutex);
+            g_active_connections--;
+            pthread_mutex_unlock(&g_connection_mutex);
+            return NULL;
+        }
+    }
+    __atomic_add_fetch(&loop->connections, 1, __ATOMIC_RELAXED);
+
+    log_verbose("New connection from %s:%d on thread %d (active: %d)",
+           inet_ntoa(client_addr->sin_addr),
+           ntohs(client_addr->sin_port),
+           loop->index, current_connections + 1);
+    return client;
 }
 
-// Function to start the TCP server
-bool start_server(Database *db, int port)
+// Accept every pending connection on a loop's non-blocking listening socket
+static void accept_clients(EventLoop *loop)
+{
+    for (;;)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+
+        int client_socket = accept(loop->listen_socket, (struct sockaddr *)&client_addr, &client_len);
+        if (client_socket < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("Failed to accept connection");
+            return;
+        }
+
+        client_create(loop, client_socket, &client_addr);
+    }
+}
+
+// Memory used by the database and the other tracked allocations, split by
+// category into bytes. Read from the process-wide counters, without locks.
+static size_t server_used_memory(size_t bytes[MEM_CATEGORY_COUNT])
+{
+    size_t total = 0;
+    for (int c = 0; c < MEM_CATEGORY_COUNT; c++)
+    {
+        bytes[c] = mem_allocated((MemCategory)c);
+        total += bytes[c];
+    }
+    return total;
+}
+
+// Background thread running periodic maintenance while the server is up
+static void *server_cron(void *arg)
+{
+    Database *db = (Database *)arg;
+    long period_us = 1000000L / SERVER_CRON_HZ;
+    long budget_us = period_us * ACTIVE_EXPIRE_CYCLE_PERCENT / 100;
+    struct timespec interval = {0, period_us * 1000L};
+
+    while (server_running())
+    {
+        db_active_expire_cycle(db, budget_us);
+
+        // Sample used memory for the peak reported by INFO
+        mem_update_peak(mem_used());
+
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+// Set up an event loop: its listening socket, bound to the port shared by
+// every loop through SO_REUSEPORT, and its epoll instance
+static bool event_loop_init(EventLoop *loop, int index, Database *db, int port)
 {
     struct sockaddr_in server_addr;
 
-    // Create socket
-    g_server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (g_server_socket < 0)
+    loop->index = index;
+    loop->db = db;
+    loop->pending_writes = NULL;
+    loop->connections = 0;
+    loop->commands_processed = 0;
+    loop->epoll_fd = -1;
+    loop->uring = false;
+    loop->wake_fd = -1;
+    loop->remote_writes = NULL;
+    if (pthread_mutex_init(&loop->remote_lock, NULL) != 0)
     {
-        perror("Failed to create socket");
+        perror("Failed to set up the event loop");
+        loop->listen_socket = -1;
         return false;
     }
 
-    // Create the global pubsub manager
-    g_pubsub_manager = pubsub_create();
-    if (!g_pubsub_manager)
+    // Create socket
+    loop->listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (loop->listen_socket < 0)
     {
-        fprintf(stderr, "Failed to create pub/sub manager\n");
-        close(g_server_socket);
+        perror("Failed to create socket");
         return false;
     }
 
-    // Set socket options to allow address reuse
+    // Set socket options to allow address reuse, and every loop to listen
+    // on the port
     int opt = 1;
-    if (setsockopt(g_server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    if (setsockopt(loop->listen_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(loop->listen_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
     {
         perror("Failed to set socket options");
-        close(g_server_socket);
-        pubsub_free(g_pubsub_manager);
-        g_pubsub_manager = NULL;
         return false;
     }
 
@@ -223,100 +872,200 @@ bool start_server(Database *db, int port)
     server_addr.sin_port = htons(port);
 
     // Bind the socket
-    if (bind(g_server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    if (bind(loop->listen_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
     {
         perror("Failed to bind socket");
-        printf("Make sure port %d is not already in use\n", port);
-        close(g_server_socket);
-        pubsub_free(g_pubsub_manager);
-        g_pubsub_manager = NULL;
+        log_warning("Make sure port %d is not already in use", port);
         return false;
     }
 
-    // Listen for connections
-    if (listen(g_server_socket, 10) < 0)
+    // Listen for connections, with a backlog deep enough for many clients
+    // reconnecting at once
+    if (listen(loop->listen_socket, SOMAXCONN) < 0)
     {
         perror("Failed to listen on socket");
-        close(g_server_socket);
-        pubsub_free(g_pubsub_manager);
-        g_pubsub_manager = NULL;
         return false;
     }
 
-    // Set up signal handler for graceful shutdown
-    signal(SIGINT, handle_signal);
-    signal(SIGTERM, handle_signal);
+    struct epoll_event listen_event;
+    listen_event.events = EPOLLIN | EPOLLET;
+    listen_event.data.ptr = NULL; // The listening socket has no client
+    struct epoll_event wake_event;
+    wake_event.events = EPOLLIN;
+    wake_event.data.ptr = loop; // Nor has the eventfd, told apart by the loop
+    loop->epoll_fd = epoll_create1(0);
+    loop->wake_fd = eventfd(0, 0);
+    if (loop->epoll_fd < 0 || loop->wake_fd < 0 || !set_nonblocking(loop->listen_socket) ||
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_socket, &listen_event) < 0 ||
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &wake_event) < 0)
+    {
+        perror("Failed to set up the event loop");
+        return false;
+    }
+    return true;
+}
 
-    printf("Server started on port %d (max connections: %d)\n", port, MAX_CONNECTIONS);
+static void event_loop_close(EventLoop *loop)
+{
+    if (__atomic_load_n(&loop->uring, __ATOMIC_ACQUIRE))
+    {
+        uring_buf_ring_free(&loop->ring, &loop->buffers);
+        uring_free(&loop->ring);
+        loop->uring = false;
+    }
+    if (loop->epoll_fd >= 0)
+        close(loop->epoll_fd);
+    if (loop->listen_socket >= 0)
+    {
+        // A multishot accept keeps the socket open until the kernel has
+        // torn the ring down, which may be after the process exits; shut
+        // down, it leaves the port's SO_REUSEPORT group at once, so a
+        // server restarted on the port gets every new connection
+        shutdown(loop->listen_socket, SHUT_RDWR);
+        close(loop->listen_socket);
+    }
+    if (loop->wake_fd >= 0)
+        close(loop->wake_fd);
+    loop->epoll_fd = -1;
+    loop->listen_socket = -1;
+    loop->wake_fd = -1;
+}
+
+static void run_uring_loop(EventLoop *loop);
 
-    // Accept and handle client connections
-    while (g_server_running)
+// Switch a loop over to io_uring: its ring and the receive buffers it
+// provides. Done by the loop's own thread, the only one allowed to submit
+// to the ring. False if the kernel lacks any of it.
+static bool event_loop_init_uring(EventLoop *loop)
+{
+    if (!uring_init(&loop->ring, URING_ENTRIES))
+        return false;
+    if (!uring_buf_ring_init(&loop->ring, &loop->buffers, URING_BUFFER_GROUP, URING_BUFFER_COUNT, READ_CHUNK_SIZE))
     {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
+        uring_free(&loop->ring);
+        return false;
+    }
 
-        int client_socket = accept(g_server_socket, (struct sockaddr *)&client_addr, &client_len);
+    close(loop->epoll_fd);
+    loop->epoll_fd = -1;
+    __atomic_store_n(&loop->uring, true, __ATOMIC_RELEASE);
+    return true;
+}
 
-        if (client_socket < 0)
+// Serve a loop with the configured backend, epoll if io_uring is missing
+static void event_loop_run(EventLoop *loop)
+{
+    if (g_io_backend == IO_BACKEND_URING)
+    {
+        if (event_loop_init_uring(loop))
         {
-            if (errno == EINTR && !g_server_running)
-                break; // Server shutdown
-
-            perror("Failed to accept connection");
-            continue;
+            run_uring_loop(loop);
+            return;
         }
+        fprintf(stderr, "io_uring is not available on thread %d (%s), using epoll\n",
+                loop->index, strerror(errno));
+    }
+    run_event_loop(loop);
+}
 
-        // Check connection limit
-        pthread_mutex_lock(&g_connection_mutex);
-        int current_connections = g_active_connections;
-        pthread_mutex_unlock(&g_connection_mutex);
+static void *event_loop_thread(void *arg)
+{
+    event_loop_run((EventLoop *)arg);
+    return NULL;
+}
 
-        if (current_connections >= MAX_CONNECTIONS)
-        {
-            printf("Connection limit reached, rejecting client %s:%d\n",
-                   inet_ntoa(client_addr.sin_addr),
-                   ntohs(client_addr.sin_port));
+// Function to start the TCP server
+bool start_server(Database *db, int port, int io_threads, IoBackend backend)
+{
+    g_io_backend = backend;
 
-            const char *error_msg = "-ERR Server busy, too many connections\r\n";
-            send(client_socket, error_msg, strlen(error_msg), 0);
-            close(client_socket);
-            continue;
-        }
+    // Create the global pubsub manager
+    g_pubsub_manager = pubsub_create();
+    if (!g_pubsub_manager)
+    {
+        fprintf(stderr, "Failed to create pub/sub manager\n");
+        return false;
+    }
 
-        printf("New connection from %s:%d (active: %d)\n",
-               inet_ntoa(client_addr.sin_addr),
-               ntohs(client_addr.sin_port),
-               current_connections + 1);
+    // Published messages are queued like replies
+    g_pubsub_manager->deliver = send_response_len;
 
-        // Create thread arguments
-        ThreadArgs *thread_args = malloc(sizeof(ThreadArgs));
-        if (!thread_args)
-        {
-            perror("Failed to allocate thread arguments");
-            close(client_socket);
-            continue;
+    g_loops = (EventLoop *)calloc((size_t)io_threads, sizeof(EventLoop));
+    if (!g_loops || !client_table_init())
+    {
+        fprintf(stderr, "Failed to allocate the event loops\n");
+        free(g_loops);
+        g_loops = NULL;
+        pubsub_free(g_pubsub_manager);
+        g_pubsub_manager = NULL;
+        return false;
+    }
+
+    for (int i = 0; i < io_threads; i++)
+    {
+        if (!event_loop_init(&g_loops[i], i, db, port))
+        {
+            for (int j = 0; j <= i; j++)
+                event_loop_close(&g_loops[j]);
+            free(g_loops);
+            g_loops = NULL;
+            pubsub_free(g_pubsub_manager);
+            g_pubsub_manager = NULL;
+            return false;
         }
+    }
+    __atomic_store_n(&g_loop_count, io_threads, __ATOMIC_RELEASE);
 
-        thread_args->client_socket = client_socket;
-        thread_args->db = db;
-        thread_args->pubsub = g_pubsub_manager;
-        thread_args->client_addr = client_addr;
+    // Set up signal handler for graceful shutdown
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    // Start background maintenance
+    pthread_t cron_thread;
+    bool cron_started = pthread_create(&cron_thread, NULL, server_cron, db) == 0;
+    bool started = cron_started;
+    if (!cron_started)
+        perror("Failed to create cron thread");
 
-        // Create thread to handle client
-        pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, client_handler, thread_args) != 0)
+    // The first loop runs in the calling thread
+    int loops_started = 1;
+    while (started && loops_started < io_threads)
+    {
+        EventLoop *loop = &g_loops[loops_started];
+        if (pthread_create(&loop->thread, NULL, event_loop_thread, loop) != 0)
         {
-            perror("Failed to create thread");
-            close(client_socket);
-            free(thread_args);
-            continue;
+            perror("Failed to create I/O thread");
+            started = false;
+            break;
         }
+        loops_started++;
+    }
 
-        // Detach thread to avoid memory leaks
-        pthread_detach(thread_id);
+    if (started)
+    {
+        log_notice("Server started on port %d with %d I/O threads (max connections: %d)",
+               port, io_threads, MAX_CONNECTIONS);
+        event_loop_run(&g_loops[0]);
     }
 
-    printf("Server shutting down...\n");
+    // Stop the other threads, whether a signal or a failure ended the
+    // first loop, and only then release what they use
+    __atomic_store_n(&g_server_running, false, __ATOMIC_RELAXED);
+    server_wake_loops();
+    for (int i = 1; i < loops_started; i++)
+        pthread_join(g_loops[i].thread, NULL);
+    if (cron_started)
+        pthread_join(cron_thread, NULL);
+
+    int shutdown_signal = __atomic_load_n(&g_shutdown_signal, __ATOMIC_RELAXED);
+    if (shutdown_signal != 0)
+        log_notice("Received signal %d. Shutting down server...", shutdown_signal);
+    else
+        log_notice("Server shutting down...");
+
+    __atomic_store_n(&g_loop_count, 0, __ATOMIC_RELEASE);
+    for (int i = 0; i < io_threads; i++)
+        event_loop_close(&g_loops[i]);
 
     // Clean up pubsub manager
     if (g_pubsub_manager)
@@ -325,136 +1074,531 @@ bool start_server(Database *db, int port)
         g_pubsub_manager = NULL;
     }
 
+    log_flush();
+    return started;
+}
+
+// Run every complete command in a client's query buffer. False if the
+// client sent something it must be disconnected for.
+static bool client_process_commands(Client *client, Database *db, PubSubManager *pubsub)
+{
+    DynamicBuffer *command_buffer = &client->query;
+    while (command_buffer->size > 0)
+    {
+        size_t command_len = 0;
+        char *complete_cmd = find_complete_resp_command(
+            command_buffer->data, command_buffer->size, &command_len);
+
+        if (!complete_cmd || command_len == 0)
+        {
+            // No complete command found, wait for more data
+            log_debug("No complete command found, waiting for more data");
+            break;
+        }
+
+        log_debug("Found complete command of length %zu", command_len);
+
+        // Check command size limit
+        if (command_len > MAX_COMMAND_SIZE)
+        {
+            send_response_debug(client->socket, "-ERR Command too large\r\n");
+            buffer_consume(command_buffer, command_len);
+            continue;
+        }
+
+        // Create a copy of the command for processing
+        char *cmd_copy = mem_alloc(MEM_CLIENT_BUFFERS, command_len + 1);
+        if (!cmd_copy)
+        {
+            fprintf(stderr, "Memory allocation failed\n");
+            send_response_debug(client->socket, "-ERR Out of memory\r\n");
+            return false;
+        }
+
+        memcpy(cmd_copy, complete_cmd, command_len);
+        cmd_copy[command_len] = '\0';
+
+        if (log_enabled(LOG_LEVEL_DEBUG))
+        {
+            char escaped[256];
+            log_escape(escaped, sizeof(escaped), cmd_copy, command_len < 50 ? command_len : 50);
+            log_debug("Processing command: '%s%s'", escaped, (command_len > 50) ? "..." : "");
+        }
+
+        // Process the complete command
+        process_client_command(client->socket, db, pubsub, cmd_copy, command_len);
+        mem_free(cmd_copy);
+        __atomic_add_fetch(&client->loop->commands_processed, 1, __ATOMIC_RELAXED);
+
+        // Replies of later commands would no longer match them
+        if (__atomic_load_n(&client->close_requested, __ATOMIC_RELAXED))
+            return false;
+
+        // Remove the processed command from the buffer
+        buffer_consume(command_buffer, command_len);
+    }
     return true;
 }
 
-// Function to handle client connection with proper buffer management
-void handle_client(int client_socket, Database *db, PubSubManager *pubsub)
+// Add received bytes to a client's query buffer and run the commands they
+// complete. False if the client must be disconnected.
+static bool client_received(Client *client, Database *db, PubSubManager *pubsub,
+                            const char *data, size_t len)
 {
-    DynamicBuffer command_buffer;
-    char recv_buffer[4096];
-    ssize_t bytes_read;
+    log_debug("Received %zu bytes", len);
 
-    printf("DEBUG: Starting handle_client\n");
+    // Commands of one batch share a clock reading
+    clock_refresh_ms();
 
-    // Initialize dynamic buffer
-    if (!buffer_init(&command_buffer, INITIAL_BUFFER_SIZE))
+    // Append to command buffer
+    if (!buffer_append(&client->query, data, len))
     {
-        fprintf(stderr, "Failed to initialize command buffer\n");
-        return;
+        send_response_debug(client->socket, "-ERR Command too large\r\n");
+        return false;
     }
 
-    while (g_server_running)
-    {
-        // Receive data
-        bytes_read = recv(client_socket, recv_buffer, sizeof(recv_buffer), 0);
+    log_debug("Buffer now contains %zu bytes", client->query.size);
+
+    if (!client_process_commands(client, db, pubsub))
+        return false;
 
+    // Idle clients hold no buffers
+    if (client->query.size == 0)
+        buffer_free(&client->query);
+    return true;
+}
+
+// Read everything the client sent until the socket is drained, running
+// commands as they complete. False if the client is gone or must be
+// disconnected.
+static bool client_read(Client *client, Database *db, PubSubManager *pubsub)
+{
+    char recv_buffer[READ_CHUNK_SIZE];
+    for (;;)
+    {
+        ssize_t bytes_read = recv(client->socket, recv_buffer, sizeof(recv_buffer), 0);
+        if (bytes_read < 0 && errno == EINTR)
+            continue;
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
         if (bytes_read <= 0)
         {
             if (bytes_read == 0)
-            {
-                printf("Client disconnected gracefully\n");
-            }
-            else if (errno != EINTR)
-            {
+                log_verbose("Client disconnected gracefully");
+            else
                 perror("Error receiving data");
-            }
-            break;
+            return false;
         }
 
-        printf("DEBUG: Received %zd bytes\n", bytes_read);
+        if (!client_received(client, db, pubsub, recv_buffer, (size_t)bytes_read))
+            return false;
+    }
+    return true;
+}
 
-        // Append to command buffer
-        if (!buffer_append(&command_buffer, recv_buffer, bytes_read))
+// Wait for socket readiness and serve it: accept new clients, read and run
+// commands, then write the replies queued by the whole batch of events
+static void run_event_loop(EventLoop *loop)
+{
+    t_loop = loop;
+
+    struct epoll_event events[EVENT_BATCH_SIZE];
+    while (server_running())
+    {
+        int event_count = epoll_wait(loop->epoll_fd, events, EVENT_BATCH_SIZE, -1);
+        if (event_count < 0)
         {
-            send_response_debug(client_socket, "-ERR Command too large\r\n");
+            if (errno == EINTR)
+                continue;
+            perror("Failed to wait for events");
             break;
         }
 
-        printf("DEBUG: Buffer now contains %zu bytes\n", command_buffer.size);
-
-        // Process all complete commands in the buffer
-        while (command_buffer.size > 0)
+        for (int i = 0; i < event_count; i++)
         {
-            size_t command_len = 0;
-            char *complete_cmd = find_complete_resp_command(
-                command_buffer.data, command_buffer.size, &command_len);
-
-            if (!complete_cmd || command_len == 0)
+            if (events[i].data.ptr == loop)
             {
-                // No complete command found, wait for more data
-                printf("DEBUG: No complete command found, waiting for more data\n");
-                break;
+                // Woken to stop; the flag is checked after the batch
+                uint64_t value;
+                if (read(loop->wake_fd, &value, sizeof(value)) < 0)
+                    perror("Failed to read event loop wakeup");
+                continue;
             }
 
-            printf("DEBUG: Found complete command of length %zu\n", command_len);
-
-            // Check command size limit
-            if (command_len > MAX_COMMAND_SIZE)
+            Client *client = (Client *)events[i].data.ptr;
+            if (!client)
             {
-                send_response_debug(client_socket, "-ERR Command too large\r\n");
-                buffer_consume(&command_buffer, command_len);
+                accept_clients(loop);
                 continue;
             }
 
-            // Create a copy of the command for processing
-            char *cmd_copy = malloc(command_len + 1);
-            if (!cmd_copy)
+            // Errors and hang-ups are found by reading
+            if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) &&
+                !client_read(client, loop->db, g_pubsub_manager))
             {
-                fprintf(stderr, "Memory allocation failed\n");
-                send_response_debug(client_socket, "-ERR Out of memory\r\n");
-                break;
+                // Send what was queued before the failure, if possible
+                client_write(client);
+                client_close(client);
+                continue;
             }
 
-            memcpy(cmd_copy, complete_cmd, command_len);
-            cmd_copy[command_len] = '\0';
+            if ((events[i].events & EPOLLOUT) && !client_write(client))
+                client_close(client);
+        }
+
+        while (loop->pending_writes)
+        {
+            Client *client = loop->pending_writes;
+            client_unlink_pending(client);
+            if (!client_write(client))
+                client_close(client);
+        }
+    }
+}
+
+static uint64_t uring_user_data(Client *client, unsigned op)
+{
+    return (uint64_t)(uintptr_t)client | op;
+}
 
-            printf("DEBUG: Processing command: '%.50s%s'\n", cmd_copy,
-                   (command_len > 50) ? "..." : "");
+// A submission entry, handing the prepared ones to the kernel first if the
+// queue is full. NULL if even that leaves no room.
+static struct io_uring_sqe *loop_get_sqe(EventLoop *loop)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (!sqe)
+    {
+        uring_submit(&loop->ring, 0);
+        sqe = uring_get_sqe(&loop->ring);
+        if (!sqe)
+            fprintf(stderr, "io_uring submission queue full on thread %d\n", loop->index);
+    }
+    return sqe;
+}
 
-            // Process the complete command
-            process_client_command(client_socket, db, pubsub, cmd_copy);
-            free(cmd_copy);
+// Multishot accept: one request completes once per new connection
+static bool uring_arm_accept(EventLoop *loop)
+{
+    struct io_uring_sqe *sqe = loop_get_sqe(loop);
+    if (!sqe)
+        return false;
 
-            // Remove the processed command from the buffer
-            buffer_consume(&command_buffer, command_len);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->listen_socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = uring_user_data(NULL, URING_OP_ACCEPT);
+    return true;
+}
+
+// Multishot receive: completes whenever data arrives, in a buffer the
+// kernel picks from the loop's group
+static bool uring_arm_recv(EventLoop *loop, Client *client)
+{
+    struct io_uring_sqe *sqe = loop_get_sqe(loop);
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client->socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = loop->buffers.group;
+    sqe->user_data = uring_user_data(client, URING_OP_RECV);
+    client->pending_ops++;
+    return true;
+}
+
+static bool uring_arm_wake(EventLoop *loop)
+{
+    struct io_uring_sqe *sqe = loop_get_sqe(loop);
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = loop->wake_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&loop->wake_value;
+    sqe->len = sizeof(loop->wake_value);
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = uring_user_data(NULL, URING_OP_WAKE);
+    return true;
+}
+
+// Start sending the client's queued replies, unless a send is in flight:
+// one sendmsg over as many blocks as an iovec takes. Replies queued
+// meanwhile only add to the blocks, past the bytes being sent. False if
+// the client must be closed.
+static bool uring_client_send(EventLoop *loop, Client *client)
+{
+    if (client->closing || client->sending)
+        return true;
+
+    pthread_mutex_lock(&client->reply_lock);
+    int count = reply_list_iov(&client->reply, client->send_iov, REPLY_IOV_COUNT);
+    pthread_mutex_unlock(&client->reply_lock);
+    if (count == 0)
+        return true;
+
+    struct io_uring_sqe *sqe = loop_get_sqe(loop);
+    if (!sqe)
+        return false;
+
+    memset(&client->send_msg, 0, sizeof(client->send_msg));
+    client->send_msg.msg_iov = client->send_iov;
+    client->send_msg.msg_iovlen = (size_t)count;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = client->socket;
+    sqe->addr = (uint64_t)(uintptr_t)&client->send_msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = uring_user_data(client, URING_OP_SEND);
+    client->sending = true;
+    client->pending_ops++;
+    return true;
+}
+
+// Handle the end of a client's request, freeing the client if it was
+// closed and this was the last one
+static bool uring_op_done(Client *client)
+{
+    client->pending_ops--;
+    if (!client->closing)
+        return false;
+    if (client->pending_ops == 0)
+        client_free(client);
+    return true;
+}
+
+static void uring_handle_accept(EventLoop *loop, int result, unsigned flags)
+{
+    if (result >= 0)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        memset(&client_addr, 0, sizeof(client_addr));
+        getpeername(result, (struct sockaddr *)&client_addr, &client_len);
+
+        Client *client = client_create(loop, result, &client_addr);
+        if (client && !uring_arm_recv(loop, client))
+            client_close(client);
+    }
+    else if (result != -ECONNABORTED && result != -EINTR)
+    {
+        fprintf(stderr, "Failed to accept connection: %s\n", strerror(-result));
+    }
+
+    if (!(flags & IORING_CQE_F_MORE) && !uring_arm_accept(loop))
+        fprintf(stderr, "Failed to accept connections on thread %d\n", loop->index);
+}
+
+static void uring_handle_recv(EventLoop *loop, Client *client, int result, unsigned flags)
+{
+    bool more = (flags & IORING_CQE_F_MORE) != 0;
+    bool has_buffer = (flags & IORING_CQE_F_BUFFER) != 0;
+    uint16_t buffer_id = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+
+    // Buffers go back to the kernel as soon as their data is in the
+    // query buffer
+    bool received = true;
+    if (has_buffer)
+    {
+        if (result > 0 && !client->closing)
+            received = client_received(client, loop->db, g_pubsub_manager,
+                                       uring_buf_data(&loop->buffers, buffer_id), (size_t)result);
+        uring_buf_ring_recycle(&loop->buffers, buffer_id);
+    }
+
+    if (!more && uring_op_done(client))
+        return;
+    if (client->closing)
+        return;
+
+    if (result > 0 || result == -ENOBUFS)
+    {
+        // The request ends when the buffers run out; more arrive with the
+        // next completions handled
+        if (received && (more || uring_arm_recv(loop, client)))
+            return;
+    }
+    else if (result == 0)
+    {
+        log_verbose("Client disconnected gracefully");
+    }
+    else if (result != -ECONNRESET)
+    {
+        fprintf(stderr, "Error receiving data: %s\n", strerror(-result));
+    }
+
+    // Send what was queued before the failure, if possible
+    if (!client->sending)
+        client_write(client);
+    client_close(client);
+}
+
+static void uring_handle_send(EventLoop *loop, Client *client, int result)
+{
+    if (uring_op_done(client))
+        return;
+
+    client->sending = false;
+    if (result < 0)
+    {
+        if (result != -EPIPE && result != -ECONNRESET)
+            fprintf(stderr, "Error sending response: %s\n", strerror(-result));
+        client_close(client);
+        return;
+    }
+
+    // Idle clients hold no buffers; the rest of a partial send and the
+    // replies queued meanwhile go out with the next send
+    pthread_mutex_lock(&client->reply_lock);
+    reply_list_consume(&client->reply, (size_t)result);
+    pthread_mutex_unlock(&client->reply_lock);
+    if (!uring_client_send(loop, client))
+        client_close(client);
+}
+
+// Other threads queued replies: their clients join the pending writes
+static void uring_handle_wake(EventLoop *loop)
+{
+    pthread_mutex_lock(&loop->remote_lock);
+    Client *client = loop->remote_writes;
+    loop->remote_writes = NULL;
+    while (client)
+    {
+        Client *next = client->remote_next;
+        client->remote_pending = false;
+        client->remote_next = NULL;
+        client_link_pending(client);
+        client = next;
+    }
+    pthread_mutex_unlock(&loop->remote_lock);
+
+    if (!uring_arm_wake(loop))
+        fprintf(stderr, "Failed to watch for wakeups on thread %d\n", loop->index);
+}
+
+// Serve the loop through its io_uring: accepts and receives stay armed as
+// multishot requests, sends are started for the replies queued by each
+// batch of completions, and everything prepared is submitted at once with
+// the wait for the next batch
+static void run_uring_loop(EventLoop *loop)
+{
+    t_loop = loop;
+
+    if (!uring_arm_accept(loop) || !uring_arm_wake(loop))
+    {
+        fprintf(stderr, "Failed to start the event loop on thread %d\n", loop->index);
+        return;
+    }
+
+    while (server_running())
+    {
+        int result = uring_submit(&loop->ring, 1);
+        if (result < 0 && result != -EINTR && result != -EAGAIN && result != -EBUSY)
+        {
+            fprintf(stderr, "Failed to wait for completions: %s\n", strerror(-result));
+            break;
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&loop->ring)) != NULL)
+        {
+            uint64_t user_data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            uring_cqe_seen(&loop->ring);
+
+            Client *client = (Client *)(uintptr_t)(user_data & ~(uint64_t)URING_OP_MASK);
+            switch (user_data & URING_OP_MASK)
+            {
+            case URING_OP_ACCEPT:
+                uring_handle_accept(loop, res, flags);
+                break;
+            case URING_OP_RECV:
+                uring_handle_recv(loop, client, res, flags);
+                break;
+            case URING_OP_SEND:
+                uring_handle_send(loop, client, res);
+                break;
+            case URING_OP_WAKE:
+                uring_handle_wake(loop);
+                break;
+            }
+        }
+
+        while (loop->pending_writes)
+        {
+            Client *client = loop->pending_writes;
+            client_unlink_pending(client);
+            if (!uring_client_send(loop, client))
+                client_close(client);
         }
     }
+}
 
-    buffer_free(&command_buffer);
-    printf("DEBUG: Finished handle_client\n");
+// Printable form of a token a client sent, for log messages
+static const char *log_token(char *out, size_t out_size, const sds token)
+{
+    log_escape(out, out_size, token, sds_len(token));
+    return out;
 }
 
 // Function to process commands received from client
-void process_client_command(int client_socket, Database *db, PubSubManager *pubsub, const char *command)
+void process_client_command(int client_socket, Database *db, PubSubManager *pubsub,
+                            const char *command, size_t command_len)
 {
-    printf("DEBUG: process_client_command called with: '%.100s%s'\n",
-           command, (strlen(command) > 100) ? "..." : "");
-
-    if (!command || !*command)
+    if (!command || command_len == 0)
     {
         send_response_debug(client_socket, "-ERR Empty command\r\n");
         return;
     }
 
     // Parse the command (RESP format)
+    if (log_enabled(LOG_LEVEL_DEBUG))
+    {
+        char escaped[512];
+        log_escape(escaped, sizeof(escaped), command, command_len < 100 ? command_len : 100);
+        log_debug("process_client_command called with: '%s%s'", escaped,
+                  (command_len > 100) ? "..." : "");
+    }
+
     int token_count = 0;
-    size_t command_len = strlen(command);
-    char **tokens = parse_resp_tokens(command, command_len, &token_count);
+    sds *tokens = parse_resp_tokens(command, command_len, &token_count);
 
-    printf("DEBUG: parse_resp_tokens returned: %s with %d tokens\n", tokens ? "valid" : "NULL", token_count);
+    log_debug("parse_resp_tokens returned: %s with %d tokens", tokens ? "valid" : "NULL", token_count);
 
     if (!tokens || token_count == 0)
     {
-        printf("Failed to parse command: '%.*s'\n", (int)command_len, command);
+        if (log_enabled(LOG_LEVEL_VERBOSE))
+        {
+            char escaped[512];
+            log_escape(escaped, sizeof(escaped), command, command_len < 100 ? command_len : 100);
+            log_verbose("Failed to parse command: '%s%s'", escaped, (command_len > 100) ? "..." : "");
+        }
         send_response_debug(client_socket, "-ERR Invalid command format\r\n");
         return;
     }
 
-    printf("DEBUG: First token: '%s'\n", tokens[0]);
-    for (int i = 0; i < token_count; i++)
+    char escaped[256];
+    for (int i = 0; log_enabled(LOG_LEVEL_DEBUG) && i < token_count; i++)
+        log_debug("Token %d: '%s'", i, log_token(escaped, sizeof(escaped), tokens[i]));
+
+    // Keyed commands hold their key's shard lock for the whole command, so
+    // values returned by the database stay valid while the reply is built
+    CommandLock lock_mode = token_count > 1 ? command_lock_mode(tokens[0]) : CMD_LOCK_NONE;
+    if (lock_mode != CMD_LOCK_NONE)
+        db_lock_key(db, tokens[1], sds_len(tokens[1]), lock_mode == CMD_LOCK_EXCLUSIVE);
+
+    // Commands that may allocate need the memory of the whole database
+    // under maxmemory, evicting keys if the policy allows it
+    if (lock_mode == CMD_LOCK_EXCLUSIVE && command_may_grow_memory(tokens[0]) &&
+        !db_ensure_memory(db, tokens[1], sds_len(tokens[1])))
     {
-        printf("DEBUG: Token %d: '%s'\n", i, tokens[i]);
+        log_debug("Refusing '%s' over maxmemory", log_token(escaped, sizeof(escaped), tokens[0]));
+        send_response_debug(client_socket, "-OOM command not allowed when used memory > 'maxmemory'\r\n");
+        db_unlock_key(db, tokens[1], sds_len(tokens[1]));
+        free_tokens(tokens, token_count);
+        return;
     }
 
     // Process commands
@@ -463,7 +1607,7 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     // Handle COMMAND queries (sent by Redis clients to discover commands)
     if (strcasecmp(tokens[0], "COMMAND") == 0)
     {
-        printf("DEBUG: Processing COMMAND\n");
+        log_debug("Processing COMMAND");
         if (token_count > 1 && strcasecmp(tokens[1], "DOCS") == 0)
         {
             // Return empty array for COMMAND DOCS to keep it simple
@@ -473,17 +1617,23 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
         {
             // Return array of supported commands
             const char *command_list =
-                "*24\r\n"
+                "*38\r\n"
                 "$3\r\nSET\r\n"
                 "$3\r\nGET\r\n"
                 "$3\r\nDEL\r\n"
+                "$6\r\nUNLINK\r\n"
                 "$6\r\nEXISTS\r\n"
                 "$4\r\nINCR\r\n"
                 "$4\r\nDECR\r\n"
+                "$6\r\nINCRBY\r\n"
+                "$6\r\nDECRBY\r\n"
                 "$4\r\nPING\r\n"
                 "$6\r\nEXPIRE\r\n"
                 "$3\r\nTTL\r\n"
                 "$7\r\nPERSIST\r\n"
+                "$7\r\nPEXPIRE\r\n"
+                "$9\r\nPEXPIREAT\r\n"
+                "$4\r\nPTTL\r\n"
                 "$5\r\nLPUSH\r\n"
                 "$5\r\nRPUSH\r\n"
                 "$4\r\nLPOP\r\n"
@@ -495,40 +1645,59 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
                 "$7\r\nHGETALL\r\n"
                 "$4\r\nHDEL\r\n"
                 "$7\r\nHEXISTS\r\n"
+                "$5\r\nHSCAN\r\n"
+                "$4\r\nSCAN\r\n"
+                "$4\r\nKEYS\r\n"
+                "$11\r\nPREFIXCOUNT\r\n"
                 "$9\r\nSUBSCRIBE\r\n"
                 "$11\r\nUNSUBSCRIBE\r\n"
-                "$7\r\nPUBLISH\r\n";
+                "$7\r\nPUBLISH\r\n"
+                "$6\r\nCONFIG\r\n"
+                "$6\r\nOBJECT\r\n"
+                "$6\r\nMEMORY\r\n"
+                "$8\r\nFLUSHALL\r\n";
             send_response_debug(client_socket, command_list);
         }
     }
     else if (strcasecmp(tokens[0], "SET") == 0)
     {
-        printf("DEBUG: Processing SET\n");
-        if (token_count != 3)
+        log_debug("Processing SET");
+        if (token_count < 3)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'set' command\r\n");
         }
         else
         {
-            set_command(db, tokens[1], tokens[2]);
-            send_response_debug(client_socket, "+OK\r\n");
+            switch (set_command(db, tokens[1], tokens[2], tokens + 3, token_count - 3))
+            {
+            case SET_OK:
+                send_response_debug(client_socket, "+OK\r\n");
+                break;
+            case SET_NOT_PERFORMED:
+                send_response_debug(client_socket, "$-1\r\n");
+                break;
+            case SET_SYNTAX_ERROR:
+                send_response_debug(client_socket, "-ERR syntax error\r\n");
+                break;
+            case SET_INVALID_EXPIRE:
+                send_response_debug(client_socket, "-ERR invalid expire time in 'set' command\r\n");
+                break;
+            }
         }
     }
     else if (strcasecmp(tokens[0], "GET") == 0)
     {
-        printf("DEBUG: Processing GET\n");
+        log_debug("Processing GET");
         if (token_count != 2)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'get' command\r\n");
         }
         else
         {
-            char *value = get_command(db, tokens[1]);
-            if (value)
+            DbString value;
+            if (get_command(db, tokens[1], &value))
             {
-                // memset(response, 0, sizeof(response)); To initialize or clear the buffer so it doesn't contain any leftover data.
-                snprintf(response, sizeof(response), "$%zu\r\n%s\r\n", strlen(value), value);
-                send_response_debug(client_socket, response);
+                send_bulk_response(client_socket, value.data, value.len);
             }
             else
             {
@@ -538,20 +1707,33 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "DEL") == 0)
     {
-        printf("DEBUG: Processing DEL\n");
+        log_debug("Processing DEL");
+        if (token_count != 2)
+        {
+            send_response_debug(client_socket, "-ERR wrong number of arguments for 'del' command\r\n");
+        }
+        else
+        {
+            bool deleted = del_command(db, tokens[1]);
+            send_response_debug(client_socket, deleted ? ":1\r\n" : ":0\r\n");
+        }
+    }
+    else if (strcasecmp(tokens[0], "UNLINK") == 0)
+    {
+        log_debug("Processing UNLINK");
         if (token_count != 2)
         {
-            send_response_debug(client_socket, "-ERR wrong number of arguments for 'del' command\r\n");
+            send_response_debug(client_socket, "-ERR wrong number of arguments for 'unlink' command\r\n");
         }
         else
         {
-            bool deleted = del_command(db, tokens[1]);
+            bool deleted = unlink_command(db, tokens[1]);
             send_response_debug(client_socket, deleted ? ":1\r\n" : ":0\r\n");
         }
     }
     else if (strcasecmp(tokens[0], "EXISTS") == 0)
     {
-        printf("DEBUG: Processing EXISTS\n");
+        log_debug("Processing EXISTS");
         if (token_count != 2)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'exists' command\r\n");
@@ -564,17 +1746,17 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "INCR") == 0)
     {
-        printf("DEBUG: Processing INCR\n");
+        log_debug("Processing INCR");
         if (token_count != 2)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'incr' command\r\n");
         }
         else
         {
-            int new_value;
+            int64_t new_value;
             if (incr_command(db, tokens[1], &new_value))
             {
-                snprintf(response, sizeof(response), ":%d\r\n", new_value);
+                snprintf(response, sizeof(response), ":%" PRId64 "\r\n", new_value);
                 send_response_debug(client_socket, response);
             }
             else
@@ -585,17 +1767,61 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "DECR") == 0)
     {
-        printf("DEBUG: Processing DECR\n");
+        log_debug("Processing DECR");
         if (token_count != 2)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'decr' command\r\n");
         }
         else
         {
-            int new_value;
+            int64_t new_value;
             if (decr_command(db, tokens[1], &new_value))
             {
-                snprintf(response, sizeof(response), ":%d\r\n", new_value);
+                snprintf(response, sizeof(response), ":%" PRId64 "\r\n", new_value);
+                send_response_debug(client_socket, response);
+            }
+            else
+            {
+                send_response_debug(client_socket, "-ERR value is not an integer or out of range\r\n");
+            }
+        }
+    }
+    else if (strcasecmp(tokens[0], "INCRBY") == 0)
+    {
+        log_debug("Processing INCRBY");
+        if (token_count != 3)
+        {
+            send_response_debug(client_socket, "-ERR wrong number of arguments for 'incrby' command\r\n");
+        }
+        else
+        {
+            int64_t delta, new_value;
+            if (string_to_int64(tokens[2], sds_len(tokens[2]), &delta) &&
+                incrby_command(db, tokens[1], delta, &new_value))
+            {
+                snprintf(response, sizeof(response), ":%" PRId64 "\r\n", new_value);
+                send_response_debug(client_socket, response);
+            }
+            else
+            {
+                send_response_debug(client_socket, "-ERR value is not an integer or out of range\r\n");
+            }
+        }
+    }
+    else if (strcasecmp(tokens[0], "DECRBY") == 0)
+    {
+        log_debug("Processing DECRBY");
+        if (token_count != 3)
+        {
+            send_response_debug(client_socket, "-ERR wrong number of arguments for 'decrby' command\r\n");
+        }
+        else
+        {
+            int64_t delta, new_value;
+            if (string_to_int64(tokens[2], sds_len(tokens[2]), &delta) &&
+                decrby_command(db, tokens[1], delta, &new_value))
+            {
+                snprintf(response, sizeof(response), ":%" PRId64 "\r\n", new_value);
                 send_response_debug(client_socket, response);
             }
             else
@@ -606,7 +1832,7 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "EXPIRE") == 0)
     {
-        printf("DEBUG: Processing EXPIRE\n");
+        log_debug("Processing EXPIRE");
         if (token_count != 3)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'expire' command\r\n");
@@ -625,23 +1851,48 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
             }
         }
     }
-    else if (strcasecmp(tokens[0], "TTL") == 0)
+    else if (strcasecmp(tokens[0], "PEXPIRE") == 0 || strcasecmp(tokens[0], "PEXPIREAT") == 0)
     {
-        printf("DEBUG: Processing TTL\n");
+        bool absolute = strcasecmp(tokens[0], "PEXPIREAT") == 0;
+        log_debug("Processing %s", absolute ? "PEXPIREAT" : "PEXPIRE");
+        int64_t time_ms;
+        if (token_count != 3)
+        {
+            snprintf(response, sizeof(response), "-ERR wrong number of arguments for '%s' command\r\n",
+                     absolute ? "pexpireat" : "pexpire");
+            send_response_debug(client_socket, response);
+        }
+        else if (!string_to_int64(tokens[2], sds_len(tokens[2]), &time_ms) || time_ms < 0)
+        {
+            send_response_debug(client_socket, "-ERR invalid expire time\r\n");
+        }
+        else
+        {
+            bool result = absolute ? pexpireat_command(db, tokens[1], time_ms)
+                                   : pexpire_command(db, tokens[1], time_ms);
+            send_response_debug(client_socket, result ? ":1\r\n" : ":0\r\n");
+        }
+    }
+    else if (strcasecmp(tokens[0], "TTL") == 0 || strcasecmp(tokens[0], "PTTL") == 0)
+    {
+        bool millis = strcasecmp(tokens[0], "PTTL") == 0;
+        log_debug("Processing %s", millis ? "PTTL" : "TTL");
         if (token_count != 2)
         {
-            send_response_debug(client_socket, "-ERR wrong number of arguments for 'ttl' command\r\n");
+            snprintf(response, sizeof(response), "-ERR wrong number of arguments for '%s' command\r\n",
+                     millis ? "pttl" : "ttl");
+            send_response_debug(client_socket, response);
         }
         else
         {
-            int ttl = ttl_command(db, tokens[1]);
-            snprintf(response, sizeof(response), ":%d\r\n", ttl);
+            int64_t ttl = millis ? pttl_command(db, tokens[1]) : ttl_command(db, tokens[1]);
+            snprintf(response, sizeof(response), ":%" PRId64 "\r\n", ttl);
             send_response_debug(client_socket, response);
         }
     }
     else if (strcasecmp(tokens[0], "PERSIST") == 0)
     {
-        printf("DEBUG: Processing PERSIST\n");
+        log_debug("Processing PERSIST");
         if (token_count != 2)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'persist' command\r\n");
@@ -654,7 +1905,7 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "LPUSH") == 0)
     {
-        printf("DEBUG: Processing LPUSH\n");
+        log_debug("Processing LPUSH");
         if (token_count != 3)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'lpush' command\r\n");
@@ -675,7 +1926,7 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "RPUSH") == 0)
     {
-        printf("DEBUG: Processing RPUSH\n");
+        log_debug("Processing RPUSH");
         if (token_count != 3)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'rpush' command\r\n");
@@ -696,19 +1947,18 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "LPOP") == 0)
     {
-        printf("DEBUG: Processing LPOP\n");
+        log_debug("Processing LPOP");
         if (token_count != 2)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'lpop' command\r\n");
         }
         else
         {
-            char *value = lpop_command(db, tokens[1]);
+            sds value = lpop_command(db, tokens[1]);
             if (value)
             {
-                snprintf(response, sizeof(response), "$%zu\r\n%s\r\n", strlen(value), value);
-                send_response_debug(client_socket, response);
-                free(value);
+                send_bulk_response(client_socket, value, sds_len(value));
+                sds_free(value);
             }
             else
             {
@@ -718,19 +1968,18 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "RPOP") == 0)
     {
-        printf("DEBUG: Processing RPOP\n");
+        log_debug("Processing RPOP");
         if (token_count != 2)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'rpop' command\r\n");
         }
         else
         {
-            char *value = rpop_command(db, tokens[1]);
+            sds value = rpop_command(db, tokens[1]);
             if (value)
             {
-                snprintf(response, sizeof(response), "$%zu\r\n%s\r\n", strlen(value), value);
-                send_response_debug(client_socket, response);
-                free(value);
+                send_bulk_response(client_socket, value, sds_len(value));
+                sds_free(value);
             }
             else
             {
@@ -740,7 +1989,7 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "LLEN") == 0)
     {
-        printf("DEBUG: Processing LLEN\n");
+        log_debug("Processing LLEN");
         if (token_count != 2)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'llen' command\r\n");
@@ -754,7 +2003,7 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "LRANGE") == 0)
     {
-        printf("DEBUG: Processing LRANGE\n");
+        log_debug("Processing LRANGE");
         if (token_count != 4)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'lrange' command\r\n");
@@ -763,54 +2012,24 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
         {
             int start = atoi(tokens[2]);
             int stop = atoi(tokens[3]);
-            int count = 0;
-            char **elements = lrange_command(db, tokens[1], start, stop, &count);
-
-            if (elements)
-            {
-                // Build RESP array response
-                char *resp_buffer = malloc(8192); // Large buffer for response
-                if (!resp_buffer)
-                {
-                    send_response_debug(client_socket, "-ERR Out of memory\r\n");
-                    // Free the elements array
-                    for (int i = 0; i < count; i++)
-                    {
-                        free(elements[i]);
-                    }
-                    free(elements);
-                }
-                else
-                {
-                    int offset = snprintf(resp_buffer, 8192, "*%d\r\n", count);
-
-                    for (int i = 0; i < count && offset < 8000; i++)
-                    {
-                        offset += snprintf(resp_buffer + offset, 8192 - offset,
-                                           "$%zu\r\n%s\r\n", strlen(elements[i]), elements[i]);
-                    }
-
-                    send_response_debug(client_socket, resp_buffer);
-                    free(resp_buffer);
-
-                    // Free the elements array
-                    for (int i = 0; i < count; i++)
-                    {
-                        free(elements[i]);
-                    }
-                    free(elements);
-                }
-            }
-            else
-            {
-                // Empty array
-                send_response_debug(client_socket, "*0\r\n");
-            }
+            DbListRange range;
+            size_t count = lrange_command(db, tokens[1], start, stop, &range);
+
+            // Elements are serialized straight from the list chunks while
+            // the shard's read lock is held
+            ReplyStream reply;
+            reply_init(&reply, client_socket);
+            reply_array_header(&reply, count);
+            DbString element;
+            while (db_lrange_next(&range, &element))
+                reply_bulk(&reply, element.data, element.len);
+            log_debug("Streaming LRANGE reply of %zu elements", count);
+            reply_flush(&reply);
         }
     }
     else if (strcasecmp(tokens[0], "HSET") == 0)
     {
-        printf("DEBUG: Processing HSET\n");
+        log_debug("Processing HSET");
         if (token_count != 4)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'hset' command\r\n");
@@ -829,18 +2048,17 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "HGET") == 0)
     {
-        printf("DEBUG: Processing HGET\n");
+        log_debug("Processing HGET");
         if (token_count != 3)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'hget' command\r\n");
         }
         else
         {
-            char *value = hget_command(db, tokens[1], tokens[2]);
-            if (value)
+            DbString value;
+            if (hget_command(db, tokens[1], tokens[2], &value))
             {
-                snprintf(response, sizeof(response), "$%zu\r\n%s\r\n", strlen(value), value);
-                send_response_debug(client_socket, response);
+                send_bulk_response(client_socket, value.data, value.len);
             }
             else
             {
@@ -850,7 +2068,7 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "HDEL") == 0)
     {
-        printf("DEBUG: Processing HDEL\n");
+        log_debug("Processing HDEL");
         if (token_count != 3)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'hdel' command\r\n");
@@ -863,7 +2081,7 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "HEXISTS") == 0)
     {
-        printf("DEBUG: Processing HEXISTS\n");
+        log_debug("Processing HEXISTS");
         if (token_count != 3)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'hexists' command\r\n");
@@ -876,61 +2094,111 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "HGETALL") == 0)
     {
-        printf("DEBUG: Processing HGETALL\n");
+        log_debug("Processing HGETALL");
         if (token_count != 2)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'hgetall' command\r\n");
         }
         else
         {
-            int count = 0;
-            char **fields_and_values = hgetall_command(db, tokens[1], &count);
+            HashIterator it;
+            size_t count = hgetall_command(db, tokens[1], &it);
 
-            if (fields_and_values && count > 0)
+            // Fields are serialized straight from the hash while the
+            // shard's read lock is held
+            ReplyStream reply;
+            reply_init(&reply, client_socket);
+            reply_array_header(&reply, count * 2);
+            DbString field, value;
+            while (count > 0 && db_hash_iterator_next(&it, &field, &value))
             {
-                // Build RESP array response
-                char *resp_buffer = malloc(8192); // Large buffer for response
-                if (!resp_buffer)
-                {
-                    send_response_debug(client_socket, "-ERR Out of memory\r\n");
-                    // Free the array
-                    for (int i = 0; i < count; i++)
-                    {
-                        free(fields_and_values[i]);
-                    }
-                    free(fields_and_values);
-                }
-                else
-                {
-                    int offset = snprintf(resp_buffer, 8192, "*%d\r\n", count);
-
-                    for (int i = 0; i < count && offset < 8000; i++)
-                    {
-                        offset += snprintf(resp_buffer + offset, 8192 - offset,
-                                           "$%zu\r\n%s\r\n", strlen(fields_and_values[i]), fields_and_values[i]);
-                    }
-
-                    send_response_debug(client_socket, resp_buffer);
-                    free(resp_buffer);
+                reply_bulk(&reply, field.data, field.len);
+                reply_bulk(&reply, value.data, value.len);
+            }
+            log_debug("Streaming HGETALL reply of %zu fields", count);
+            reply_flush(&reply);
+        }
+    }
+    else if (strcasecmp(tokens[0], "SCAN") == 0 || strcasecmp(tokens[0], "HSCAN") == 0)
+    {
+        bool hash = strcasecmp(tokens[0], "HSCAN") == 0;
+        log_debug("Processing %s", hash ? "HSCAN" : "SCAN");
+        int first_option = hash ? 3 : 2;
+        if (token_count < first_option)
+        {
+            send_response_debug(client_socket, hash ? "-ERR wrong number of arguments for 'hscan' command\r\n"
+                                                    : "-ERR wrong number of arguments for 'scan' command\r\n");
+        }
+        else
+        {
+            // SCAN locks the shard it visits itself; HSCAN holds its key's
+            // shared lock like the other reads
+            uint64_t cursor = 0;
+            sds *items = NULL;
+            int count = 0;
+            ScanResult result =
+                hash ? hscan_command(db, tokens[1], tokens[2], tokens + 3, token_count - 3, &cursor, &items, &count)
+                     : scan_command(db, tokens[1], tokens + 2, token_count - 2, &cursor, &items, &count);
 
-                    // Free the array
-                    for (int i = 0; i < count; i++)
-                    {
-                        free(fields_and_values[i]);
-                    }
-                    free(fields_and_values);
-                }
+            switch (result)
+            {
+            case SCAN_OK:
+                send_scan_response(client_socket, cursor, items, count);
+                break;
+            case SCAN_INVALID_CURSOR:
+                send_response_debug(client_socket, "-ERR invalid cursor\r\n");
+                break;
+            case SCAN_SYNTAX_ERROR:
+                send_response_debug(client_socket, "-ERR syntax error\r\n");
+                break;
+            case SCAN_WRONG_TYPE:
+                send_response_debug(client_socket,
+                                    "-ERR WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+                break;
+            }
+            sds_free_array(items, count);
+        }
+    }
+    else if (strcasecmp(tokens[0], "KEYS") == 0)
+    {
+        log_debug("Processing KEYS");
+        if (token_count != 2)
+        {
+            send_response_debug(client_socket, "-ERR wrong number of arguments for 'keys' command\r\n");
+        }
+        else
+        {
+            // Shards are locked one at a time by the database
+            int count = 0;
+            sds *keys = keys_command(db, tokens[1], &count);
+            send_array_response(client_socket, keys, count);
+            sds_free_array(keys, count);
+        }
+    }
+    else if (strcasecmp(tokens[0], "PREFIXCOUNT") == 0)
+    {
+        log_debug("Processing PREFIXCOUNT");
+        if (token_count != 2)
+        {
+            send_response_debug(client_socket, "-ERR wrong number of arguments for 'prefixcount' command\r\n");
+        }
+        else
+        {
+            size_t count;
+            if (prefixcount_command(db, tokens[1], &count))
+            {
+                snprintf(response, sizeof(response), ":%zu\r\n", count);
+                send_response_debug(client_socket, response);
             }
             else
             {
-                // Empty array
-                send_response_debug(client_socket, "*0\r\n");
+                send_response_debug(client_socket, "-ERR the key index is disabled, enable it with CONFIG SET key-index yes\r\n");
             }
         }
     }
     else if (strcasecmp(tokens[0], "SUBSCRIBE") == 0)
     {
-        printf("DEBUG: Processing SUBSCRIBE\n");
+        log_debug("Processing SUBSCRIBE");
         if (token_count < 2)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'subscribe' command\r\n");
@@ -966,11 +2234,11 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "UNSUBSCRIBE") == 0)
     {
-        printf("DEBUG: Processing UNSUBSCRIBE\n");
+        log_debug("Processing UNSUBSCRIBE");
         if (token_count == 1)
         {
             // Unsubscribe from all channels
-            printf("DEBUG: Unsubscribing from all channels\n");
+            log_debug("Unsubscribing from all channels");
 
             // Get current subscriptions before unsubscribing
             int current_count = 0;
@@ -1007,12 +2275,12 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
             }
 
             send_response_debug(client_socket, response);
-            printf("DEBUG: Sent unsubscribe-all response\n");
+            log_debug("Sent unsubscribe-all response");
         }
         else
         {
             // Unsubscribe from specified channels
-            printf("DEBUG: Unsubscribing from %d specific channels\n", token_count - 1);
+            log_debug("Unsubscribing from %d specific channels", token_count - 1);
 
             char response[8192] = {0};
             size_t offset = 0;
@@ -1020,7 +2288,7 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
 
             for (int i = 1; i < token_count; i++)
             {
-                printf("DEBUG: Attempting to unsubscribe from channel: %s\n", tokens[i]);
+                log_debug("Attempting to unsubscribe from channel: %s", log_token(escaped, sizeof(escaped), tokens[i]));
 
                 // Check if client is currently subscribed to this channel
                 bool was_subscribed = pubsub_is_subscribed(pubsub, client_socket, tokens[i]);
@@ -1028,7 +2296,8 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
                 if (was_subscribed)
                 {
                     bool success = unsubscribe_command(pubsub, client_socket, tokens[i]);
-                    printf("DEBUG: Unsubscribe from %s: %s\n", tokens[i], success ? "SUCCESS" : "FAILED");
+                    log_debug("Unsubscribe from %s: %s", log_token(escaped, sizeof(escaped), tokens[i]),
+                              success ? "SUCCESS" : "FAILED");
 
                     if (success)
                     {
@@ -1059,14 +2328,14 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
                         }
                         else
                         {
-                            printf("DEBUG: Response buffer full, sending partial response\n");
+                            log_debug("Response buffer full, sending partial response");
                             break;
                         }
                     }
                 }
                 else
                 {
-                    printf("DEBUG: Client was not subscribed to channel %s\n", tokens[i]);
+                    log_debug("Client was not subscribed to channel %s", log_token(escaped, sizeof(escaped), tokens[i]));
 
                     // Still send a response for channels not subscribed to
                     // Get current subscription count
@@ -1097,18 +2366,18 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
             if (offset > 0)
             {
                 send_response_debug(client_socket, response);
-                printf("DEBUG: Sent unsubscribe response for %d channels\n", successful_unsubscribes);
+                log_debug("Sent unsubscribe response for %d channels", successful_unsubscribes);
             }
             else
             {
                 send_response_debug(client_socket, "-ERR Failed to process unsubscribe request\r\n");
-                printf("DEBUG: No response generated - this is unexpected\n");
+                log_debug("No response generated - this is unexpected");
             }
         }
     }
     else if (strcasecmp(tokens[0], "PUBLISH") == 0)
     {
-        printf("DEBUG: Processing PUBLISH\n");
+        log_debug("Processing PUBLISH");
         if (token_count != 3)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'publish' command\r\n");
@@ -1122,13 +2391,13 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "PUBSUB") == 0)
     {
-        printf("DEBUG: Processing PUBSUB\n");
+        log_debug("Processing PUBSUB");
         if (token_count >= 2 && strcasecmp(tokens[1], "CHANNELS") == 0)
         {
             // Return list of channels with at least one subscriber
             pthread_mutex_lock(&pubsub->mutex);
 
-            char *resp_buffer = malloc(8192);
+            char *resp_buffer = mem_alloc(MEM_CLIENT_BUFFERS, 8192);
             if (!resp_buffer)
             {
                 send_response_debug(client_socket, "-ERR Out of memory\r\n");
@@ -1172,7 +2441,7 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
                 }
 
                 send_response_debug(client_socket, resp_buffer);
-                free(resp_buffer);
+                mem_free(resp_buffer);
             }
 
             pthread_mutex_unlock(&pubsub->mutex);
@@ -1180,7 +2449,7 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
         else if (token_count >= 3 && strcasecmp(tokens[1], "NUMSUB") == 0)
         {
             // Return number of subscribers for specified channels
-            char *resp_buffer = malloc(8192);
+            char *resp_buffer = mem_alloc(MEM_CLIENT_BUFFERS, 8192);
             if (!resp_buffer)
             {
                 send_response_debug(client_socket, "-ERR Out of memory\r\n");
@@ -1217,7 +2486,7 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
                 pthread_mutex_unlock(&pubsub->mutex);
 
                 send_response_debug(client_socket, resp_buffer);
-                free(resp_buffer);
+                mem_free(resp_buffer);
             }
         }
         else
@@ -1227,14 +2496,19 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "SAVE") == 0)
     {
-        printf("DEBUG: Processing SAVE\n");
+        log_debug("Processing SAVE");
         if (token_count != 2)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'save' command\r\n");
         }
         else
         {
-            if (save_command(db, tokens[1]))
+            // Snapshot under shared locks on every shard
+            db_lock_all(db, false);
+            bool saved = save_command(db, tokens[1]);
+            db_unlock_all(db);
+
+            if (saved)
             {
                 send_response_debug(client_socket, "+OK\r\n");
             }
@@ -1246,14 +2520,18 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     }
     else if (strcasecmp(tokens[0], "LOAD") == 0)
     {
-        printf("DEBUG: Processing LOAD\n");
+        log_debug("Processing LOAD");
         if (token_count != 2)
         {
             send_response_debug(client_socket, "-ERR wrong number of arguments for 'load' command\r\n");
         }
         else
         {
-            if (load_command(db, tokens[1]))
+            db_lock_all(db, true);
+            bool loaded = load_command(db, tokens[1]);
+            db_unlock_all(db);
+
+            if (loaded)
             {
                 send_response_debug(client_socket, "+OK\r\n");
             }
@@ -1263,18 +2541,26 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
             }
         }
     }
+    else if (strcasecmp(tokens[0], "FLUSHALL") == 0)
+    {
+        log_debug("Processing FLUSHALL");
+        db_lock_all(db, true);
+        bool flushed = flushall_command(db, tokens + 1, token_count - 1);
+        db_unlock_all(db);
+
+        send_response_debug(client_socket, flushed ? "+OK\r\n" : "-ERR syntax error\r\n");
+    }
     // Redis protocol PING command
     else if (strcasecmp(tokens[0], "PING") == 0)
     {
-        printf("DEBUG: Processing PING\n");
+        log_debug("Processing PING");
         if (token_count == 1)
         {
             send_response_debug(client_socket, "+PONG\r\n");
         }
         else if (token_count == 2)
         {
-            snprintf(response, sizeof(response), "$%zu\r\n%s\r\n", strlen(tokens[1]), tokens[1]);
-            send_response_debug(client_socket, response);
+            send_bulk_response(client_socket, tokens[1], sds_len(tokens[1]));
         }
         else
         {
@@ -1284,47 +2570,207 @@ void process_client_command(int client_socket, Database *db, PubSubManager *pubs
     // Simple command to get server info
     else if (strcasecmp(tokens[0], "INFO") == 0)
     {
-        printf("DEBUG: Processing INFO\n");
-        const char *info_text = "# Server\r\nkey_value_store_version:1.0\r\nprotocol_version:1.0";
-        snprintf(response, sizeof(response), "$%zu\r\n%s\r\n", strlen(info_text), info_text);
-        send_response_debug(client_socket, response);
+        log_debug("Processing INFO");
+        SlabStats stats;
+        DbExpireStats expire_stats;
+        db_lock_all(db, false);
+        db_slab_stats(db, &stats);
+        db_expire_stats(db, &expire_stats);
+        size_t keys = db_size(db);
+        size_t category_bytes[MEM_CATEGORY_COUNT];
+        size_t used_memory = server_used_memory(category_bytes);
+        size_t evicted = db_evicted_keys(db);
+        size_t maxmemory = db->config.maxmemory;
+        const char *policy = db_eviction_policy_name(db->config.maxmemory_policy);
+        db_unlock_all(db);
+
+        size_t lazyfree_pending, lazyfreed;
+        db_lazyfree_stats(db, &lazyfree_pending, &lazyfreed);
+
+        size_t peak = mem_update_peak(used_memory);
+        size_t rss = mem_rss();
+        double fragmentation = used_memory > 0 ? (double)rss / (double)used_memory : 0.0;
+
+        pthread_mutex_lock(&g_connection_mutex);
+        int connected_clients = g_active_connections;
+        pthread_mutex_unlock(&g_connection_mutex);
+
+        char info[8192];
+        size_t len = (size_t)snprintf(info, sizeof(info),
+                                      "# Server\r\nkey_value_store_version:1.0\r\nprotocol_version:1.0\r\n"
+                                      "\r\n# Clients\r\nconnected_clients:%d\r\nio_threads:%d\r\n",
+                                      connected_clients, g_loop_count);
+
+        // One line per event loop thread, to check that clients are spread
+        for (int i = 0; i < g_loop_count && len < sizeof(info); i++)
+        {
+            len += (size_t)snprintf(info + len, sizeof(info) - len,
+                                    "io_thread_%d:connections=%zu,commands=%zu,backend=%s\r\n", i,
+                                    __atomic_load_n(&g_loops[i].connections, __ATOMIC_RELAXED),
+                                    __atomic_load_n(&g_loops[i].commands_processed, __ATOMIC_RELAXED),
+                                    __atomic_load_n(&g_loops[i].uring, __ATOMIC_ACQUIRE) ? "io_uring" : "epoll");
+        }
+
+        if (len < sizeof(info))
+            len += (size_t)snprintf(info + len, sizeof(info) - len,
+                                    "\r\n# Memory\r\n"
+                                    "used_memory:%zu\r\nused_memory_peak:%zu\r\nused_memory_rss:%zu\r\n"
+                                    "mem_fragmentation_ratio:%.2f\r\nmaxmemory:%zu\r\nmaxmemory_policy:%s\r\n"
+                                    "lazyfree_pending_objects:%zu\r\n",
+                                    used_memory, peak, rss, fragmentation, maxmemory, policy, lazyfree_pending);
+
+        // One line per memory category
+        for (int c = 0; c < MEM_CATEGORY_COUNT && len < sizeof(info); c++)
+        {
+            len += (size_t)snprintf(info + len, sizeof(info) - len, "mem_%s:%zu\r\n",
+                                    mem_category_name((MemCategory)c), category_bytes[c]);
+        }
+
+        if (len < sizeof(info))
+            len += (size_t)snprintf(info + len, sizeof(info) - len,
+                                    "\r\n# Keyspace\r\n"
+                                    "keys:%zu\r\nexpires:%zu\r\n"
+                                    "\r\n# Stats\r\n"
+                                    "expired_keys:%zu\r\nexpired_keys_active:%zu\r\nexpired_keys_lazy:%zu\r\n"
+                                    "evicted_keys:%zu\r\nlazyfreed_objects:%zu\r\n"
+                                    "\r\n# Slabs\r\n"
+                                    "slab_count:%zu\r\nslab_bytes:%zu\r\nslab_used_bytes:%zu\r\n"
+                                    "slab_objects:%zu\r\nlarge_objects:%zu\r\nlarge_bytes:%zu",
+                                    keys, expire_stats.expires,
+                                    expire_stats.expired_active + expire_stats.expired_lazy,
+                                    expire_stats.expired_active, expire_stats.expired_lazy, evicted, lazyfreed,
+                                    stats.slabs, stats.slab_bytes, stats.used_bytes,
+                                    stats.objects, stats.large_objects, stats.large_bytes);
+
+        // One line per size class in use
+        for (int i = 0; i < SLAB_CLASS_COUNT && len < sizeof(info); i++)
+        {
+            if (stats.class_slabs[i] == 0)
+                continue;
+            len += (size_t)snprintf(info + len, sizeof(info) - len, "\r\nslab_class_%zu:slabs=%zu,objects=%zu",
+                                    slab_class_object_size(i),
+                                    stats.class_slabs[i], stats.class_objects[i]);
+        }
+        if (len >= sizeof(info))
+            len = sizeof(info) - 1;
+
+        send_bulk_response(client_socket, info, len);
+    }
+    else if (strcasecmp(tokens[0], "CONFIG") == 0)
+    {
+        log_debug("Processing CONFIG");
+        if (token_count == 3 && strcasecmp(tokens[1], "GET") == 0)
+        {
+            int count = 0;
+            db_lock_all(db, false);
+            sds *pairs = config_get_command(db, tokens[2], &count);
+            db_unlock_all(db);
+
+            if (pairs && count > 0)
+            {
+                send_array_response(client_socket, pairs, count);
+            }
+            else
+            {
+                send_response_debug(client_socket, "*0\r\n");
+            }
+            sds_free_array(pairs, count);
+        }
+        else if (token_count == 4 && strcasecmp(tokens[1], "SET") == 0)
+        {
+            // Settings are read under shard locks, so change them under all of them
+            db_lock_all(db, true);
+            bool ok = config_set_command(db, tokens[2], tokens[3]);
+            db_unlock_all(db);
+
+            send_response_debug(client_socket,
+                                ok ? "+OK\r\n" : "-ERR invalid CONFIG SET parameter or value\r\n");
+        }
+        else
+        {
+            send_response_debug(client_socket, "-ERR unknown CONFIG subcommand or wrong number of arguments\r\n");
+        }
+    }
+    else if (strcasecmp(tokens[0], "OBJECT") == 0)
+    {
+        log_debug("Processing OBJECT");
+        if (token_count == 3 && strcasecmp(tokens[1], "ENCODING") == 0)
+        {
+            // The key is the second argument, so it is locked here
+            db_lock_key(db, tokens[2], sds_len(tokens[2]), false);
+            const char *encoding = object_encoding_command(db, tokens[2]);
+            if (encoding)
+            {
+                send_bulk_response(client_socket, encoding, strlen(encoding));
+            }
+            else
+            {
+                send_response_debug(client_socket, "$-1\r\n"); // Redis nil response
+            }
+            db_unlock_key(db, tokens[2], sds_len(tokens[2]));
+        }
+        else
+        {
+            send_response_debug(client_socket, "-ERR unknown OBJECT subcommand or wrong number of arguments\r\n");
+        }
+    }
+    else if (strcasecmp(tokens[0], "MEMORY") == 0)
+    {
+        log_debug("Processing MEMORY");
+        if (token_count == 3 && strcasecmp(tokens[1], "USAGE") == 0)
+        {
+            // The key is the second argument, so it is locked here
+            size_t bytes;
+            db_lock_key(db, tokens[2], sds_len(tokens[2]), false);
+            bool found = memory_usage_command(db, tokens[2], &bytes);
+            db_unlock_key(db, tokens[2], sds_len(tokens[2]));
+
+            if (found)
+            {
+                snprintf(response, sizeof(response), ":%zu\r\n", bytes);
+                send_response_debug(client_socket, response);
+            }
+            else
+            {
+                send_response_debug(client_socket, "$-1\r\n"); // Redis nil response
+            }
+        }
+        else
+        {
+            send_response_debug(client_socket, "-ERR unknown MEMORY subcommand or wrong number of arguments\r\n");
+        }
     }
     // Command to exit
     else if (strcasecmp(tokens[0], "QUIT") == 0 || strcasecmp(tokens[0], "EXIT") == 0)
     {
-        printf("DEBUG: Processing QUIT/EXIT\n");
+        log_debug("Processing QUIT/EXIT");
         send_response_debug(client_socket, "+OK\r\n");
         free_tokens(tokens, token_count);
         return;
     }
     else
     {
-        printf("DEBUG: Unknown command: '%s'\n", tokens[0]);
+        log_debug("Unknown command: '%s'", log_token(escaped, sizeof(escaped), tokens[0]));
         snprintf(response, sizeof(response), "-ERR unknown command '%s'\r\n", tokens[0]);
         send_response_debug(client_socket, response);
     }
 
+    if (lock_mode != CMD_LOCK_NONE)
+        db_unlock_key(db, tokens[1], sds_len(tokens[1]));
+
     free_tokens(tokens, token_count);
-    printf("DEBUG: Finished processing command\n");
+    log_debug("Finished processing command");
 }
 
 // Debug function to help diagnose RESP formatting issues
 void debug_resp_response(const char *label, const char *resp_data)
 {
-    printf("DEBUG RESP [%s]: ", label);
-    for (int i = 0; resp_data[i] != '\0'; i++)
-    {
-        char c = resp_data[i];
-        if (c == '\r')
-            printf("\\r");
-        else if (c == '\n')
-            printf("\\n");
-        else if (c >= 32 && c <= 126)
-            printf("%c", c);
-        else
-            printf("\\x%02x", (unsigned char)c);
-    }
-    printf("\n");
+    if (!log_enabled(LOG_LEVEL_DEBUG))
+        return;
+
+    char escaped[LOG_LINE_MAX];
+    log_escape(escaped, sizeof(escaped), resp_data, strlen(resp_data));
+    log_debug("RESP [%s]: %s", label, escaped);
 }
 
 // Enhanced send_response_debug function with debugging
@@ -1337,10 +2783,109 @@ void send_response_debug(int client_socket, const char *response)
     debug_resp_response("SENDING", response);
 
     size_t total_bytes = strlen(response);
-    size_t bytes_sent = 0;
 
-    printf("DEBUG: Sending response: '%.100s%s'\n", response,
-           (total_bytes > 100) ? "..." : "");
+    send_response_len(client_socket, response, total_bytes);
+}
+
+// Send a RESP bulk string using its known length, so values are neither
+// rescanned nor truncated to a fixed reply buffer. The value is copied
+// once, straight into the client's queued output.
+void send_bulk_response(int client_socket, const char *data, size_t len)
+{
+    char header[32];
+    int header_len = snprintf(header, sizeof(header), "$%zu\r\n", len);
+
+    struct iovec parts[3];
+    parts[0].iov_base = header;
+    parts[0].iov_len = (size_t)header_len;
+    parts[1].iov_base = (void *)data;
+    parts[1].iov_len = len;
+    parts[2].iov_base = (void *)"\r\n";
+    parts[2].iov_len = 2;
+
+    log_debug("Sending bulk response of %zu bytes", len);
+    send_response_parts(client_socket, parts, 3);
+}
+
+// Bytes needed to format items as a RESP array, header included
+static size_t array_reply_size(sds *items, int count)
+{
+    size_t total_bytes = 32;
+    for (int i = 0; i < count; i++)
+    {
+        total_bytes += 32 + sds_len(items[i]);
+    }
+    return total_bytes;
+}
+
+// Format items as a RESP array at reply + offset; returns the new offset
+static size_t format_array_reply(char *reply, size_t total_bytes, size_t offset, sds *items, int count)
+{
+    offset += (size_t)snprintf(reply + offset, total_bytes - offset, "*%d\r\n", count);
+    for (int i = 0; i < count; i++)
+    {
+        size_t len = sds_len(items[i]);
+        offset += (size_t)snprintf(reply + offset, total_bytes - offset, "$%zu\r\n", len);
+        memcpy(reply + offset, items[i], len);
+        memcpy(reply + offset + len, "\r\n", 2);
+        offset += len + 2;
+    }
+    return offset;
+}
+
+// Send a RESP array of bulk strings in one reply sized from the lengths
+void send_array_response(int client_socket, sds *items, int count)
+{
+    size_t total_bytes = array_reply_size(items, count);
+    char *reply = (char *)mem_alloc(MEM_CLIENT_BUFFERS, total_bytes);
+    if (!reply)
+    {
+        send_response_debug(client_socket, "-ERR Out of memory\r\n");
+        return;
+    }
+
+    size_t offset = format_array_reply(reply, total_bytes, 0, items, count);
+
+    log_debug("Sending array response of %d elements", count);
+    send_response_len(client_socket, reply, offset);
+    mem_free(reply);
+}
+
+// Reply of SCAN and HSCAN: the next cursor, then the items found
+void send_scan_response(int client_socket, uint64_t cursor, sds *items, int count)
+{
+    char digits[24];
+    int digits_len = snprintf(digits, sizeof(digits), "%" PRIu64, cursor);
+
+    size_t total_bytes = 64 + array_reply_size(items, count);
+    char *reply = (char *)mem_alloc(MEM_CLIENT_BUFFERS, total_bytes);
+    if (!reply)
+    {
+        send_response_debug(client_socket, "-ERR Out of memory\r\n");
+        return;
+    }
+
+    size_t offset = (size_t)snprintf(reply, total_bytes, "*2\r\n$%d\r\n%s\r\n", digits_len, digits);
+    offset = format_array_reply(reply, total_bytes, offset, items, count);
+
+    log_debug("Sending scan response of %d elements, cursor %s", count, digits);
+    send_response_len(client_socket, reply, offset);
+    mem_free(reply);
+}
+
+// Send exactly total_bytes of a response: queued for a client of the event
+// loop, written at once to any other socket
+void send_response_len(int client_socket, const char *response, size_t total_bytes)
+{
+    struct iovec part;
+    part.iov_base = (void *)response;
+    part.iov_len = total_bytes;
+    send_response_parts(client_socket, &part, 1);
+}
+
+static void socket_send_all(int client_socket, const char *response, size_t total_bytes)
+{
+    size_t bytes_sent = 0;
 
     // Send data in chunks until everything is sent
     while (bytes_sent < total_bytes)
@@ -1361,4 +2906,81 @@ void send_response_debug(int client_socket, const char *response)
 
         bytes_sent += result;
     }
-}
\ No newline at end of file
+}
+
+void send_response_parts(int client_socket, const struct iovec *parts, int count)
+{
+    Client *client = client_lookup(client_socket);
+    if (client)
+    {
+        client_queue_reply(client, parts, count);
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+        socket_send_all(client_socket, (const char *)parts[i].iov_base, parts[i].iov_len);
+}
+
+// A stream holds the client's reply lock from reply_init to reply_flush, so
+// no other output splits the reply, and serializes pieces straight into the
+// client's queued blocks. Pieces for a socket that is not a client of the
+// event loops are sent at once.
+void reply_init(ReplyStream *reply, int client_socket)
+{
+    reply->client_socket = client_socket;
+    reply->client = client_lookup(client_socket);
+    if (reply->client)
+        pthread_mutex_lock(&reply->client->reply_lock);
+}
+
+static void reply_append_parts(ReplyStream *reply, const struct iovec *parts, int count)
+{
+    if (reply->client)
+    {
+        client_queue_locked(reply->client, parts, count);
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+        socket_send_all(reply->client_socket, (const char *)parts[i].iov_base, parts[i].iov_len);
+}
+
+void reply_append(ReplyStream *reply, const char *data, size_t len)
+{
+    struct iovec part;
+    part.iov_base = (void *)data;
+    part.iov_len = len;
+    reply_append_parts(reply, &part, 1);
+}
+
+void reply_array_header(ReplyStream *reply, size_t count)
+{
+    char header[32];
+    int header_len = snprintf(header, sizeof(header), "*%zu\r\n", count);
+    reply_append(reply, header, (size_t)header_len);
+}
+
+void reply_bulk(ReplyStream *reply, const char *data, size_t len)
+{
+    char header[32];
+    int header_len = snprintf(header, sizeof(header), "$%zu\r\n", len);
+
+    struct iovec parts[3];
+    parts[0].iov_base = header;
+    parts[0].iov_len = (size_t)header_len;
+    parts[1].iov_base = (void *)data;
+    parts[1].iov_len = len;
+    parts[2].iov_base = (void *)"\r\n";
+    parts[2].iov_len = 2;
+    reply_append_parts(reply, parts, 3);
+}
+
+void reply_flush(ReplyStream *reply)
+{
+    if (!reply->client)
+        return;
+
+    pthread_mutex_unlock(&reply->client->reply_lock);
+    client_reply_queued(reply->client);
+    reply->client = NULL;
+}
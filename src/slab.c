@@ -0,0 +1,250 @@
+#include "../include/slab.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Slab header, stored at the start of its SLAB_SIZE-aligned block so the
+// slab of any object is found by masking the object's address
+struct Slab
+{
+    Slab *prev;
+    Slab *next;
+    void *free_list; // Freed objects, linked through their first word
+    char *unused;    // First object never handed out
+    char *end;       // End of the last whole object
+    size_t used;     // Live objects
+    int class_index;
+};
+
+// Objects start after the header, 16-byte aligned
+#define SLAB_HEADER_SIZE ((sizeof(Slab) + 15) & ~(size_t)15)
+
+static int slab_class_index(size_t size)
+{
+    if (size == 0)
+        size = 1;
+    if (size <= 256)
+        return (int)((size + 15) / 16) - 1;
+    if (size <= 512)
+        return 16 + (int)((size - 257) / 64);
+    return 20 + (int)((size - 513) / 128);
+}
+
+size_t slab_class_object_size(int index)
+{
+    if (index < 16)
+        return (size_t)(index + 1) * 16;
+    if (index < 20)
+        return 256 + (size_t)(index - 15) * 64;
+    return 512 + (size_t)(index - 19) * 128;
+}
+
+size_t slab_class_size(size_t size)
+{
+    if (size > SLAB_MAX_OBJECT)
+        return size;
+    return slab_class_object_size(slab_class_index(size));
+}
+
+static void slab_list_push(Slab **head, Slab *slab)
+{
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head)
+        (*head)->prev = slab;
+    *head = slab;
+}
+
+static void slab_list_remove(Slab **head, Slab *slab)
+{
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *head = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+static bool slab_is_full(const Slab *slab)
+{
+    return !slab->free_list && slab->unused == slab->end;
+}
+
+static Slab *slab_create(SlabClass *cls, int index)
+{
+    void *mem;
+    if (posix_memalign(&mem, SLAB_SIZE, SLAB_SIZE) != 0)
+    {
+        fprintf(stderr, "Failed to allocate memory for slab\n");
+        return NULL;
+    }
+
+    Slab *slab = (Slab *)mem;
+    slab->prev = NULL;
+    slab->next = NULL;
+    slab->free_list = NULL;
+    slab->unused = (char *)mem + SLAB_HEADER_SIZE;
+    slab->end = slab->unused + cls->objects_per_slab * cls->object_size;
+    slab->used = 0;
+    slab->class_index = index;
+    cls->slabs++;
+    return slab;
+}
+
+static void slab_list_release(Slab *slab)
+{
+    while (slab)
+    {
+        Slab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+}
+
+void slab_pool_init(SlabPool *pool)
+{
+    memset(pool, 0, sizeof(*pool));
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++)
+    {
+        SlabClass *cls = &pool->classes[i];
+        cls->object_size = slab_class_object_size(i);
+        cls->objects_per_slab = (SLAB_SIZE - SLAB_HEADER_SIZE) / cls->object_size;
+    }
+}
+
+void slab_pool_release(SlabPool *pool)
+{
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++)
+    {
+        SlabClass *cls = &pool->classes[i];
+        slab_list_release(cls->partial);
+        slab_list_release(cls->full);
+        cls->partial = NULL;
+        cls->full = NULL;
+        cls->slabs = 0;
+        cls->used = 0;
+    }
+    pool->used_bytes = pool->large_bytes;
+    for (int c = 0; c < MEM_CATEGORY_COUNT; c++)
+        mem_count_free((MemCategory)c, pool->category_bytes[c]);
+    memset(pool->category_bytes, 0, sizeof(pool->category_bytes));
+}
+
+void *slab_alloc(SlabPool *pool, MemCategory category, size_t size)
+{
+    if (size > SLAB_MAX_OBJECT)
+    {
+        void *ptr = malloc(size);
+        if (ptr)
+        {
+            pool->large_objects++;
+            pool->large_bytes += size;
+            pool->used_bytes += size;
+            pool->category_bytes[category] += size;
+            mem_count_alloc(category, size);
+        }
+        return ptr;
+    }
+
+    int index = slab_class_index(size);
+    SlabClass *cls = &pool->classes[index];
+
+    Slab *slab = cls->partial;
+    if (!slab)
+    {
+        slab = slab_create(cls, index);
+        if (!slab)
+            return NULL;
+        slab_list_push(&cls->partial, slab);
+    }
+
+    // Reuse freed objects first, then carve new ones
+    void *ptr;
+    if (slab->free_list)
+    {
+        ptr = slab->free_list;
+        slab->free_list = *(void **)ptr;
+    }
+    else
+    {
+        ptr = slab->unused;
+        slab->unused += cls->object_size;
+    }
+
+    slab->used++;
+    cls->used++;
+    pool->used_bytes += cls->object_size;
+    pool->category_bytes[category] += cls->object_size;
+    mem_count_alloc(category, cls->object_size);
+
+    if (slab_is_full(slab))
+    {
+        slab_list_remove(&cls->partial, slab);
+        slab_list_push(&cls->full, slab);
+    }
+    return ptr;
+}
+
+void slab_free(SlabPool *pool, MemCategory category, void *ptr, size_t size)
+{
+    if (!ptr)
+        return;
+
+    if (size > SLAB_MAX_OBJECT)
+    {
+        free(ptr);
+        pool->large_objects--;
+        pool->large_bytes -= size;
+        pool->used_bytes -= size;
+        pool->category_bytes[category] -= size;
+        mem_count_free(category, size);
+        return;
+    }
+
+    Slab *slab = (Slab *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+    SlabClass *cls = &pool->classes[slab->class_index];
+    bool was_full = slab_is_full(slab);
+
+    *(void **)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->used--;
+    cls->used--;
+    pool->used_bytes -= cls->object_size;
+    pool->category_bytes[category] -= cls->object_size;
+    mem_count_free(category, cls->object_size);
+
+    if (was_full)
+    {
+        slab_list_remove(&cls->full, slab);
+        slab_list_push(&cls->partial, slab);
+    }
+    else if (slab->used == 0 && (slab->prev || slab->next))
+    {
+        // Empty and not the class's only slab with free space
+        slab_list_remove(&cls->partial, slab);
+        free(slab);
+        cls->slabs--;
+    }
+}
+
+void slab_pool_add_stats(const SlabPool *pool, SlabStats *stats)
+{
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++)
+    {
+        const SlabClass *cls = &pool->classes[i];
+        stats->slabs += cls->slabs;
+        stats->slab_bytes += cls->slabs * SLAB_SIZE;
+        stats->used_bytes += cls->used * cls->object_size;
+        stats->objects += cls->used;
+        stats->class_slabs[i] += cls->slabs;
+        stats->class_objects[i] += cls->used;
+    }
+    stats->large_objects += pool->large_objects;
+    stats->large_bytes += pool->large_bytes;
+    for (int i = 0; i < MEM_CATEGORY_COUNT; i++)
+        stats->category_bytes[i] += pool->category_bytes[i];
+}
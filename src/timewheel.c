@@ -0,0 +1,228 @@
+#include "../include/timewheel.h"
+#include "../include/utils.h"
+#include <string.h>
+
+#define TW_SLOT_MASK (TW_SLOTS - 1)
+#define TW_RANGE_BITS (TW_LEVEL_BITS * TW_LEVELS)
+
+static TimerNode **tw_list(TimerWheel *tw, const TimerNode *node)
+{
+    if (node->level == TW_LEVELS)
+        return &tw->overflow;
+    return &tw->slots[node->level][node->slot];
+}
+
+// Place a timer relative to the current tick. Overdue timers go to the
+// current slot, which is handed out first.
+static void tw_link(TimerWheel *tw, TimerNode *node)
+{
+    uint64_t when = (uint64_t)(node->when < tw->current ? tw->current : node->when);
+    uint64_t diff = when ^ (uint64_t)tw->current;
+
+    int level = 0;
+    while (level < TW_LEVELS && (diff >> (TW_LEVEL_BITS * (level + 1))) != 0)
+        level++;
+
+    node->level = (uint8_t)level;
+    node->slot = 0;
+    if (level < TW_LEVELS)
+    {
+        node->slot = (uint8_t)((when >> (TW_LEVEL_BITS * level)) & TW_SLOT_MASK);
+        tw->occupied[level] |= (uint64_t)1 << node->slot;
+    }
+
+    TimerNode **list = tw_list(tw, node);
+    node->prev = NULL;
+    node->next = *list;
+    if (*list)
+        (*list)->prev = node;
+    *list = node;
+}
+
+static void tw_unlink(TimerWheel *tw, TimerNode *node)
+{
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        *tw_list(tw, node) = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+
+    if (node->level < TW_LEVELS && !tw->slots[node->level][node->slot])
+        tw->occupied[node->level] &= ~((uint64_t)1 << node->slot);
+}
+
+// Re-place every timer of a list after the current tick moved
+static void tw_cascade(TimerWheel *tw, TimerNode **list)
+{
+    TimerNode *node = *list;
+    *list = NULL;
+    while (node)
+    {
+        TimerNode *next = node->next;
+        tw_link(tw, node);
+        node = next;
+    }
+}
+
+void tw_init(TimerWheel *tw, int64_t now)
+{
+    memset(tw, 0, sizeof(*tw));
+    tw->current = now;
+}
+
+void tw_release(SlabPool *pool, TimerWheel *tw)
+{
+    for (int level = 0; level <= TW_LEVELS; level++)
+    {
+        for (int slot = 0; slot < (level < TW_LEVELS ? TW_SLOTS : 1); slot++)
+        {
+            TimerNode *node = level < TW_LEVELS ? tw->slots[level][slot] : tw->overflow;
+            while (node)
+            {
+                TimerNode *next = node->next;
+                slab_free(pool, MEM_EXPIRES, node, sizeof(TimerNode));
+                node = next;
+            }
+        }
+    }
+    tw_init(tw, tw->current);
+}
+
+TimerNode *tw_add(SlabPool *pool, TimerWheel *tw, void *owner, int64_t when)
+{
+    TimerNode *node = (TimerNode *)slab_alloc(pool, MEM_EXPIRES, sizeof(TimerNode));
+    if (!node)
+        return NULL;
+
+    node->owner = owner;
+    node->when = when;
+    tw_link(tw, node);
+    tw->count++;
+    return node;
+}
+
+void tw_update(TimerWheel *tw, TimerNode *node, int64_t when)
+{
+    tw_unlink(tw, node);
+    node->when = when;
+    tw_link(tw, node);
+}
+
+void tw_remove(SlabPool *pool, TimerWheel *tw, TimerNode *node)
+{
+    tw_unlink(tw, node);
+    tw->count--;
+    slab_free(pool, MEM_EXPIRES, node, sizeof(TimerNode));
+}
+
+TimerNode *tw_next_due(TimerWheel *tw, int64_t now)
+{
+    for (;;)
+    {
+        // Find the earliest non-empty slot: at level 0 from the current
+        // tick on, at higher levels strictly after the current slot
+        int level;
+        for (level = 0; level < TW_LEVELS; level++)
+        {
+            int shift = TW_LEVEL_BITS * level;
+            int index = (int)(((uint64_t)tw->current >> shift) & TW_SLOT_MASK);
+            uint64_t pending = tw->occupied[level];
+            if (level == 0)
+                pending &= ~(uint64_t)0 << index;
+            else
+                pending &= index == TW_SLOT_MASK ? 0 : ~(uint64_t)0 << (index + 1);
+            if (!pending)
+                continue;
+
+            int slot = __builtin_ctzll(pending);
+            uint64_t base = (uint64_t)tw->current >> (shift + TW_LEVEL_BITS) << (shift + TW_LEVEL_BITS);
+            int64_t start = (int64_t)(base | ((uint64_t)slot << shift));
+            if (start > now)
+                return NULL;
+
+            tw->current = start;
+            if (level == 0)
+                return tw->slots[0][slot];
+
+            // Entering a higher level slot spreads its timers below
+            tw->occupied[level] &= ~((uint64_t)1 << slot);
+            tw_cascade(tw, &tw->slots[level][slot]);
+            break;
+        }
+
+        if (level < TW_LEVELS)
+            continue;
+
+        // The wheel is empty up to the end of its range; move on to the
+        // next range if it has begun
+        if (!tw->overflow)
+            return NULL;
+        int64_t start = (int64_t)((((uint64_t)tw->current >> TW_RANGE_BITS) + 1) << TW_RANGE_BITS);
+        if (start > now)
+            return NULL;
+        tw->current = start;
+        tw_cascade(tw, &tw->overflow);
+    }
+}
+
+TimerNode *tw_first(const TimerWheel *tw)
+{
+    const TimerNode *list = tw->overflow;
+    for (int level = 0; level < TW_LEVELS; level++)
+    {
+        // Slots before the current one are empty at every level
+        int index = (int)(((uint64_t)tw->current >> (TW_LEVEL_BITS * level)) & TW_SLOT_MASK);
+        uint64_t pending = tw->occupied[level] & (~(uint64_t)0 << index);
+        if (pending)
+        {
+            list = tw->slots[level][__builtin_ctzll(pending)];
+            break;
+        }
+    }
+
+    // Timers of a slot above level 0 are not ordered
+    const TimerNode *first = list;
+    int scanned = 0;
+    for (const TimerNode *node = list; node && scanned < TW_SCAN_LIMIT; node = node->next, scanned++)
+    {
+        if (node->when < first->when)
+            first = node;
+    }
+    return (TimerNode *)first;
+}
+
+TimerNode *tw_random(const TimerWheel *tw)
+{
+    int occupied = 0;
+    for (int level = 0; level < TW_LEVELS; level++)
+        occupied += __builtin_popcountll(tw->occupied[level]);
+
+    const TimerNode *list = tw->overflow;
+    if (occupied > 0)
+    {
+        int pick = (int)(random_u64() % (uint64_t)occupied);
+        for (int level = 0; level < TW_LEVELS; level++)
+        {
+            uint64_t bits = tw->occupied[level];
+            int count = __builtin_popcountll(bits);
+            if (pick >= count)
+            {
+                pick -= count;
+                continue;
+            }
+            while (pick-- > 0)
+                bits &= bits - 1;
+            list = tw->slots[level][__builtin_ctzll(bits)];
+            break;
+        }
+    }
+    if (!list)
+        return NULL;
+
+    // A random position among the first timers of the slot
+    const TimerNode *node = list;
+    for (int skip = (int)(random_u64() % TW_SCAN_LIMIT); skip > 0; skip--)
+        node = node->next ? node->next : list;
+    return (TimerNode *)node;
+}
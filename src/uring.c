@@ -0,0 +1,222 @@
+// syscall() is not declared at the POSIX feature level the tree builds with
+#define _DEFAULT_SOURCE
+#include "../include/uring.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+bool uring_init(Uring *ring, unsigned entries)
+{
+    memset(ring, 0, sizeof(*ring));
+
+    // Completions are only processed when this thread enters the kernel,
+    // which it does once per batch anyway; older kernels do without
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    ring->fd = uring_setup(entries, &params);
+    if (ring->fd < 0 && errno == EINVAL)
+    {
+        memset(&params, 0, sizeof(params));
+        ring->fd = uring_setup(entries, &params);
+    }
+    if (ring->fd < 0)
+        return false;
+    ring->features = params.features;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+    {
+        ring->sq_ring = NULL;
+        uring_free(ring);
+        return false;
+    }
+
+    ring->cq_ring = ring->sq_ring;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                             ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED)
+        {
+            ring->cq_ring = NULL;
+            uring_free(ring);
+            return false;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                             ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        uring_free(ring);
+        return false;
+    }
+
+    char *sq = (char *)ring->sq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_local_tail = *ring->sq_tail;
+
+    char *cq = (char *)ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Submission slots map one to one to entries
+    for (unsigned i = 0; i < ring->sq_entries; i++)
+        ring->sq_array[i] = i;
+    return true;
+}
+
+void uring_free(Uring *ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(Uring *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries)
+        return NULL;
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+    ring->sq_local_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit(Uring *ring, unsigned wait_nr)
+{
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    // Entering for completions also runs deferred completion work
+    int result = uring_enter(ring->fd, to_submit, wait_nr, IORING_ENTER_GETEVENTS);
+    return result < 0 ? -errno : result;
+}
+
+struct io_uring_cqe *uring_peek_cqe(Uring *ring)
+{
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(Uring *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool uring_buf_ring_init(Uring *ring, UringBufRing *buffers, uint16_t group, unsigned entries, size_t buffer_size)
+{
+    memset(buffers, 0, sizeof(*buffers));
+
+    // The ring is shared with the kernel and must be page aligned
+    void *mem = NULL;
+    size_t ring_size = entries * sizeof(struct io_uring_buf);
+    int error = posix_memalign(&mem, (size_t)sysconf(_SC_PAGESIZE), ring_size);
+    if (error != 0)
+    {
+        errno = error;
+        return false;
+    }
+    memset(mem, 0, ring_size);
+
+    buffers->buffers = (char *)malloc(entries * buffer_size);
+    if (!buffers->buffers)
+    {
+        free(mem);
+        errno = ENOMEM;
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)mem;
+    reg.ring_entries = entries;
+    reg.bgid = group;
+    if (uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        free(buffers->buffers);
+        free(mem);
+        buffers->buffers = NULL;
+        return false;
+    }
+
+    buffers->ring = (struct io_uring_buf_ring *)mem;
+    buffers->entries = entries;
+    buffers->buffer_size = buffer_size;
+    buffers->group = group;
+    for (unsigned i = 0; i < entries; i++)
+        uring_buf_ring_recycle(buffers, (uint16_t)i);
+    return true;
+}
+
+void uring_buf_ring_free(Uring *ring, UringBufRing *buffers)
+{
+    if (!buffers->ring)
+        return;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = buffers->group;
+    uring_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    free(buffers->ring);
+    free(buffers->buffers);
+    memset(buffers, 0, sizeof(*buffers));
+}
+
+void uring_buf_ring_recycle(UringBufRing *buffers, uint16_t id)
+{
+    struct io_uring_buf *buf = &buffers->ring->bufs[buffers->tail & (buffers->entries - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buf_data(buffers, id);
+    buf->len = (uint32_t)buffers->buffer_size;
+    buf->bid = id;
+    buffers->tail++;
+    __atomic_store_n(&buffers->ring->tail, buffers->tail, __ATOMIC_RELEASE);
+}
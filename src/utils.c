@@ -1,35 +1,43 @@
 #define _POSIX_C_SOURCE 200809L
 #include "../include/utils.h"
+#include "../include/log.h"
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <time.h>
 
 // Free token array
-void free_tokens(char **tokens, int count)
+void free_tokens(sds *tokens, int count)
 {
     if (!tokens)
         return;
 
     for (int i = 0; i < count; i++)
     {
-        free(tokens[i]);
+        sds_free(tokens[i]);
     }
 
     free(tokens);
 }
 
 // Tokenise command string into array of strings (for regular commands, not RESP)
-char **tokenise_command(const char *command, int *token_count)
+sds *tokenise_command(const char *command, int *token_count)
 {
-    printf("DEBUG: tokenise_command called with: '%.100s'\n", command ? command : "NULL");
+    if (log_enabled(LOG_LEVEL_DEBUG) && command)
+    {
+        char escaped[512];
+        size_t command_len = strlen(command);
+        log_escape(escaped, sizeof(escaped), command, command_len < 100 ? command_len : 100);
+        log_debug("tokenise_command called with: '%s%s'", escaped, (command_len > 100) ? "..." : "");
+    }
 
     *token_count = 0;
 
     if (!command || !*command)
     {
-        printf("DEBUG: tokenise_command - empty command\n");
+        log_debug("tokenise_command - empty command");
         return NULL;
     }
 
@@ -63,16 +71,16 @@ char **tokenise_command(const char *command, int *token_count)
         p++;
     }
 
-    printf("DEBUG: tokenise_command - found %d tokens\n", *token_count);
+    log_debug("tokenise_command - found %d tokens", *token_count);
 
     if (*token_count == 0)
         return NULL;
 
     // Allocate token array
-    char **tokens = (char **)malloc(sizeof(char *) * (*token_count));
+    sds *tokens = (sds *)malloc(sizeof(sds) * (*token_count));
     if (!tokens)
     {
-        printf("DEBUG: tokenise_command - failed to allocate tokens array\n");
+        log_debug("tokenise_command - failed to allocate tokens array");
         *token_count = 0;
         return NULL;
     }
@@ -111,20 +119,17 @@ char **tokenise_command(const char *command, int *token_count)
                     token_len -= 2;
                 }
 
-                tokens[token_index] = (char *)malloc(token_len + 1);
+                tokens[token_index] = sds_new_len(token_start, token_len);
                 if (!tokens[token_index])
                 {
-                    printf("DEBUG: tokenise_command - failed to allocate token %d\n", token_index);
+                    log_debug("tokenise_command - failed to allocate token %d", token_index);
                     // Cleanup on failure
                     free_tokens(tokens, *token_count);
                     *token_count = 0;
                     return NULL;
                 }
 
-                strncpy(tokens[token_index], token_start, token_len);
-                tokens[token_index][token_len] = '\0';
-
-                printf("DEBUG: tokenise_command - token %d: '%s'\n", token_index, tokens[token_index]);
+                log_debug("tokenise_command - token %d: '%s'", token_index, tokens[token_index]);
                 token_index++;
             }
         }
@@ -151,24 +156,21 @@ char **tokenise_command(const char *command, int *token_count)
             token_len -= 2;
         }
 
-        tokens[token_index] = (char *)malloc(token_len + 1);
+        tokens[token_index] = sds_new_len(token_start, token_len);
         if (!tokens[token_index])
         {
-            printf("DEBUG: tokenise_command - failed to allocate token %d\n", token_index);
+            log_debug("tokenise_command - failed to allocate token %d", token_index);
             // Cleanup on failure
             free_tokens(tokens, *token_count);
             *token_count = 0;
             return NULL;
         }
 
-        strncpy(tokens[token_index], token_start, token_len);
-        tokens[token_index][token_len] = '\0';
-
-        printf("DEBUG: tokenise_command - token %d: '%s'\n", token_index, tokens[token_index]);
+        log_debug("tokenise_command - token %d: '%s'", token_index, tokens[token_index]);
         token_index++;
     }
 
-    printf("DEBUG: tokenise_command - successfully parsed %d tokens\n", token_index);
+    log_debug("tokenise_command - successfully parsed %d tokens", token_index);
     return tokens;
 }
 
@@ -301,31 +303,25 @@ char *find_complete_resp_command(const char *buffer, size_t buffer_len, size_t *
 }
 
 // RESP protocol parsing
-char **parse_resp_tokens(const char *input, size_t input_len, int *token_count)
+sds *parse_resp_tokens(const char *input, size_t input_len, int *token_count)
 {
     *token_count = 0;
 
     if (!input || input_len == 0)
         return NULL;
 
-    printf("DEBUG: parse_resp_tokens - Raw input (%zu bytes): ", input_len);
-    for (size_t i = 0; i < input_len && i < 100; i++)
+    if (log_enabled(LOG_LEVEL_DEBUG))
     {
-        if (input[i] >= 32 && input[i] <= 126)
-        {
-            printf("%c", input[i]);
-        }
-        else
-        {
-            printf("\\x%02x", (unsigned char)input[i]);
-        }
+        char escaped[512];
+        log_escape(escaped, sizeof(escaped), input, input_len < 100 ? input_len : 100);
+        log_debug("parse_resp_tokens - Raw input (%zu bytes): %s%s", input_len, escaped,
+                  (input_len > 100) ? "..." : "");
     }
-    printf("%s\n", (input_len > 100) ? "..." : "");
 
     // Handle inline commands (non-RESP) - need to tokenize these
     if (input[0] != '*')
     {
-        printf("DEBUG: parse_resp_tokens - Processing as inline command\n");
+        log_debug("parse_resp_tokens - Processing as inline command");
         // Find the end of the command (CRLF or end of string)
         size_t cmd_len = 0;
         for (size_t i = 0; i < input_len; i++)
@@ -346,15 +342,15 @@ char **parse_resp_tokens(const char *input, size_t input_len, int *token_count)
         strncpy(cmd_str, input, cmd_len);
         cmd_str[cmd_len] = '\0';
 
-        printf("DEBUG: parse_resp_tokens - Inline command: '%s'\n", cmd_str);
+        log_debug("parse_resp_tokens - Inline command: '%s'", cmd_str);
 
         // For inline commands, we need to tokenize manually
-        char **tokens = tokenise_command(cmd_str, token_count);
+        sds *tokens = tokenise_command(cmd_str, token_count);
         free(cmd_str);
         return tokens;
     }
 
-    printf("DEBUG: parse_resp_tokens - Processing as RESP array\n");
+    log_debug("parse_resp_tokens - Processing as RESP array");
 
     // Parse RESP array
     // Find first CRLF
@@ -370,19 +366,19 @@ char **parse_resp_tokens(const char *input, size_t input_len, int *token_count)
 
     if (first_crlf == 0)
     {
-        printf("DEBUG: parse_resp_tokens - No CRLF found after array size\n");
+        log_debug("parse_resp_tokens - No CRLF found after array size");
         return NULL;
     }
 
     // Parse array size
     int array_size = atoi(input + 1);
-    printf("DEBUG: parse_resp_tokens - Array size: %d\n", array_size);
+    log_debug("parse_resp_tokens - Array size: %d", array_size);
 
     if (array_size <= 0)
         return NULL;
 
     // Allocate array to store parsed elements (this will be our final result)
-    char **tokens = malloc(sizeof(char *) * array_size);
+    sds *tokens = malloc(sizeof(sds) * array_size);
     if (!tokens)
         return NULL;
 
@@ -398,11 +394,11 @@ char **parse_resp_tokens(const char *input, size_t input_len, int *token_count)
     // Parse each bulk string directly into tokens array
     for (int i = 0; i < array_size && !parse_error; i++)
     {
-        printf("DEBUG: parse_resp_tokens - Processing element %d at position %zu\n", i, pos);
+        log_debug("parse_resp_tokens - Processing element %d at position %zu", i, pos);
 
         if (pos >= input_len || input[pos] != '$')
         {
-            printf("DEBUG: parse_resp_tokens - Expected '$' at position %zu, found '%c'\n", pos, (pos < input_len) ? input[pos] : '?');
+            log_debug("parse_resp_tokens - Expected '$' at position %zu, found '%c'", pos, (pos < input_len) ? input[pos] : '?');
             parse_error = true;
             break;
         }
@@ -422,13 +418,13 @@ char **parse_resp_tokens(const char *input, size_t input_len, int *token_count)
 
         if (!found)
         {
-            printf("DEBUG: parse_resp_tokens - No CRLF found after length for element %d\n", i);
+            log_debug("parse_resp_tokens - No CRLF found after length for element %d", i);
             parse_error = true;
             break;
         }
 
         int str_len = atoi(input + pos + 1);
-        printf("DEBUG: parse_resp_tokens - Element %d length: %d\n", i, str_len);
+        log_debug("parse_resp_tokens - Element %d length: %d", i, str_len);
 
         if (str_len < 0)
         {
@@ -440,22 +436,24 @@ char **parse_resp_tokens(const char *input, size_t input_len, int *token_count)
 
         if (pos + str_len + 2 > input_len)
         {
-            printf("DEBUG: parse_resp_tokens - Not enough data for element %d (need %d more bytes)\n", i, (int)(pos + str_len + 2 - input_len));
+            log_debug("parse_resp_tokens - Not enough data for element %d (need %d more bytes)", i, (int)(pos + str_len + 2 - input_len));
             parse_error = true;
             break;
         }
 
-        tokens[i] = malloc(str_len + 1);
+        tokens[i] = sds_new_len(input + pos, str_len);
         if (!tokens[i])
         {
             parse_error = true;
             break;
         }
 
-        memcpy(tokens[i], input + pos, str_len);
-        tokens[i][str_len] = '\0';
-
-        printf("DEBUG: parse_resp_tokens - Token %d: '%s'\n", i, tokens[i]);
+        if (log_enabled(LOG_LEVEL_DEBUG))
+        {
+            char escaped[256];
+            log_escape(escaped, sizeof(escaped), tokens[i], (size_t)str_len);
+            log_debug("parse_resp_tokens - Token %d: '%s'", i, escaped);
+        }
 
         pos += str_len + 2;
     }
@@ -463,17 +461,258 @@ char **parse_resp_tokens(const char *input, size_t input_len, int *token_count)
     // Handle parsing errors - cleanup
     if (parse_error)
     {
-        printf("DEBUG: parse_resp_tokens - Parse error occurred\n");
-        for (int i = 0; i < array_size; i++)
-        {
-            free(tokens[i]);
-        }
-        free(tokens);
+        log_debug("parse_resp_tokens - Parse error occurred");
+        free_tokens(tokens, array_size);
         return NULL;
     }
 
     *token_count = array_size;
-    printf("DEBUG: parse_resp_tokens - Successfully parsed %d tokens\n", array_size);
+    log_debug("parse_resp_tokens - Successfully parsed %d tokens", array_size);
 
     return tokens;
-}
\ No newline at end of file
+}
+// Strict int64 parser; rejects anything that would not format back to the
+// same string
+bool string_to_int64(const char *str, size_t len, int64_t *value)
+{
+    if (len == 0 || len > 20)
+        return false;
+
+    const char *p = str;
+    const char *end = str + len;
+    bool negative = false;
+
+    if (*p == '-')
+    {
+        negative = true;
+        p++;
+        if (p == end)
+            return false;
+    }
+
+    // "0" is the only number allowed to start with a zero ("-0" is not)
+    if (*p == '0')
+    {
+        if (len != 1)
+            return false;
+        *value = 0;
+        return true;
+    }
+
+    // Accumulate as unsigned so INT64_MIN can be represented
+    uint64_t magnitude = 0;
+    for (; p < end; p++)
+    {
+        if (*p < '0' || *p > '9')
+            return false;
+
+        uint64_t digit = (uint64_t)(*p - '0');
+        if (magnitude > (UINT64_MAX - digit) / 10)
+            return false;
+        magnitude = magnitude * 10 + digit;
+    }
+
+    if (negative)
+    {
+        if (magnitude > (uint64_t)INT64_MAX + 1)
+            return false;
+        *value = (int64_t)(0 - magnitude);
+    }
+    else
+    {
+        if (magnitude > (uint64_t)INT64_MAX)
+            return false;
+        *value = (int64_t)magnitude;
+    }
+    return true;
+}
+
+size_t int64_to_string(int64_t value, char *buf)
+{
+    char digits[20];
+    size_t count = 0;
+
+    // Work on the unsigned magnitude so INT64_MIN does not overflow
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    do
+    {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+
+    size_t len = 0;
+    if (value < 0)
+        buf[len++] = '-';
+    while (count)
+        buf[len++] = digits[--count];
+    buf[len] = '\0';
+    return len;
+}
+
+static bool glob_char_equal(char a, char b, bool nocase)
+{
+    if (nocase)
+        return tolower((unsigned char)a) == tolower((unsigned char)b);
+    return a == b;
+}
+
+// Match c against the single pattern element at pattern[*pos] ('?', a
+// [class], an escaped or a literal character) and advance *pos past it
+static bool glob_match_one(const char *pattern, size_t pattern_len, size_t *pos, char c, bool nocase)
+{
+    size_t p = *pos;
+
+    if (pattern[p] == '?')
+    {
+        *pos = p + 1;
+        return true;
+    }
+
+    if (pattern[p] == '[')
+    {
+        p++;
+        bool negate = p < pattern_len && pattern[p] == '^';
+        if (negate)
+            p++;
+
+        bool matched = false;
+        while (p < pattern_len && pattern[p] != ']')
+        {
+            if (pattern[p] == '\\' && p + 1 < pattern_len)
+                p++;
+
+            char low = pattern[p];
+            if (p + 2 < pattern_len && pattern[p + 1] == '-' && pattern[p + 2] != ']')
+            {
+                char high = pattern[p + 2];
+                if (low > high)
+                {
+                    char tmp = low;
+                    low = high;
+                    high = tmp;
+                }
+                unsigned char u = (unsigned char)c;
+                if (nocase)
+                    u = (unsigned char)tolower(u);
+                if (u >= (unsigned char)(nocase ? tolower((unsigned char)low) : low) &&
+                    u <= (unsigned char)(nocase ? tolower((unsigned char)high) : high))
+                    matched = true;
+                p += 3;
+            }
+            else
+            {
+                if (glob_char_equal(low, c, nocase))
+                    matched = true;
+                p++;
+            }
+        }
+
+        // An unterminated class runs to the end of the pattern
+        *pos = p < pattern_len ? p + 1 : p;
+        return matched != negate;
+    }
+
+    if (pattern[p] == '\\' && p + 1 < pattern_len)
+        p++;
+
+    *pos = p + 1;
+    return glob_char_equal(pattern[p], c, nocase);
+}
+
+bool glob_match(const char *pattern, size_t pattern_len, const char *str, size_t str_len, bool nocase)
+{
+    size_t p = 0;
+    size_t s = 0;
+
+    // On a mismatch, retry from the last '*' with it consuming one more byte;
+    // earlier stars never need revisiting, so matching stays polynomial
+    size_t star_p = SIZE_MAX;
+    size_t star_s = 0;
+
+    while (s < str_len)
+    {
+        if (p < pattern_len && pattern[p] == '*')
+        {
+            star_p = ++p;
+            star_s = s;
+            continue;
+        }
+
+        if (p < pattern_len)
+        {
+            size_t next = p;
+            if (glob_match_one(pattern, pattern_len, &next, str[s], nocase))
+            {
+                p = next;
+                s++;
+                continue;
+            }
+        }
+
+        if (star_p == SIZE_MAX)
+            return false;
+        p = star_p;
+        s = ++star_s;
+    }
+
+    while (p < pattern_len && pattern[p] == '*')
+        p++;
+    return p == pattern_len;
+}
+
+size_t glob_literal_prefix(const char *pattern, size_t pattern_len)
+{
+    size_t i = 0;
+    while (i < pattern_len && pattern[i] != '*' && pattern[i] != '?' && pattern[i] != '[' && pattern[i] != '\\')
+        i++;
+    return i;
+}
+
+static __thread int64_t g_cached_ms = 0;
+
+int64_t clock_refresh_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    g_cached_ms = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    return g_cached_ms;
+}
+
+int64_t clock_cached_ms(void)
+{
+    if (g_cached_ms == 0)
+        return clock_refresh_ms();
+    return g_cached_ms;
+}
+
+static __thread uint64_t g_random_state = 0;
+
+uint64_t random_u64(void)
+{
+    if (g_random_state == 0)
+        g_random_state = ((uint64_t)time(NULL) << 20) ^ (uint64_t)(uintptr_t)&g_random_state ^ 1;
+
+    // xorshift64*
+    uint64_t x = g_random_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    g_random_state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t reverse_bits(uint64_t v)
+{
+    v = ((v >> 1) & 0x5555555555555555ULL) | ((v & 0x5555555555555555ULL) << 1);
+    v = ((v >> 2) & 0x3333333333333333ULL) | ((v & 0x3333333333333333ULL) << 2);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((v & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return __builtin_bswap64(v);
+}
+
+uint64_t scan_cursor_next(uint64_t cursor, uint64_t mask)
+{
+    // Setting the bits above the mask makes the carry of the reversed
+    // increment run off the top instead of into them
+    cursor |= ~mask;
+    return reverse_bits(reverse_bits(cursor) + 1);
+}